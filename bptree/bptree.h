@@ -0,0 +1,487 @@
+#if !defined __BPTREE_H
+
+#define __BPTREE_H
+
+#include <cstring>
+
+#include <count_alloc/slab_alloc.h>
+#include <key_utils/key_utils.h>
+#include <bucket_structs/key_search.h>
+#include <bucket_structs/bucket_iterator.h>
+
+// A BPTree leaf's keys and values. A set's leaf (ValueType = void) has only
+// keys, which are its values too.
+template <class KeyType, class ValueType, int N> struct BPTreeLeafArrays
+{
+    KeyType keys[N];
+    ValueType values[N];
+};
+
+template <class KeyType, int N> struct BPTreeLeafArrays<KeyType, void, N>
+{
+    union
+    {
+        KeyType keys[N];
+        KeyType values[N];
+    };
+};
+
+// A B+-tree whose nodes are fixed arrays sized to a whole number of cache
+// lines: INNER_LINES for inner nodes and LEAF_LINES for leaves. Keys are
+// kept apart from the child pointers (or values), so a node's keys sit in
+// as few lines as possible, and they're searched with KeySearch (vectorized
+// for 32 and 64-bit integer keys). The leaves are a doubly linked list, in
+// order, so they iterate as buckets do (see BucketIterator).
+//
+// An inner node with num keys has num + 1 children, and every key in
+// children[i + 1] is >= keys[i] and every key in children[i] is < keys[i].
+// Nodes other than the root are kept at least half full.
+//
+// Nodes are allocated through Alloc (see slab_alloc.h), which cache line
+// aligns them, and counted if count_mem.
+//
+// With ValueType = void it's a set (see ValueTypeInfo): leaves hold only
+// keys, so about twice as many of them.
+template <class KeyType, class ValueType, bool count_mem = false, class Alloc = SlabAlloc<>, int INNER_LINES = 4, int LEAF_LINES = 8> class BPTree
+{
+    typedef ValueTypeInfo<KeyType, ValueType> ValueInfo;
+    typedef typename ValueInfo::Value Value;
+
+    static const int LINE = Alloc::CACHE_LINE_SIZE;
+    // Room is left for the count, and for the leaves' list pointers.
+    static const int INNER_KEYS = (LINE * INNER_LINES - 2 * sizeof(void*)) / (sizeof(KeyType) + sizeof(void*));
+    static const int LEAF_KEYS = (LINE * LEAF_LINES - 3 * sizeof(void*)) / (sizeof(KeyType) + ValueInfo::STORED_BYTES);
+    static const int MIN_INNER_KEYS = INNER_KEYS / 2;
+    static const int MIN_LEAF_KEYS = LEAF_KEYS / 2;
+    // Enough for any tree that fits in memory, the fanout being at least 3.
+    static const int MAX_HEIGHT = 64;
+
+    typedef KeySearch<KeyType> Search;
+
+    struct alignas(LINE) Leaf : BPTreeLeafArrays<KeyType, ValueType, LEAF_KEYS>
+    {
+        Leaf* prev;
+        Leaf* next;
+        int num_elems;
+
+        inline int lower_bound(const KeyType& key)
+        {
+            return Search::lower_bound(this->keys, num_elems, key);
+        }
+        inline const KeyType& get_key(int i) const
+        {
+            return this->keys[i];
+        }
+        ALLOC_MEMORY(Alloc, count_mem)
+    };
+    struct alignas(LINE) Inner
+    {
+        KeyType keys[INNER_KEYS];
+        void* children[INNER_KEYS + 1];
+        int num;
+
+        ALLOC_MEMORY(Alloc, count_mem)
+    };
+
+    static_assert(sizeof(Inner) == LINE * INNER_LINES, "BPTree inner nodes must fill their cache lines");
+    static_assert(sizeof(Leaf) == LINE * LEAF_LINES, "BPTree leaves must fill their cache lines");
+
+    // A leaf when height is 0, else an Inner.
+    void* root;
+    int height;
+
+    // The leaf key belongs in. If path isn't 0, the inner nodes on the way
+    // down are left in path[height], .., path[1] and the child taken from
+    // each in slot.
+    Leaf* find_leaf(const KeyType& key, Inner** path = 0, int* slot = 0) const
+    {
+        void* n = root;
+        for(int h = height; h > 0; h--)
+        {
+            Inner* in = static_cast<Inner*>(n);
+            int i = Search::upper_bound(in->keys, in->num, key);
+            if(path)
+            {
+                path[h] = in;
+                slot[h] = i;
+            }
+            n = in->children[i];
+        }
+        return static_cast<Leaf*>(n);
+    }
+    Leaf* first_leaf() const
+    {
+        void* n = root;
+        for(int h = height; h > 0; h--)
+        {
+            n = static_cast<Inner*>(n)->children[0];
+        }
+        return static_cast<Leaf*>(n);
+    }
+    Leaf* last_leaf() const
+    {
+        void* n = root;
+        for(int h = height; h > 0; h--)
+        {
+            Inner* in = static_cast<Inner*>(n);
+            n = in->children[in->num];
+        }
+        return static_cast<Leaf*>(n);
+    }
+    // A set's values are its keys, so these leave them to the keys' moves.
+    static inline void move_values(Value* to, const Value* from, int n)
+    {
+        if(!ValueInfo::IS_SET)
+        {
+            memmove(to, from, n * sizeof(Value));
+        }
+        return;
+    }
+    static inline void set_value(Leaf* leaf, int i, const Value& value)
+    {
+        if(!ValueInfo::IS_SET)
+        {
+            leaf->values[i] = value;
+        }
+        return;
+    }
+    static void leaf_insert_at(Leaf* leaf, int i, const KeyType& key, const Value& value)
+    {
+        int n = leaf->num_elems - i;
+        memmove(leaf->keys + i + 1, leaf->keys + i, n * sizeof(KeyType));
+        move_values(leaf->values + i + 1, leaf->values + i, n);
+        leaf->keys[i] = key;
+        set_value(leaf, i, value);
+        leaf->num_elems++;
+        return;
+    }
+    static void leaf_remove_at(Leaf* leaf, int i)
+    {
+        int n = leaf->num_elems - i - 1;
+        memmove(leaf->keys + i, leaf->keys + i + 1, n * sizeof(KeyType));
+        move_values(leaf->values + i, leaf->values + i + 1, n);
+        leaf->num_elems--;
+        return;
+    }
+    // Put key and child (to its right) at i and i + 1 of a non-full in.
+    static void inner_insert_at(Inner* in, int i, const KeyType& key, void* child)
+    {
+        int n = in->num - i;
+        memmove(in->keys + i + 1, in->keys + i, n * sizeof(KeyType));
+        memmove(in->children + i + 2, in->children + i + 1, n * sizeof(void*));
+        in->keys[i] = key;
+        in->children[i + 1] = child;
+        in->num++;
+        return;
+    }
+    // Take key i and the child to its right out of in.
+    static void inner_remove_at(Inner* in, int i)
+    {
+        int n = in->num - i - 1;
+        memmove(in->keys + i, in->keys + i + 1, n * sizeof(KeyType));
+        memmove(in->children + i + 1, in->children + i + 2, n * sizeof(void*));
+        in->num--;
+        return;
+    }
+    // Split the full leaf in two, putting key and value where they belong
+    // at i. The new right half is returned, the key to separate them being
+    // its first.
+    Leaf* split_leaf(Leaf* leaf, int i, const KeyType& key, const Value& value)
+    {
+        Leaf* right = new Leaf;
+        int mid = LEAF_KEYS / 2;
+        right->num_elems = LEAF_KEYS - mid;
+        memcpy(right->keys, leaf->keys + mid, right->num_elems * sizeof(KeyType));
+        move_values(right->values, leaf->values + mid, right->num_elems);
+        leaf->num_elems = mid;
+        right->prev = leaf;
+        right->next = leaf->next;
+        if(leaf->next)
+        {
+            leaf->next->prev = right;
+        }
+        leaf->next = right;
+        if(i <= mid)
+        {
+            leaf_insert_at(leaf, i, key, value);
+        }
+        else
+        {
+            leaf_insert_at(right, i - mid, key, value);
+        }
+        return right;
+    }
+    // Split the full in, with key and child going in at i. The new right
+    // half is returned and key is set to the one to separate them, which
+    // neither keeps.
+    Inner* split_inner(Inner* in, int i, KeyType& key, void* child)
+    {
+        KeyType keys[INNER_KEYS + 1];
+        void* children[INNER_KEYS + 2];
+        memcpy(keys, in->keys, i * sizeof(KeyType));
+        keys[i] = key;
+        memcpy(keys + i + 1, in->keys + i, (INNER_KEYS - i) * sizeof(KeyType));
+        memcpy(children, in->children, (i + 1) * sizeof(void*));
+        children[i + 1] = child;
+        memcpy(children + i + 2, in->children + i + 1, (INNER_KEYS - i) * sizeof(void*));
+
+        Inner* right = new Inner;
+        int mid = (INNER_KEYS + 1) / 2;
+        in->num = mid;
+        memcpy(in->keys, keys, mid * sizeof(KeyType));
+        memcpy(in->children, children, (mid + 1) * sizeof(void*));
+        right->num = INNER_KEYS - mid;
+        memcpy(right->keys, keys + mid + 1, right->num * sizeof(KeyType));
+        memcpy(right->children, children + mid + 1, (right->num + 1) * sizeof(void*));
+        key = keys[mid];
+        return right;
+    }
+    // The leaf (child s of parent) is one short of half full: take a key
+    // from a sibling that can spare one, else merge with a sibling, taking
+    // a key and child out of parent.
+    void fix_leaf(Leaf* leaf, Inner* parent, int s)
+    {
+        Leaf* left = s > 0 ? static_cast<Leaf*>(parent->children[s - 1]) : 0;
+        Leaf* right = s < parent->num ? static_cast<Leaf*>(parent->children[s + 1]) : 0;
+        if(left && left->num_elems > MIN_LEAF_KEYS)
+        {
+            int last = left->num_elems - 1;
+            leaf_insert_at(leaf, 0, left->keys[last], left->values[last]);
+            left->num_elems--;
+            parent->keys[s - 1] = leaf->keys[0];
+        }
+        else if(right && right->num_elems > MIN_LEAF_KEYS)
+        {
+            leaf->keys[leaf->num_elems] = right->keys[0];
+            set_value(leaf, leaf->num_elems, right->values[0]);
+            leaf->num_elems++;
+            leaf_remove_at(right, 0);
+            parent->keys[s] = right->keys[0];
+        }
+        else
+        {
+            // Merge the right one of the pair into the left.
+            if(left)
+            {
+                right = leaf;
+                s--;
+            }
+            else
+            {
+                left = leaf;
+            }
+            memcpy(left->keys + left->num_elems, right->keys, right->num_elems * sizeof(KeyType));
+            move_values(left->values + left->num_elems, right->values, right->num_elems);
+            left->num_elems += right->num_elems;
+            left->next = right->next;
+            if(right->next)
+            {
+                right->next->prev = left;
+            }
+            delete right;
+            inner_remove_at(parent, s);
+        }
+        return;
+    }
+    // As fix_leaf, for an inner node.
+    void fix_inner(Inner* in, Inner* parent, int s)
+    {
+        Inner* left = s > 0 ? static_cast<Inner*>(parent->children[s - 1]) : 0;
+        Inner* right = s < parent->num ? static_cast<Inner*>(parent->children[s + 1]) : 0;
+        if(left && left->num > MIN_INNER_KEYS)
+        {
+            // Rotate through the parent's key.
+            memmove(in->keys + 1, in->keys, in->num * sizeof(KeyType));
+            memmove(in->children + 1, in->children, (in->num + 1) * sizeof(void*));
+            in->keys[0] = parent->keys[s - 1];
+            in->children[0] = left->children[left->num];
+            in->num++;
+            parent->keys[s - 1] = left->keys[left->num - 1];
+            left->num--;
+        }
+        else if(right && right->num > MIN_INNER_KEYS)
+        {
+            in->keys[in->num] = parent->keys[s];
+            in->children[in->num + 1] = right->children[0];
+            in->num++;
+            parent->keys[s] = right->keys[0];
+            memmove(right->keys, right->keys + 1, (right->num - 1) * sizeof(KeyType));
+            memmove(right->children, right->children + 1, right->num * sizeof(void*));
+            right->num--;
+        }
+        else
+        {
+            if(left)
+            {
+                right = in;
+                s--;
+            }
+            else
+            {
+                left = in;
+            }
+            // The parent's key comes down between them.
+            left->keys[left->num] = parent->keys[s];
+            memcpy(left->keys + left->num + 1, right->keys, right->num * sizeof(KeyType));
+            memcpy(left->children + left->num + 1, right->children, (right->num + 1) * sizeof(void*));
+            left->num += right->num + 1;
+            delete right;
+            inner_remove_at(parent, s);
+        }
+        return;
+    }
+    void free_subtree(void* n, int h)
+    {
+        if(h == 0)
+        {
+            delete static_cast<Leaf*>(n);
+            return;
+        }
+        Inner* in = static_cast<Inner*>(n);
+        for(int i = 0; i <= in->num; i++)
+        {
+            free_subtree(in->children[i], h - 1);
+        }
+        delete in;
+        return;
+    }
+public:
+    // In-order iteration along the leaves (see BucketIterator). Any insert
+    // or remove invalidates an Iterator.
+    typedef BucketIterator<KeyType, Value, Leaf> Iterator;
+
+    BPTree()
+    {
+        Leaf* leaf = new Leaf;
+        leaf->prev = leaf->next = 0;
+        leaf->num_elems = 0;
+        root = leaf;
+        height = 0;
+        return;
+    }
+    // Sets key's value if it's there already.
+    void insert(const KeyType& key, const Value& value)
+    {
+        Inner* path[MAX_HEIGHT + 1];
+        int slot[MAX_HEIGHT + 1];
+        Leaf* leaf = find_leaf(key, path, slot);
+        int i = leaf->lower_bound(key);
+        if(i < leaf->num_elems && !(key < leaf->keys[i]))
+        {
+            set_value(leaf, i, value);
+            return;
+        }
+        if(leaf->num_elems < LEAF_KEYS)
+        {
+            leaf_insert_at(leaf, i, key, value);
+            return;
+        }
+        // Split up the path until a node has room for the new child.
+        void* child = split_leaf(leaf, i, key, value);
+        KeyType sep = static_cast<Leaf*>(child)->keys[0];
+        for(int h = 1; h <= height; h++)
+        {
+            if(path[h]->num < INNER_KEYS)
+            {
+                inner_insert_at(path[h], slot[h], sep, child);
+                return;
+            }
+            child = split_inner(path[h], slot[h], sep, child);
+        }
+        Inner* new_root = new Inner;
+        new_root->num = 1;
+        new_root->keys[0] = sep;
+        new_root->children[0] = root;
+        new_root->children[1] = child;
+        root = new_root;
+        height++;
+        return;
+    }
+    // For a set.
+    void insert(const KeyType& key)
+    {
+        static_assert(ValueInfo::IS_SET, "insert(key) is for sets, which have ValueType void");
+        insert(key, key);
+        return;
+    }
+    Value* search(const KeyType& key)
+    {
+        Leaf* leaf = find_leaf(key);
+        int i = leaf->lower_bound(key);
+        if(i < leaf->num_elems && !(key < leaf->keys[i]))
+        {
+            return &leaf->values[i];
+        }
+        return 0;
+    }
+    // The value of the largest key <= key (0 if there's none). Only the
+    // root leaf can be empty, so if key's leaf has nothing <= key, the
+    // previous leaf's last key is the one.
+    Value* locate(const KeyType& key)
+    {
+        Leaf* leaf = find_leaf(key);
+        int i = Search::upper_bound(leaf->keys, leaf->num_elems, key);
+        if(i > 0)
+        {
+            return &leaf->values[i - 1];
+        }
+        leaf = leaf->prev;
+        return leaf ? &leaf->values[leaf->num_elems - 1] : 0;
+    }
+    void remove(const KeyType& key)
+    {
+        Inner* path[MAX_HEIGHT + 1];
+        int slot[MAX_HEIGHT + 1];
+        Leaf* leaf = find_leaf(key, path, slot);
+        int i = leaf->lower_bound(key);
+        if(i == leaf->num_elems || key < leaf->keys[i])
+        {
+            return;
+        }
+        leaf_remove_at(leaf, i);
+        // The separators above needn't change: they still divide the keys.
+        if(height == 0 || leaf->num_elems >= MIN_LEAF_KEYS)
+        {
+            return;
+        }
+        fix_leaf(leaf, path[1], slot[1]);
+        for(int h = 1; h < height && path[h]->num < MIN_INNER_KEYS; h++)
+        {
+            fix_inner(path[h], path[h + 1], slot[h + 1]);
+        }
+        Inner* top = static_cast<Inner*>(root);
+        if(top->num == 0)
+        {
+            root = top->children[0];
+            height--;
+            delete top;
+        }
+        return;
+    }
+    Iterator first()
+    {
+        return Iterator::first(first_leaf());
+    }
+    Iterator last()
+    {
+        return Iterator::last(last_leaf());
+    }
+    // At the smallest key >= key.
+    Iterator lower_bound(const KeyType& key)
+    {
+        return Iterator::lower_bound(find_leaf(key), key);
+    }
+    // callback(key, value) for every key in [lo, hi], in order.
+    template <class Callback> void scan(const KeyType& lo, const KeyType& hi, Callback callback)
+    {
+        lower_bound(lo).scan(hi, callback);
+        return;
+    }
+    ~BPTree()
+    {
+        free_subtree(root, height);
+        return;
+    }
+};
+
+#endif
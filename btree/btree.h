@@ -45,6 +45,8 @@ at: http://www.mars.dti.ne.jp/~torao/program/structure/btree.html
 #include <iostream>
 #include <vector>
 
+#include <key_utils/key_utils.h>
+
 using namespace std;
 
 #define null_ptr 0
@@ -85,12 +87,43 @@ public:
 		mp_subtree = other.mp_subtree;
 		return *this;
 	}
+	payload* payload_ptr () { return &m_payload; }
+	void set_payload (const payload& p) { m_payload = p; }
+	void clear_payload () { m_payload = 0; }
 	Element () { mp_subtree = null_ptr; }
 }; //______________________________________________________________________
 
 // Note from Nicholas: I apologize to humanity for this line of code.
 template <class key, class payload> Node<Element<key, payload> >* Element<key, payload>::invalid_ptr = reinterpret_cast<Node<Element>*>(0xFFFFFFFF);
 
+template<class key> class Element<key, void> {
+// the element of a set (see ValueTypeInfo): no payload, the key stands in
+// for it.
+	static Node<Element>* invalid_ptr;
+public:
+	key m_key;
+	Node<Element>* mp_subtree;
+public:
+	bool operator>   (Element& other) const { return m_key >  other.m_key; }
+	bool operator<   (Element& other) const { return m_key <  other.m_key; }
+	bool operator>=  (Element& other) const { return m_key >= other.m_key; }
+	bool operator<=  (Element& other) const { return m_key <= other.m_key; }
+	bool operator==  (Element& other) const { return m_key == other.m_key; }
+	bool valid () const { return mp_subtree != invalid_ptr; }
+	void invalidate () { mp_subtree = invalid_ptr; }
+	Element& operator= (const Element& other) {
+		m_key = other.m_key;
+		mp_subtree = other.mp_subtree;
+		return *this;
+	}
+	key* payload_ptr () { return &m_key; }
+	void set_payload (const key&) { }
+	void clear_payload () { }
+	Element () { mp_subtree = null_ptr; }
+}; //______________________________________________________________________
+
+template <class key> Node<Element<key, void> >* Element<key, void>::invalid_ptr = reinterpret_cast<Node<Element>*>(0xFFFFFFFF);
+
 template <class Elem> class RootTracker;
 
 template <class Elem> class Node {
@@ -135,6 +168,9 @@ public:
     // the root of the tree may change.  this attribute keeps it accessible.
 	RootTracker<Elem>& m_root;
 	Elem& operator[] (int i) { return m_vector[i]; }
+    // for walking the tree in order from outside.
+	int count () { return m_count; }
+	Node<Elem>* parent () { return mp_parent; }
     // node cannot be instantiated without a root tracker
 	Node<Elem> (RootTracker<Elem>& root_track);
 }; 
@@ -384,7 +420,7 @@ template <class Elem> bool Node<Elem>::delete_element (Elem& target) {
 		Elem& smallest_in_subtree =
 			found.mp_subtree->smallest_key_in_subtree();
 		found.m_key = smallest_in_subtree.m_key;
-		found.m_payload = smallest_in_subtree.m_payload;
+		found.set_payload(*smallest_in_subtree.payload_ptr());
 		found.mp_subtree->delete_element (smallest_in_subtree);
 	}
 	return true;
@@ -402,7 +438,7 @@ template <class Elem> Node<Elem>* Node<Elem>::rotate_from_right(int parent_index
 	vector_insert (underflow_filler);
 	right_sib->vector_delete(0);
 	(*right_sib)[0].m_key = 0;
-	(*right_sib)[0].m_payload = 0;
+	(*right_sib)[0].clear_payload();
 	return null_ptr; // parent node still has same element count
 } //_______________________________________________________________________
 template <class Elem> Node<Elem>* Node<Elem>::rotate_from_left(int parent_index_this) {
@@ -561,13 +597,97 @@ template <class Elem> Elem& Node<Elem>::search (Elem& desired, Node<Elem>*& last
 } //_____________________________________________________________________
 
 
+// With ValueType = void it's a set (see ValueTypeInfo), storing no payloads.
 template <class KeyType, class ValueType> class BTree
 {
     typedef Element<KeyType, ValueType> Elem;
+    typedef typename ValueTypeInfo<KeyType, ValueType>::Value Value;
     Elem elem, result;   
-    Node<Elem>* last;
     RootTracker<Elem> tracker;
 public:
+    // In-order iteration, at element idx of node. Stepping off either end
+    // leaves it invalid, and any insert or remove invalidates it.
+    class Iterator
+    {
+        Node<Elem>* node;
+        int idx;
+
+        // The index of child among parent's subtrees.
+        static int child_index(Node<Elem>* parent, Node<Elem>* child)
+        {
+            int i = 0;
+            while((*parent)[i].mp_subtree != child)
+            {
+                i++;
+            }
+            return i;
+        }
+    public:
+        Iterator(Node<Elem>* node, int idx) : node(node), idx(idx) {}
+        inline bool valid() const
+        {
+            return node != 0;
+        }
+        inline const KeyType& key() const
+        {
+            return (*node)[idx].m_key;
+        }
+        inline Value& value() const
+        {
+            return *(*node)[idx].payload_ptr();
+        }
+        void next()
+        {
+            Node<Elem>* s = (*node)[idx].mp_subtree;
+            if(s)
+            {
+                // The leftmost element of the subtree to the right.
+                for(; s; s = (*s)[0].mp_subtree)
+                {
+                    node = s;
+                }
+                idx = 1;
+                return;
+            }
+            idx++;
+            while(node && idx == node->count())
+            {
+                Node<Elem>* child = node;
+                node = node->parent();
+                if(node)
+                {
+                    idx = child_index(node, child) + 1;
+                }
+            }
+            return;
+        }
+        void prev()
+        {
+            Node<Elem>* s = (*node)[idx - 1].mp_subtree;
+            if(s)
+            {
+                // The rightmost element of the subtree to the left.
+                for(; s; s = (*s)[s->count() - 1].mp_subtree)
+                {
+                    node = s;
+                }
+                idx = node->count() - 1;
+                return;
+            }
+            idx--;
+            while(node && !idx)
+            {
+                Node<Elem>* child = node;
+                node = node->parent();
+                if(node)
+                {
+                    idx = child_index(node, child);
+                }
+            }
+            return;
+        }
+    };
+
     BTree()
     {
         Node<Elem>::m_failure.invalidate();
@@ -577,29 +697,68 @@ public:
         tracker.set_root(null_ptr, root_ptr);
         return;
     }
-    void insert(const KeyType& key, const ValueType& value)
+    void insert(const KeyType& key, const Value& value)
     {        
         elem.m_key = key;
-        elem.m_payload = value;
+        elem.set_payload(value);
         tracker.get_root()->tree_insert(elem);
         return;
     }
-    ValueType* search(const KeyType& key)
+    // For a set.
+    void insert(const KeyType& key)
+    {
+        static_assert(ValueTypeInfo<KeyType, ValueType>::IS_SET, "insert(key) is for sets, which have ValueType void");
+        insert(key, key);
+        return;
+    }
+    // search and locate use locals rather than elem and result, so any 
+    // number of threads can search and locate at once.
+    Value* search(const KeyType& key)
     {
-        elem.m_key = key; 
-        result = tracker.get_root()->search(elem, last);
-        return &(result.m_payload);
+        Elem desired;
+        Node<Elem>* last_visited;
+        desired.m_key = key; 
+        return tracker.get_root()->search(desired, last_visited).payload_ptr();
     }
 
-    ValueType* locate(const KeyType& key) 
+    // The value of the largest key <= key (0 if there's none): the
+    // deepest element <= key passed on the way down, or key's own.
+    Value* locate(const KeyType& key) 
     {
-        // This should actually locate, and not just search.
-        // However not doing the locate only biases the results *against*
-        // my own data structures, i.e. making them look (perhaps immesurably)
-        // worse than they really are.
-        elem.m_key = key; 
-        result = tracker.get_root()->search(elem, last);
-        return &(result.m_payload);
+        Elem* pred = 0;
+        Node<Elem>* n = tracker.get_root();
+        if(n->count() == 1)
+        {
+            return 0;
+        }
+        while(n)
+        {
+            // i ends up just past the last element <= key.
+            int i = 1;
+            int j = n->count();
+            while(i < j)
+            {
+                int mid = i + (j - i) / 2;
+                if(key < (*n)[mid].m_key)
+                {
+                    j = mid;
+                }
+                else
+                {
+                    i = mid + 1;
+                }
+            }
+            if(i > 1)
+            {
+                pred = &(*n)[i - 1];
+                if(!(pred->m_key < key))
+                {
+                    break;
+                }
+            }
+            n = (*n)[i - 1].mp_subtree;
+        }
+        return pred ? pred->payload_ptr() : 0;
     }
     void remove(const KeyType& key)
     {
@@ -607,6 +766,75 @@ public:
         tracker.get_root()->delete_element(elem);
         return;
     }
+    Iterator first()
+    {
+        Node<Elem>* n = tracker.get_root();
+        if(n->count() == 1)
+        {
+            return Iterator(0, 0);
+        }
+        while((*n)[0].mp_subtree)
+        {
+            n = (*n)[0].mp_subtree;
+        }
+        return Iterator(n, 1);
+    }
+    Iterator last()
+    {
+        Node<Elem>* n = tracker.get_root();
+        if(n->count() == 1)
+        {
+            return Iterator(0, 0);
+        }
+        while((*n)[n->count() - 1].mp_subtree)
+        {
+            n = (*n)[n->count() - 1].mp_subtree;
+        }
+        return Iterator(n, n->count() - 1);
+    }
+    // At the smallest key >= key: the deepest element >= key passed on
+    // the way down.
+    Iterator lower_bound(const KeyType& key)
+    {
+        Iterator it(0, 0);
+        Node<Elem>* n = tracker.get_root();
+        if(n->count() == 1)
+        {
+            return it;
+        }
+        while(n)
+        {
+            int i = 1;
+            int j = n->count();
+            while(i < j)
+            {
+                int mid = i + (j - i) / 2;
+                if((*n)[mid].m_key < key)
+                {
+                    i = mid + 1;
+                }
+                else
+                {
+                    j = mid;
+                }
+            }
+            if(i < n->count())
+            {
+                it = Iterator(n, i);
+            }
+            n = (*n)[i - 1].mp_subtree;
+        }
+        return it;
+    }
+    // callback(key, value) for every key in [lo, hi], in order.
+    template <class Callback> void scan(const KeyType& lo, const KeyType& hi, Callback callback)
+    {
+        for(Iterator it = lower_bound(lo); it.valid() && !(hi < it.key()); it.next())
+        {
+            callback(it.key(), it.value());
+        }
+        return;
+    }
     ~BTree()
     {
         return;
@@ -5,6 +5,8 @@
 #include <key_utils/key_utils.h>
 #include <btrie/bursters.h>
 #include <count_alloc/count_alloc.h>
+#include <bucket_structs/bucket_iterator.h>
+#include <bucket_structs/bucket_sizer.h>
 
 
 template <class KeyType, class ValueType, class TopStruct, class UpdateLeafBucket, class Bucket, bool count_mem = false> class BTrie
@@ -13,10 +15,11 @@ template <class KeyType, class ValueType, class TopStruct, class UpdateLeafBucke
     typedef typename KeyInfo::BitIdx BitIdx;
     typedef typename TopStruct::Leaf Leaf;
     typedef typename TopStruct::INode INode;
+    typedef typename TopStruct::UpdatePolicy Updates;
     typedef /*unsigned short*/unsigned int ChildIdx;
 
     TopStruct& top_struct;
-    int bucket_size;
+    BucketSizer<KeyType> sizer;
     Bucket* first_bucket;
 
     static const int INITIAL_BUCKET_SIZE = 2;
@@ -25,20 +28,28 @@ template <class KeyType, class ValueType, class TopStruct, class UpdateLeafBucke
     {
         ValueType value;
         int max_bucket_size;
-        /*const*/ TopStruct& ts;
         Bucket*& fb;
     public:
-        CreateLeafBucket(Bucket*& fb, /*const*/ TopStruct& ts, const ValueType& value, int max_bucket_size) : value(value), max_bucket_size(max_bucket_size), ts(ts), fb(fb) {}
-        inline void operator()(INode* parent, const KeyType& leaf_idx, const KeyType& key)
+        CreateLeafBucket(Bucket*& fb, const ValueType& value, int max_bucket_size) : value(value), max_bucket_size(max_bucket_size), fb(fb) {}
+        // The trie hands over the leaf next to the new one, so b goes into
+        // the list beside its bucket without another search.
+        inline void operator()(INode* parent, const KeyType& leaf_idx, const KeyType& key, Leaf* neighbour, bool is_pred)
         {
             Bucket* b = new Bucket(key, value, INITIAL_BUCKET_SIZE, max_bucket_size);
-            
-            KeyType pred_key;
-            Bucket* pred_bucket;
 
             // Link in b to the linked list of buckets
-            if(ts.find_predecessor(key, pred_key, pred_bucket))
+            if(!neighbour)
             {
+                if(fb)
+                {
+                    b->next = fb;
+                    fb->prev = b;
+                }
+                fb = b;
+            }
+            else if(is_pred)
+            {
+                Bucket* pred_bucket = neighbour->value;
                 b->prev = pred_bucket;
                 if(pred_bucket->next)
                 {
@@ -49,18 +60,50 @@ template <class KeyType, class ValueType, class TopStruct, class UpdateLeafBucke
             }
             else
             {
-                if(fb)
+                Bucket* succ_bucket = neighbour->value;
+                b->next = succ_bucket;
+                if(succ_bucket->prev)
                 {
-                    b->next = fb;
-                    fb->prev = b;
+                    b->prev = succ_bucket->prev;
+                    succ_bucket->prev->next = b;
                 }
-                fb = b;
+                else
+                {
+                    fb = b;
+                }
+                succ_bucket->prev = b;
             }
             Leaf* l = new Leaf(key, b);
             parent->add_leaf(l, (ChildIdx)leaf_idx);
+            return;
+        }
+    };
+    class CreateLeafBuckets
+    {
+        const KeyType* keys;
+        const ValueType* values;
+        int max_bucket_size;
+        Bucket*& fb;
+        Bucket* last_bucket;
+    public:
+        CreateLeafBuckets(Bucket*& fb, const KeyType* keys, const ValueType* values, int max_bucket_size) : keys(keys), values(values), max_bucket_size(max_bucket_size), fb(fb), last_bucket(0) {}
+        // Called in key order, so each new bucket goes on the end of the list.
+        inline void operator()(INode* parent, ChildIdx leaf_idx, size_t first, size_t last)
+        {
+            Bucket* b = new Bucket(keys + first, values + first, last - first, max_bucket_size);
+            b->prev = last_bucket;
+            if(last_bucket)
+            {
+                last_bucket->next = b;
+            }
+            else
+            {
+                fb = b;
+            }
+            last_bucket = b;
 
-            update_mem_counter<count_mem,Bucket>(MemCounter::NEW, b);
-            update_mem_counter<count_mem,Leaf>(MemCounter::NEW, l);
+            Leaf* l = new Leaf(keys[first], b);
+            parent->add_leaf(l, leaf_idx);
             return;
         }
     };
@@ -81,28 +124,104 @@ template <class KeyType, class ValueType, class TopStruct, class UpdateLeafBucke
         inline bool operator()(Leaf* l)
         {
             Bucket* b = l->value;
-            if(b->remove(key) && !b->num_elems)
+            if(Updates::COPY_ON_WRITE)
             {
-                if(b->prev) b->prev->next = b->next;
-                if(b->next) b->next->prev = b->prev;
-                if(b == fb) fb = b->next;
-                update_mem_counter<count_mem,Bucket>(MemCounter::DELETE, b);
-                delete b;
-                return true;
+                // Readers may be looking at b, so a copy loses the key
+                // instead, and b is never left empty: it goes with its 
+                // last key.
+                if(!b->search(key))
+                {
+                    return false;
+                }
+                if(b->num_elems > 1)
+                {
+                    Bucket* w = writable_bucket<Updates>(b, fb);
+                    w->remove(key);
+                    publish_bucket<Updates>(l, b, w);
+                    return false;
+                }
             }
-            return false;
+            else if(!b->remove(key) || b->num_elems)
+            {
+                return false;
+            }
+            if(b->prev) b->prev->next = b->next;
+            if(b->next) b->next->prev = b->prev;
+            if(b == fb) fb = b->next;
+            delete b;
+            return true;
+        }
+    };
+    // Tests the bucket of a leaf for read_locate (see LPCTrie::read_predecessor_leaf),
+    // setting result to the value of the largest key <= key if it has one.
+    class ReadLocate
+    {
+        const KeyType& key;
+        ValueType*& result;
+    public:
+        ReadLocate(const KeyType& key, ValueType*& result) : key(key), result(result) {}
+        inline bool operator()(Leaf* l)
+        {
+            result = Updates::load(l->value)->locate(key);
+            return result != 0;
         }
     };
+    // Finish a locate, given the bucket general_search found for key.
+    ValueType* locate_in_bucket(const KeyType& key, Bucket* b, typename TopStruct::SearchStatus status)
+    {
+        if(status == TopStruct::FOUND_KEY) // Found a bucket
+        {
+            return b->locate_with_list(key);
+        }
+        else if(status == TopStruct::FOUND_PRED) // Found predecessor
+        {
+            return b->get_max_value_ptr();
+        }
+        // Found successor
+        Bucket* p = b->prev;
+        if(!p)
+        {
+            return 0;
+        }
+        return p->get_max_value_ptr();
+    }
+    // The bucket a locate of key would start in, or 0 if there are none.
+    Bucket* start_bucket(const KeyType& key)
+    {
+        typename TopStruct::SearchStatus status;
+        Bucket** b = top_struct.general_search(key, status);
+        return b ? *b : 0;
+    }
 public:
-    BTrie(TopStruct& top_struct, int bucket_size) : top_struct(top_struct), bucket_size(bucket_size), first_bucket(0)
+    BTrie(TopStruct& top_struct, const BucketSizer<KeyType>& sizer) : top_struct(top_struct), sizer(sizer), first_bucket(0)
+    {
+        return;
+    }
+    // Buckets burst at the new size from their next insert on.
+    void set_bucket_size(int size, bool adaptive = false)
     {
+        sizer.set(size, adaptive);
         return;
     }
     bool insert(const KeyType& key, const ValueType& value)
     {
-        top_struct.insert(key, MatchTester(), CreateLeafBucket(first_bucket, top_struct, value, bucket_size), UpdateLeafBucket(value, top_struct.get_min_children_bits(), first_bucket));
+        top_struct.insert(key, MatchTester(), CreateLeafBucket(first_bucket, value, sizer.size()), UpdateLeafBucket(value, top_struct.get_min_children_bits(), first_bucket, sizer));
+        sizer.note_insert();
         return false;
     }
+    // Build from the n sorted, distinct keys and their values, rather than
+    // inserting them one at a time. Must be called while empty. Each bucket
+    // gets at most fill_factor of the keys it can hold before bursting.
+    void bulk_load(const KeyType* keys, const ValueType* values, size_t n, float fill_factor)
+    {
+        size_t max_keys = fill_factor * (sizer.size() - 1);
+        if(!max_keys)
+        {
+            max_keys = 1;
+        }
+        top_struct.bulk_load(keys, n, max_keys, CreateLeafBuckets(first_bucket, keys, values, sizer.size()));
+        return;
+    }
     void remove(const KeyType& key)
     {
         top_struct.remove_if(key, MatchTester(), RemovePred(key, first_bucket));
@@ -111,6 +230,7 @@ public:
     ValueType* search(const KeyType& key)
     {
         using namespace std;
+        sizer.note_locates();
         Bucket** b;
         if(b = top_struct.search(key, MatchTester()))
         {
@@ -121,6 +241,7 @@ public:
     ValueType* locate(const KeyType& key)
     {
         using namespace std;
+        sizer.note_locates();
         Bucket** b;
 
         typename TopStruct::SearchStatus status;
@@ -130,21 +251,83 @@ public:
         {
             return 0;
         }
-        if(status == TopStruct::FOUND_KEY) // Found a bucket
-        {
-            return (*b)->locate_with_list(key);
-        }
-        else if(status == TopStruct::FOUND_PRED) // Found predecessor
+        return locate_in_bucket(key, *b, status);
+    }
+    // As search and locate, but they only read: with CopyOnWriteUpdates
+    // any number of threads may call them while another updates.
+    ValueType* read_search(const KeyType& key) const
+    {
+        Leaf* l = top_struct.read_leaf(key);
+        return l ? Updates::load(l->value)->search(key) : 0;
+    }
+    ValueType* read_locate(const KeyType& key) const
+    {
+        ValueType* result = 0;
+        Leaf* l = top_struct.read_predecessor_leaf(key, ReadLocate(key, result));
+        if(!l || result)
         {
-            return (*b)->get_max_value_ptr();
+            return result;
         }
-        // Found successor
-        Bucket* p = (*b)->prev;
-        if(!p)
+        return Updates::load(l->value)->get_max_value_ptr();
+    }
+    // out[i] = locate(keys[i]) for i = 0, .., n - 1. The trie descents
+    // of TopStruct::BATCH_SIZE keys at a time are interleaved by the top
+    // structure, then the buckets they lead to are prefetched together
+    // before any of them is searched.
+    void locate_batch(const KeyType* keys, size_t n, ValueType** out)
+    {
+        static const unsigned int BATCH_SIZE = TopStruct::BATCH_SIZE;
+        Bucket** leaf_values[BATCH_SIZE];
+        Bucket* buckets[BATCH_SIZE];
+        typename TopStruct::SearchStatus status[BATCH_SIZE];
+
+        sizer.note_locates(n);
+        for(size_t first = 0; first < n; first += BATCH_SIZE)
         {
-            return 0;
+            unsigned int m = n - first < BATCH_SIZE ? n - first : BATCH_SIZE;
+            top_struct.general_search_batch(keys + first, m, leaf_values, status);
+            for(unsigned int i = 0; i < m; i++)
+            {
+                buckets[i] = leaf_values[i] ? *leaf_values[i] : 0;
+                if(buckets[i])
+                {
+                    __builtin_prefetch(buckets[i]);
+                }
+            }
+            for(unsigned int i = 0; i < m; i++)
+            {
+                if(buckets[i])
+                {
+                    buckets[i]->prefetch(status[i] == TopStruct::FOUND_KEY);
+                }
+            }
+            for(unsigned int i = 0; i < m; i++)
+            {
+                out[first + i] = buckets[i] ? locate_in_bucket(keys[first + i], buckets[i], status[i]) : 0;
+            }
         }
-        return p->get_max_value_ptr();
+        return;
+    }
+    typedef BucketIterator<KeyType, ValueType, Bucket> Iterator;
+
+    Iterator first()
+    {
+        return Iterator::first(first_bucket);
+    }
+    Iterator last()
+    {
+        return Iterator::last(start_bucket(std::numeric_limits<KeyType>::max()));
+    }
+    // At the smallest key >= key.
+    Iterator lower_bound(const KeyType& key)
+    {
+        return Iterator::lower_bound(start_bucket(key), key);
+    }
+    // callback(key, value) for every key in [lo, hi], in order.
+    template <class Callback> void scan(const KeyType& lo, const KeyType& hi, Callback callback)
+    {
+        lower_bound(lo).scan(hi, callback);
+        return;
     }
     void print(std::ostream& out)
     {
@@ -157,7 +340,6 @@ public:
         while(b)
         {
             Bucket* n = b->next;            
-            update_mem_counter<count_mem,Bucket>(MemCounter::DELETE, b);
             delete b;
             b = n;
         }
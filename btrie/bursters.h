@@ -6,11 +6,46 @@
 #include <bucket_structs/bucket_structs.h>
 #include <count_alloc/count_alloc.h>
 
+// The bucket to change in place of b, which is b itself unless Updates
+// is CopyOnWriteUpdates (see LPCTrie). Then it's a copy, which takes b's
+// place in the bucket list, and goes in b's leaf with publish_bucket.
+template <class Updates, class Bucket> Bucket* writable_bucket(Bucket* b, Bucket*& first_bucket)
+{
+    Bucket* w = Updates::writable(b);
+    if(w != b)
+    {
+        if(w->prev)
+        {
+            w->prev->next = w;
+        }
+        else
+        {
+            first_bucket = w;
+        }
+        if(w->next)
+        {
+            w->next->prev = w;
+        }
+    }
+    return w;
+}
+// Replace old, leaf's bucket, with b from writable_bucket(old, ...).
+template <class Updates, class Bucket, class Leaf> void publish_bucket(Leaf* leaf, Bucket* old, Bucket* b)
+{
+    if(b != old)
+    {
+        Updates::store(leaf->value, b);
+        delete old;
+    }
+    return;
+}
+
 template <class KeyType, class ValueType, class LevelPathCompTrie, class Bucket, bool count_mem = false> class LevelPathCompTrieBurst
 {
     typedef typename LevelPathCompTrie::INode INode;
     typedef typename LevelPathCompTrie::Leaf Leaf;
     typedef typename LevelPathCompTrie::ChildIdx ChildIdx;
+    typedef typename LevelPathCompTrie::UpdatePolicy Updates;
 
     typedef KeyTypeInfo<KeyType> KeyInfo;
     typedef typename KeyInfo::BitIdx BitIdx;
@@ -18,16 +53,20 @@ template <class KeyType, class ValueType, class LevelPathCompTrie, class Bucket,
     ValueType value;
     int min_children_bits;
     Bucket*& first_bucket;
+    BucketSizer<KeyType>& sizer;
 public:
-    LevelPathCompTrieBurst(const ValueType& value, int min_children_bits, Bucket*& first_bucket) : value(value), min_children_bits(min_children_bits), first_bucket(first_bucket) {}       
+    LevelPathCompTrieBurst(const ValueType& value, int min_children_bits, Bucket*& first_bucket, BucketSizer<KeyType>& sizer) : value(value), min_children_bits(min_children_bits), first_bucket(first_bucket), sizer(sizer) {}       
     inline void operator()(INode* parent, const KeyType& key, BitIdx shift)
     {
         ChildIdx leaf_idx = KeyInfo::extract_bits(key, shift, parent->num_children_bits);
         Leaf* leaf = parent->leaves[leaf_idx];
-        Bucket* b = leaf->value;
+        Bucket* old = leaf->value;
+        Bucket* b = writable_bucket<Updates>(old, first_bucket);
         
+        b->set_max_capacity(sizer.size());
         if(b->insert(key, value) == BucketData::INSERT_FILLED)
         {
+            sizer.note_full(b->get_min_key(), b->get_key(b->num_elems - 1), b->num_elems);
             // Here we are bursting a bucket.
             // Before inserting the key we have
             //
@@ -60,18 +99,7 @@ public:
             // N.B. S is the longest common prefix of all the keys
             // in the bucket, excluding their common prefix before 
             // node P.
-            INode* splitter = new INode(min_children_bits);
-
-            update_mem_counter<count_mem,INode>(MemCounter::NEW, splitter);
-            // Make the splitter the child of the parent, 
-            // and mark the splitter as an internal node.
-
-            // No need to update the in-node data
-            // structure when adding the splitter, since
-            // a leaf was already at this index.
-            //parent->add_inode(splitter, leaf_idx);
-            parent->inodes[leaf_idx] = splitter;
-            parent->is_internal[leaf_idx] = true;
+            INode* splitter = LevelPathCompTrie::new_inode(min_children_bits);
 
             // Compute the length of the longest common prefix
             // 
@@ -103,11 +131,29 @@ public:
             }
 
             splitter->node_struct->rebuild();
-            update_mem_counter<count_mem,Bucket>(MemCounter::DELETE, b);
-            update_mem_counter<count_mem,Leaf>(MemCounter::DELETE, leaf);
+
+            // Make the splitter the child of the parent, 
+            // and mark the splitter as an internal node.
+            // This is left until the splitter is complete
+            // (see CopyOnWriteUpdates).
+
+            // No need to update the in-node data
+            // structure when adding the splitter, since
+            // a leaf was already at this index.
+            //parent->add_inode(splitter, leaf_idx);
+            parent->set_inode(splitter, leaf_idx);
+
             delete b;
+            if(old != b)
+            {
+                delete old;
+            }
             delete leaf;
         }
+        else
+        {
+            publish_bucket<Updates>(leaf, old, b);
+        }
         return;
     }    
     inline void connect(INode* parent, INode* node, ChildIdx idx, BitIdx shift)
@@ -122,8 +168,6 @@ public:
             first_bucket = z;
         }
 
-        update_mem_counter<count_mem,Bucket>(MemCounter::DELETE, b);
-        update_mem_counter<count_mem,Leaf>(MemCounter::DELETE, l);
         delete b;
         delete l;
         return;
@@ -0,0 +1,78 @@
+#if !defined __CONCURRENT_LPCBTRIE_H
+
+#define __CONCURRENT_LPCBTRIE_H
+
+#include <btrie/lpcbtrie.h>
+#include <bucket_structs/sorted_bucket.h>
+#include <bucket_structs/bucket_sizer.h>
+#include <count_alloc/epoch_alloc.h>
+
+// An LPCBTrie that any number of threads can locate and search in, without
+// taking a lock, while one thread inserts and removes. It's LPCBTrie with
+// CopyOnWriteUpdates (see LPCTrie), allocating through EpochAlloc.
+//
+// EpochAlloc's state is static, and this always uses EpochAlloc<SlabAlloc<> >,
+// so every ConcurrentLPCBTrie, whatever its KeyType and ValueType, shares
+// it: they must all have the same writing thread.
+template <class KeyType, class ValueType, bool count_mem = false> class ConcurrentLPCBTrie
+{
+    typedef EpochAlloc<SlabAlloc<> > Alloc;
+    typedef typename Alloc::ReadGuard ReadGuard;
+    typedef LPCBTrie<KeyType, ValueType, count_mem, Alloc, SortedBucket, CopyOnWriteUpdates> Trie;
+
+    Trie* trie;
+public:
+    explicit ConcurrentLPCBTrie(int bucket_size = BucketSizer<KeyType>::DEFAULT_SIZE) : trie(new Trie(0, BucketSizer<KeyType>(bucket_size)))
+    {
+        return;
+    }
+    // Writer only.
+    void insert(const KeyType& key, const ValueType& value)
+    {
+        trie->insert(key, value);
+        Alloc::end_update();
+        return;
+    }
+    // Writer only.
+    void remove(const KeyType& key)
+    {
+        trie->remove(key);
+        Alloc::end_update();
+        return;
+    }
+    // Any thread. Sets value to the value of the largest key <= key,
+    // returning false if there is no such key.
+    bool locate(const KeyType& key, ValueType& value)
+    {
+        ReadGuard guard;
+        ValueType* v = trie->read_locate(key);
+        if(!v)
+        {
+            return false;
+        }
+        value = *v;
+        return true;
+    }
+    // Any thread. Sets value to key's value, returning false if key is absent.
+    bool search(const KeyType& key, ValueType& value)
+    {
+        ReadGuard guard;
+        ValueType* v = trie->read_search(key);
+        if(!v)
+        {
+            return false;
+        }
+        value = *v;
+        return true;
+    }
+    // Writer only, and there must be no readers left, in this or any
+    // other ConcurrentLPCBTrie.
+    ~ConcurrentLPCBTrie()
+    {
+        delete trie;
+        Alloc::collect();
+        return;
+    }
+};
+
+#endif
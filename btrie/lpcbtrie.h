@@ -7,9 +7,15 @@
 #include <node_structs/node_structs.h>
 #include <btrie/btrie.h>
 
-template <class KeyType, class ValueType, bool count_mem = false> class LPCBTrie
+// Nodes, leaves and buckets are allocated through Alloc (see slab_alloc.h).
+// BucketT is SortedBucket, or ForBucket to store integer keys compressed.
+// With ValueType = void it's a set (see ValueTypeInfo), and SortedBucket
+// stores no values.
+//
+// Updates is InPlaceUpdates or CopyOnWriteUpdates (see LPCTrie). The latter
+// copies buckets, so it needs SortedBucket, and expand_slice must be 0.
+template <class KeyType, class ValueType, bool count_mem = false, class Alloc = SlabAlloc<>, template <class, class, bool, class> class BucketT = SortedBucket, class Updates = InPlaceUpdates> class LPCBTrie
 {
-    static const int MAX_BUCKET_SIZE = 128;
 /*
     typedef SortedBucket<KeyType, ValueType, count_mem> Bucket; 
     typedef SqrtBitSearcher<count_mem> NodeStruct;
@@ -24,43 +30,110 @@ template <class KeyType, class ValueType, bool count_mem = false> class LPCBTrie
 
 
 */    
-    typedef SortedBucket<KeyType, ValueType, count_mem> Bucket; 
-    typedef HeapBitSearcher<count_mem> NodeStruct;
-    typedef LPCTrie<KeyType, Bucket*, NodeStruct, count_mem > LPCTrie_heap;
-    typedef LevelPathCompTrieBurst<KeyType, ValueType, LPCTrie_heap, Bucket, count_mem> LPCTrieBurst;    
+    typedef BucketT<KeyType, ValueType, count_mem, Alloc> Bucket; 
+    typedef typename ValueTypeInfo<KeyType, ValueType>::Value Value;
+    typedef SummaryBitSearcher<count_mem> NodeStruct;
+    typedef LPCTrie<KeyType, Bucket*, NodeStruct, count_mem, true, Alloc, Updates> LPCTrie_summary;
+    typedef LevelPathCompTrieBurst<KeyType, Value, LPCTrie_summary, Bucket, count_mem> LPCTrieBurst;    
 
-    typedef BTrie<KeyType, ValueType, LPCTrie_heap, LPCTrieBurst, Bucket, count_mem> LPCBTrie_internal; 
+    typedef BTrie<KeyType, Value, LPCTrie_summary, LPCTrieBurst, Bucket, count_mem> LPCBTrie_internal; 
  
 
     LPCBTrie_internal* lpcbtrie;
-    LPCTrie_heap* lpctrie;
+    LPCTrie_summary* lpctrie;
 
 public:
-    LPCBTrie()
+    typedef typename LPCBTrie_internal::Iterator Iterator;
+
+    // A non-zero expand_slice makes node expansion incremental (see LPCTrie).
+    // sizer picks the number of keys at which buckets burst (see BucketSizer).
+    explicit LPCBTrie(unsigned int expand_slice = 0, const BucketSizer<KeyType>& sizer = BucketSizer<KeyType>())
     {
   /*
         lpctrie = new LPCTrie_sqrt(4, 24, 0.75f, 0.25f);
         lpcbtrie = new LPCBTrie_internal(*lpctrie, MAX_BUCKET_SIZE);
     */    
-        lpctrie = new LPCTrie_heap(4, 24, 0.75f, 0.25f);
-        lpcbtrie = new LPCBTrie_internal(*lpctrie, MAX_BUCKET_SIZE);
+        lpctrie = new LPCTrie_summary(4, 24, 0.75f, 0.25f, expand_slice);
+        lpcbtrie = new LPCBTrie_internal(*lpctrie, sizer);
+        return;
+    }
+
+    // Bulk load the n sorted, distinct keys and their values (a set passes
+    // its keys again), packing buckets to fill_factor of their capacity.
+    LPCBTrie(const KeyType* keys, const Value* values, size_t n, float fill_factor = 0.75f, const BucketSizer<KeyType>& sizer = BucketSizer<KeyType>())
+    {
+        lpctrie = new LPCTrie_summary(4, 24, 0.75f, 0.25f);
+        lpcbtrie = new LPCBTrie_internal(*lpctrie, sizer);
+        lpcbtrie->bulk_load(keys, values, n, fill_factor);
+        return;
+    }
+    // Fixes the bucket size, or with adaptive has it chosen from size up.
+    void set_bucket_size(int size, bool adaptive = false)
+    {
+        lpcbtrie->set_bucket_size(size, adaptive);
         return;
     }
 
-    void insert(const KeyType& key, const ValueType& value)
+    void insert(const KeyType& key, const Value& value)
     {
         lpcbtrie->insert(key, value);        
         return;
     }
-    ValueType* locate(const KeyType& key)
+    // For a set.
+    void insert(const KeyType& key)
+    {
+        static_assert(ValueTypeInfo<KeyType, ValueType>::IS_SET, "insert(key) is for sets, which have ValueType void");
+        lpcbtrie->insert(key, key);
+        return;
+    }
+    Value* search(const KeyType& key)
+    {
+        return lpcbtrie->search(key);
+    }
+    Value* locate(const KeyType& key)
     {
         return lpcbtrie->locate(key);
     }
+    // As search and locate, for readers alongside a writer (see BTrie).
+    Value* read_search(const KeyType& key) const
+    {
+        return lpcbtrie->read_search(key);
+    }
+    Value* read_locate(const KeyType& key) const
+    {
+        return lpcbtrie->read_locate(key);
+    }
+    void locate_batch(const KeyType* keys, size_t n, Value** out)
+    {
+        lpcbtrie->locate_batch(keys, n, out);
+        return;
+    }
     void remove(const KeyType& key)
     {
         lpcbtrie->remove(key);
         return;
     }
+    // In-order iteration (see BucketIterator). Any insert or remove
+    // invalidates an Iterator.
+    Iterator first()
+    {
+        return lpcbtrie->first();
+    }
+    Iterator last()
+    {
+        return lpcbtrie->last();
+    }
+    // At the smallest key >= key.
+    Iterator lower_bound(const KeyType& key)
+    {
+        return lpcbtrie->lower_bound(key);
+    }
+    // callback(key, value) for every key in [lo, hi], in order.
+    template <class Callback> void scan(const KeyType& lo, const KeyType& hi, Callback callback)
+    {
+        lpcbtrie->scan(lo, hi, callback);
+        return;
+    }
     ~LPCBTrie()
     {
         delete lpctrie;
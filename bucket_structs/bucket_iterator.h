@@ -0,0 +1,120 @@
+#if !defined __BUCKET_ITERATOR_H
+
+#define __BUCKET_ITERATOR_H
+
+// An in-order iterator over the keys in a doubly linked list of sorted
+// buckets (as BTrie and QTrie keep), at element i of bucket b. Empty buckets
+// are stepped over. Stepping off either end of the list leaves it invalid.
+// Any insert or remove invalidates it.
+template <class KeyType, class ValueType, class Bucket> class BucketIterator
+{
+    Bucket* b;
+    int i;
+
+    // Move to the first element at or after i, b.
+    void skip_forward()
+    {
+        while(b && i == b->num_elems)
+        {
+            b = b->next;
+            i = 0;
+        }
+        return;
+    }
+    // Move to the last element at or before i, b.
+    void skip_backward()
+    {
+        while(b && i < 0)
+        {
+            b = b->prev;
+            i = b ? b->num_elems - 1 : 0;
+        }
+        return;
+    }
+public:
+    BucketIterator() : b(0), i(0) {}
+    // The first key in the list starting at b (0 for an empty list).
+    static BucketIterator first(Bucket* b)
+    {
+        BucketIterator it;
+        it.b = b;
+        it.skip_forward();
+        return it;
+    }
+    // The last key in the list holding b.
+    static BucketIterator last(Bucket* b)
+    {
+        BucketIterator it;
+        while(b && b->next)
+        {
+            b = b->next;
+        }
+        it.b = b;
+        it.i = b ? b->num_elems - 1 : 0;
+        it.skip_backward();
+        return it;
+    }
+    // The first key >= key in the list holding b, where b is the bucket a
+    // locate of key would start in: the one whose range holds key, or the
+    // closest before or after it (whose keys are all smaller or larger).
+    // Walking back only steps off buckets starting above key, a b whose keys
+    // are all below it is left by skip_forward.
+    static BucketIterator lower_bound(Bucket* b, const KeyType& key)
+    {
+        BucketIterator it;
+        while(b && b->prev && (!b->num_elems || key < b->get_key(0)))
+        {
+            b = b->prev;
+        }
+        it.b = b;
+        it.i = b ? b->lower_bound(key) : 0;
+        it.skip_forward();
+        return it;
+    }
+    inline bool valid() const
+    {
+        return b != 0;
+    }
+    // By value, since a bucket may store its keys compressed (see ForBucket).
+    inline KeyType key() const
+    {
+        return b->get_key(i);
+    }
+    inline ValueType& value() const
+    {
+        return b->values[i];
+    }
+    inline void next()
+    {
+        i++;
+        skip_forward();
+        return;
+    }
+    inline void prev()
+    {
+        i--;
+        skip_backward();
+        return;
+    }
+    // callback(key, value) for each key from here on up to hi, in order.
+    // Runs along each bucket's arrays rather than stepping the iterator.
+    template <class Callback> void scan(const KeyType& hi, Callback& callback)
+    {
+        for(; b; b = b->next, i = 0)
+        {
+            ValueType* values = b->values;
+            for(int n = b->num_elems; i < n; i++)
+            {
+                KeyType key = b->get_key(i);
+                if(hi < key)
+                {
+                    return;
+                }
+                callback(key, values[i]);
+            }
+        }
+        return;
+    }
+};
+
+#endif
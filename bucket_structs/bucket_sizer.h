@@ -0,0 +1,121 @@
+#if !defined __BUCKET_SIZER_H
+
+#define __BUCKET_SIZER_H
+
+#include <cmath>
+
+// The number of keys at which BTrie and QTrie burst or split a bucket.
+// Fixed, it's whatever it was set to. Adaptive, it's rechosen every
+// ADAPT_PERIOD inserts as the set size times a power of two:
+//
+// - Bigger buckets leave fewer trie levels to descend, and are searched
+//   about as fast, so locates speed up and memory shrinks; inserts move more
+//   keys though. Each of 1/2, 4/5 and 19/20 that the locates' share of the
+//   operations passes doubles the size.
+// - Dense keys save the most memory from bigger buckets, so another doubling
+//   if the keys of buckets that fill are on average less than 2^DENSE_GAP_BITS
+//   apart.
+//
+// The size is kept to MAX_SIZE (unless it was set bigger), and is never less
+// than MIN_SIZE: smaller buckets burst every few keys, leaving a trie node
+// for every bucket or two and buying nothing. The operation
+// counts are halved at each choice, so they follow the current mix.
+// Buckets take up a new size when they're next inserted into.
+// An adaptive sizer counts locates, so an adaptive structure shouldn't be
+// read by several threads at once.
+template <class KeyType> class BucketSizer
+{
+    int base_size, cur_size;
+    bool adaptive;
+    unsigned long num_inserts, num_locates, until_adapt;
+    // The running average of log2 of the mean gap between the keys of full
+    // buckets, over the last MAX_GAP_SAMPLES or so.
+    double gap_bits;
+    int num_gap_samples;
+
+    void adapt()
+    {
+        unsigned long num_ops = num_inserts + num_locates;
+        int shift = 0;
+        shift += 2 * num_locates > num_ops;
+        shift += 5 * num_locates > 4 * num_ops;
+        shift += 20 * num_locates > 19 * num_ops;
+        shift += num_gap_samples && gap_bits < DENSE_GAP_BITS;
+        cur_size = base_size << shift;
+        if(cur_size > MAX_SIZE)
+        {
+            cur_size = base_size > MAX_SIZE ? base_size : MAX_SIZE;
+        }
+        num_inserts /= 2;
+        num_locates /= 2;
+        until_adapt = ADAPT_PERIOD;
+        return;
+    }
+public:
+    static const int DEFAULT_SIZE = 128;
+    static const int MIN_SIZE = 8;
+    static const int MAX_SIZE = 2048;
+    static const unsigned long ADAPT_PERIOD = 1 << 16;
+    static const int DENSE_GAP_BITS = 4;
+    static const int MAX_GAP_SAMPLES = 64;
+
+    explicit BucketSizer(int size = DEFAULT_SIZE, bool adaptive = false)
+    {
+        set(size, adaptive);
+        return;
+    }
+    void set(int size, bool adaptive = false)
+    {
+        base_size = cur_size = size < MIN_SIZE ? MIN_SIZE : size;
+        this->adaptive = adaptive;
+        num_inserts = num_locates = 0;
+        until_adapt = ADAPT_PERIOD;
+        gap_bits = 0;
+        num_gap_samples = 0;
+        return;
+    }
+    inline int size() const
+    {
+        return cur_size;
+    }
+    inline bool is_adaptive() const
+    {
+        return adaptive;
+    }
+    inline void note_insert()
+    {
+        if(adaptive)
+        {
+            num_inserts++;
+            if(!--until_adapt)
+            {
+                adapt();
+            }
+        }
+        return;
+    }
+    inline void note_locates(unsigned long n = 1)
+    {
+        if(adaptive)
+        {
+            num_locates += n;
+        }
+        return;
+    }
+    // A bucket filled up with n keys, from lo to hi.
+    void note_full(const KeyType& lo, const KeyType& hi, int n)
+    {
+        if(adaptive)
+        {
+            double bits = std::log2((double)(hi - lo) / n + 1);
+            if(num_gap_samples < MAX_GAP_SAMPLES)
+            {
+                num_gap_samples++;
+            }
+            gap_bits += (bits - gap_bits) / num_gap_samples;
+        }
+        return;
+    }
+};
+
+#endif
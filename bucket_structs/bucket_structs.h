@@ -6,6 +6,7 @@
 #include <bucket_structs/common.h>
 #include <bucket_structs/stdvector_bucket.h>
 #include <bucket_structs/sorted_bucket.h>
+#include <bucket_structs/bucket_iterator.h>
 #include <bucket_structs/unsorted_bucket.h>
 #include <bucket_structs/psorted_bucket.h>
 #include <bucket_structs/cpsorted_bucket.h>
@@ -18,5 +19,8 @@
 // a single header for the JEA code submission:
 
 #include <bucket_structs/sorted_bucket.h>
+#include <bucket_structs/for_bucket.h>
+#include <bucket_structs/bucket_iterator.h>
+#include <bucket_structs/bucket_sizer.h>
 
 #endif
@@ -0,0 +1,500 @@
+#if !defined __FOR_BUCKET_H
+
+#define __FOR_BUCKET_H
+
+#include <bucket_structs/common.h>
+#include <bucket_structs/key_search.h>
+#include <key_utils/key_utils.h>
+#include <count_alloc/count_alloc.h>
+#include <count_alloc/slab_alloc.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <type_traits>
+
+// A drop-in for SortedBucket (for integer keys) that stores its keys
+// frame-of-reference encoded: as offsets from a base key, at most the
+// smallest key, in 1, 2, 4 or 8 bytes, whichever is the narrowest that the
+// range of keys fits. A bucket's keys share their high bits with those of
+// its neighbours, so dense buckets take a quarter or an eighth of the key
+// memory.
+//
+// Searches don't decode the offsets: the key searched for is turned into an
+// offset instead, and KeySearch then compares a vector of offsets at a
+// time, so the narrower they are the more keys each compare covers.
+//
+// An insert out of the base's range, or needing wider offsets, re-encodes
+// the bucket. Shrinking and splitting narrow the offsets again if they can.
+// Keys are only handed out by value (get_key), never by reference.
+template <class KeyType, class ValueType, bool count_mem = false, class Alloc = HeapAlloc> class ForBucket
+{
+    static_assert(!ValueTypeInfo<KeyType, ValueType>::IS_SET, "ForBucket has no set mode: there are no whole keys for values to point at");
+    typedef typename std::make_unsigned<KeyType>::type Offset;
+public:
+    ALLOC_MEMORY(Alloc, count_mem)
+
+    typedef /*unsigned short*/unsigned int ChildIdx;
+
+    int num_elems, capacity, max_capacity;
+    int width;
+    ForBucket* prev;
+    ForBucket* next;
+    KeyType base;
+    char* offsets;
+    ValueType* values;
+
+    static const int GROWTH_FACTOR        = 2;
+    static const int INITIAL_CAPACITY     = 2;
+
+    ForBucket(int capacity, int max_capacity) : num_elems(0), capacity(capacity), max_capacity(max_capacity), width(1), prev(0), next(0), base(0)
+    {
+        allocate();
+        return;
+    }
+    ForBucket(const KeyType& key, const ValueType& value, int capacity, int max_capacity) : num_elems(1), capacity(capacity), max_capacity(max_capacity), width(1), prev(0), next(0), base(key)
+    {
+        allocate();
+
+        set_offset(offsets, width, 0, 0);
+        values[0] = value;
+        return;
+    }
+    // A bucket holding copies of the n sorted keys in sorted_keys and their values.
+    ForBucket(const KeyType* sorted_keys, const ValueType* sorted_values, int n, int max_capacity) : num_elems(n), capacity(INITIAL_CAPACITY), max_capacity(max_capacity), width(1), prev(0), next(0), base(n ? sorted_keys[0] : 0)
+    {
+        while(capacity < n)
+        {
+            capacity *= GROWTH_FACTOR;
+        }
+        if(n)
+        {
+            width = width_of((Offset)sorted_keys[n - 1] - (Offset)base);
+        }
+        allocate();
+
+        for(int i = 0; i < n; i++)
+        {
+            set_offset(offsets, width, i, (Offset)sorted_keys[i] - (Offset)base);
+        }
+        memcpy(values, sorted_values, n * sizeof(ValueType));
+        return;
+    }
+    // The narrowest width that holds the offset off.
+    static inline int width_of(Offset off)
+    {
+        if(off <= 0xFF)
+        {
+            return 1;
+        }
+        if(off <= 0xFFFF)
+        {
+            return 2;
+        }
+        if(off <= 0xFFFFFFFFUL)
+        {
+            return 4;
+        }
+        return 8;
+    }
+    static inline Offset max_offset(int width)
+    {
+        return width >= (int)sizeof(Offset) ? ~(Offset)0 : ((Offset)1 << (8 * width)) - 1;
+    }
+    static inline Offset get_offset(const char* offsets, int width, int i)
+    {
+        switch(width)
+        {
+        case 1:
+            return reinterpret_cast<const uint8_t*>(offsets)[i];
+        case 2:
+            return reinterpret_cast<const uint16_t*>(offsets)[i];
+        case 4:
+            return reinterpret_cast<const uint32_t*>(offsets)[i];
+        default:
+            return reinterpret_cast<const uint64_t*>(offsets)[i];
+        }
+    }
+    static inline void set_offset(char* offsets, int width, int i, Offset off)
+    {
+        switch(width)
+        {
+        case 1:
+            reinterpret_cast<uint8_t*>(offsets)[i] = off;
+            break;
+        case 2:
+            reinterpret_cast<uint16_t*>(offsets)[i] = off;
+            break;
+        case 4:
+            reinterpret_cast<uint32_t*>(offsets)[i] = off;
+            break;
+        default:
+            reinterpret_cast<uint64_t*>(offsets)[i] = off;
+            break;
+        }
+        return;
+    }
+    // The offsets and values live in one block: capacity offsets, then
+    // (suitably aligned) capacity values.
+    static inline size_t values_offset(int capacity, int width)
+    {
+        const size_t align = alignof(ValueType);
+        return (capacity * width + align - 1) & ~(align - 1);
+    }
+    static inline size_t block_size(int capacity, int width)
+    {
+        return values_offset(capacity, width) + capacity * sizeof(ValueType);
+    }
+    void allocate()
+    {
+        offsets = static_cast<char*>(alloc_bytes<Alloc,count_mem>(block_size(capacity, width)));
+        values = reinterpret_cast<ValueType*>(offsets + values_offset(capacity, width));
+        return;
+    }
+    // Resizes the block to hold new_capacity offsets and values, moving the
+    // values along so they stay after the offsets.
+    void reallocate(int new_capacity)
+    {
+        if(new_capacity < capacity)
+        {
+            memmove(offsets + values_offset(new_capacity, width), values, num_elems * sizeof(ValueType));
+        }
+        offsets = static_cast<char*>(realloc_bytes<Alloc,count_mem>(offsets, block_size(capacity, width), block_size(new_capacity, width)));
+        if(new_capacity > capacity)
+        {
+            memmove(offsets + values_offset(new_capacity, width), offsets + values_offset(capacity, width), num_elems * sizeof(ValueType));
+        }
+        values = reinterpret_cast<ValueType*>(offsets + values_offset(new_capacity, width));
+        capacity = new_capacity;
+        return;
+    }
+    // Re-encodes the keys from new_base at new_width into a new block of
+    // new_capacity.
+    void rebuild(const KeyType& new_base, int new_width, int new_capacity)
+    {
+        if(new_width == width && new_base == base)
+        {
+            reallocate(new_capacity);
+            return;
+        }
+        char* new_offsets = static_cast<char*>(alloc_bytes<Alloc,count_mem>(block_size(new_capacity, new_width)));
+        ValueType* new_values = reinterpret_cast<ValueType*>(new_offsets + values_offset(new_capacity, new_width));
+        Offset shift = (Offset)base - (Offset)new_base;
+        for(int i = 0; i < num_elems; i++)
+        {
+            set_offset(new_offsets, new_width, i, get_offset(offsets, width, i) + shift);
+        }
+        memcpy(new_values, values, num_elems * sizeof(ValueType));
+        free_bytes<Alloc,count_mem>(offsets, block_size(capacity, width));
+        offsets = new_offsets;
+        values = new_values;
+        base = new_base;
+        width = new_width;
+        capacity = new_capacity;
+        return;
+    }
+    // Makes room for key: a base no bigger than it, offsets wide enough for
+    // it and capacity for one more. Grows by GROWTH_FACTOR, but never past
+    // max_capacity, which needn't be a power of two.
+    void check_fit(const KeyType& key)
+    {
+        if(!num_elems)
+        {
+            base = key;
+        }
+        KeyType new_base = key < base ? key : base;
+        KeyType max_key = num_elems && key < get_key(num_elems - 1) ? get_key(num_elems - 1) : key;
+        int new_width = std::max(width, width_of((Offset)max_key - (Offset)new_base));
+        int new_capacity = capacity;
+        if(num_elems == capacity)
+        {
+            new_capacity = std::max(std::min(capacity * GROWTH_FACTOR, max_capacity), num_elems + 1);
+        }
+        if(new_base != base || new_width != width || new_capacity != capacity)
+        {
+            rebuild(new_base, new_width, new_capacity);
+        }
+        return;
+    }
+    // Rebases on the smallest key and takes the narrowest width the keys
+    // fit, if narrower than now.
+    void check_narrow(int new_capacity)
+    {
+        KeyType new_base = num_elems ? get_key(0) : base;
+        int new_width = num_elems ? width_of((Offset)get_key(num_elems - 1) - (Offset)new_base) : 1;
+        if(new_width < width || new_capacity != capacity)
+        {
+            rebuild(new_base, new_width, new_capacity);
+        }
+        return;
+    }
+    void check_shrink()
+    {
+        if(num_elems <= (capacity / GROWTH_FACTOR) && capacity > INITIAL_CAPACITY)
+        {
+            check_narrow(capacity / GROWTH_FACTOR);
+        }
+        return;
+    }
+
+    void unchecked_insert(const KeyType& key, const ValueType& value)
+    {
+        check_fit(key);
+        set_offset(offsets, width, num_elems, (Offset)key - (Offset)base);
+        values[num_elems] = value;
+        num_elems++;
+        return;
+    }
+    BucketData::INSERT_RESULT insert(const KeyType& key, const ValueType& value)
+    {
+        using namespace BucketData;
+        INSERT_RESULT result;
+
+        int i = lower_bound(key);
+        if(i < num_elems && get_key(i) == key)
+        {
+            values[i] = value;
+            result = INSERT_UPDATED;
+        }
+        else if(num_elems == max_capacity)
+        {
+            result = INSERT_FAILED;
+        }
+        else
+        {
+            check_fit(key);
+            if(num_elems == max_capacity - 1)
+            {
+                result = INSERT_FILLED;
+            }
+            else
+            {
+                result = INSERT_CREATED;
+            }
+            size_t num_moved = num_elems - i;
+            memmove(offsets + (i + 1) * width, offsets + i * width, num_moved * width);
+            memmove(values + i + 1, values + i, num_moved * sizeof(ValueType));
+            set_offset(offsets, width, i, (Offset)key - (Offset)base);
+            values[i] = value;
+            num_elems++;
+        }
+        return result;
+    }
+    // The bucket fills at max_capacity keys (see insert). A bucket that
+    // already holds that many fills with its next new key instead.
+    inline void set_max_capacity(int n)
+    {
+        max_capacity = std::max(n, num_elems + 1);
+        return;
+    }
+    ValueType* remove(const KeyType& key)
+    {
+        int i = lower_bound(key);
+        ValueType* result = 0;
+        if(i < num_elems && get_key(i) == key)
+        {
+            result = values + i;
+            size_t num_moved = num_elems - i - 1;
+            memmove(offsets + i * width, offsets + (i + 1) * width, num_moved * width);
+            memmove(values + i, values + i + 1, num_moved * sizeof(ValueType));
+            num_elems--;
+            check_shrink();
+        }
+        return result;
+    }
+    void sort()
+    {
+        return; // Do nothing.
+    }
+    ForBucket* split()
+    {
+        if(num_elems != max_capacity)
+        {
+            // Can only split full buckets.
+            return 0;
+        }
+        // The new bucket takes the upper half, the bigger one if
+        // max_capacity is odd.
+        int half = num_elems / 2;
+        int rest = num_elems - half;
+        KeyType b_base = get_key(half);
+        ForBucket* b = new ForBucket(rest, max_capacity);
+        b->rebuild(b_base, width_of((Offset)get_key(num_elems - 1) - (Offset)b_base), rest);
+        for(int i = 0; i < rest; i++)
+        {
+            set_offset(b->offsets, b->width, i, (Offset)get_key(i + half) - (Offset)b_base);
+        }
+        memcpy(b->values, values + half, rest * sizeof(ValueType));
+        b->num_elems = rest;
+        num_elems = half;
+        check_narrow(capacity);
+        return b;
+    }
+    template <class INode, class Leaf> ForBucket* burst_into(INode* node, Leaf*, int shift, int length)
+    {
+        KeyType k = get_key(0);
+        int idx = (ChildIdx)KeyTypeInfo<KeyType>::extract_bits(k, shift, length);
+        ForBucket* first_new = new ForBucket(k, values[0], INITIAL_CAPACITY, max_capacity);
+        if(prev)
+        {
+            first_new->prev = prev;
+            prev->next = first_new;
+        }
+
+        node->leaves[idx] = new Leaf(k, first_new);
+
+        ForBucket* b = first_new;
+        for(int i = 1; i < num_elems; i++)
+        {
+            KeyType k = get_key(i);
+            int idx = (ChildIdx)KeyTypeInfo<KeyType>::extract_bits(k, shift, length);
+            if(!node->leaves[idx])
+            {
+                ForBucket* b_new = new ForBucket(k, values[i], INITIAL_CAPACITY, max_capacity);
+
+                b_new->prev = b;
+                b->next = b_new;
+
+                node->leaves[idx] = new Leaf(k, b_new);
+
+                b = b_new;
+            }
+            else
+            {
+                node->leaves[idx]->value->unchecked_insert(k, values[i]);
+            }
+        }
+        if(next)
+        {
+            b->next = next;
+            next->prev = b;
+        }
+        return first_new;
+    }
+    bool all_bits_match(const KeyType& bits, int shift, int length)
+    {
+        for(int i = 0; i < num_elems; i++)
+        {
+            if(bits != KeyTypeInfo<KeyType>::extract_bits(get_key(i), shift, length))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    ValueType* search(const KeyType& key)
+    {
+        int i = lower_bound(key);
+        if(i < num_elems && get_key(i) == key)
+        {
+            return values + i;
+        }
+        return 0;
+    }
+    // The index of the first key >= key (num_elems if there is none).
+    inline int lower_bound(const KeyType& key)
+    {
+        if(!num_elems || key < base)
+        {
+            return 0;
+        }
+        Offset off = (Offset)key - (Offset)base;
+        if(off > max_offset(width))
+        {
+            return num_elems;
+        }
+        return search_offsets<false>(off);
+    }
+    // The index of the first key > key (num_elems if there is none).
+    inline int upper_bound(const KeyType& key)
+    {
+        if(!num_elems || key < base)
+        {
+            return 0;
+        }
+        Offset off = (Offset)key - (Offset)base;
+        if(off > max_offset(width))
+        {
+            return num_elems;
+        }
+        return search_offsets<true>(off);
+    }
+    template <bool upper> inline int search_offsets(Offset off)
+    {
+        switch(width)
+        {
+        case 1:
+            return search_width<uint8_t, upper>(off);
+        case 2:
+            return search_width<uint16_t, upper>(off);
+        case 4:
+            return search_width<uint32_t, upper>(off);
+        default:
+            return search_width<uint64_t, upper>(off);
+        }
+    }
+    template <class Word, bool upper> inline int search_width(Offset off)
+    {
+        const Word* words = reinterpret_cast<const Word*>(offsets);
+        if(upper)
+        {
+            return KeySearch<Word>::upper_bound(words, num_elems, (Word)off);
+        }
+        return KeySearch<Word>::lower_bound(words, num_elems, (Word)off);
+    }
+    ValueType* locate_with_list(const KeyType& key)
+    {
+        if(!num_elems || key < get_key(0)) {
+            if (prev==nullptr) {
+                return nullptr;
+            } else {
+                return prev->locate_with_list(key);
+            }
+        } else {
+            return values + upper_bound(key) - 1;
+        }
+    }
+    // Prefetch the first things locate_with_list (if searching) or
+    // get_max_value_ptr will touch.
+    inline void prefetch(bool searching)
+    {
+        if(searching)
+        {
+            __builtin_prefetch(offsets);
+            __builtin_prefetch(offsets + (num_elems >> 1) * width);
+        }
+        else
+        {
+            __builtin_prefetch(values + num_elems - 1);
+        }
+        return;
+    }
+    inline ValueType* get_max_value_ptr()
+    {
+        return values + num_elems - 1;
+    }
+    inline KeyType get_min_key()
+    {
+        return get_key(0);
+    }
+    inline KeyType get_key(int idx)
+    {
+        return (KeyType)((Offset)base + get_offset(offsets, width, idx));
+    }
+    inline const ValueType& get_value(int idx)
+    {
+        return values[idx];
+    }
+    inline void set_value(const ValueType& value, int idx)
+    {
+        values[idx] = value;
+        return;
+    }
+    ~ForBucket()
+    {
+        free_bytes<Alloc,count_mem>(offsets, block_size(capacity, width));
+        return;
+    }
+};
+
+#endif
@@ -0,0 +1,311 @@
+#if !defined __KEY_SEARCH_H
+
+#define __KEY_SEARCH_H
+
+#include <limits>
+
+#if defined __AVX2__ || defined __SSE4_2__
+#include <immintrin.h>
+#endif
+
+// Linear lower_bound/upper_bound scans over a short sorted array of keys,
+// returning the index found. For 8, 16, 32 and 64-bit integer keys these
+// compare a vector of keys at a time against the key and movemask the result.
+// Since the keys are sorted, the keys that compare less (or less or
+// equal) form a prefix, so we stop at the first vector that isn't all
+// ones, and the count of its set mask bits is the offset within it.
+//
+// The instruction set is chosen at compile time: AVX2 if available,
+// otherwise SSE4.2 (64-bit compares need it), otherwise a scalar scan.
+// Both compare signed lanes, so unsigned keys have their top bit
+// flipped first.
+template <class KeyType, int size = sizeof(KeyType), bool is_integer = std::numeric_limits<KeyType>::is_integer> class KeyScan
+{
+public:
+    static inline int lower_scan(const KeyType* keys, int n, const KeyType& key)
+    {
+        int i = 0;
+        while(i < n && keys[i] < key)
+        {
+            i++;
+        }
+        return i;
+    }
+    static inline int upper_scan(const KeyType* keys, int n, const KeyType& key)
+    {
+        int i = 0;
+        while(i < n && !(key < keys[i]))
+        {
+            i++;
+        }
+        return i;
+    }
+};
+
+#if defined __AVX2__ || defined __SSE4_2__
+
+template <class KeyType> class KeyScan<KeyType, 8, true>
+{
+    static const long long FLIP = std::numeric_limits<KeyType>::is_signed ? 0 : (long long)(1ULL << 63);
+#if defined __AVX2__
+    static const int LANES = 4;
+    typedef __m256i Vec;
+    static inline Vec load(const KeyType* p) { return _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)p), _mm256_set1_epi64x(FLIP)); }
+    static inline Vec splat(const KeyType& key) { return _mm256_set1_epi64x((long long)key ^ FLIP); }
+    static inline unsigned int greater(Vec a, Vec b) { return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(a, b))); }
+#else
+    static const int LANES = 2;
+    typedef __m128i Vec;
+    static inline Vec load(const KeyType* p) { return _mm_xor_si128(_mm_loadu_si128((const __m128i*)p), _mm_set1_epi64x(FLIP)); }
+    static inline Vec splat(const KeyType& key) { return _mm_set1_epi64x((long long)key ^ FLIP); }
+    static inline unsigned int greater(Vec a, Vec b) { return _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(a, b))); }
+#endif
+    static const unsigned int ALL = (1 << LANES) - 1;
+public:
+    static inline int lower_scan(const KeyType* keys, int n, const KeyType& key)
+    {
+        Vec k = splat(key);
+        int i = 0;
+        for(; i + LANES <= n; i += LANES)
+        {
+            unsigned int less = greater(k, load(keys + i));
+            if(less != ALL)
+            {
+                return i + __builtin_popcount(less);
+            }
+        }
+        while(i < n && keys[i] < key)
+        {
+            i++;
+        }
+        return i;
+    }
+    static inline int upper_scan(const KeyType* keys, int n, const KeyType& key)
+    {
+        Vec k = splat(key);
+        int i = 0;
+        for(; i + LANES <= n; i += LANES)
+        {
+            unsigned int more = greater(load(keys + i), k);
+            if(more)
+            {
+                return i + __builtin_ctz(more);
+            }
+        }
+        while(i < n && !(key < keys[i]))
+        {
+            i++;
+        }
+        return i;
+    }
+};
+
+template <class KeyType> class KeyScan<KeyType, 4, true>
+{
+    static const int FLIP = std::numeric_limits<KeyType>::is_signed ? 0 : (int)(1U << 31);
+#if defined __AVX2__
+    static const int LANES = 8;
+    typedef __m256i Vec;
+    static inline Vec load(const KeyType* p) { return _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)p), _mm256_set1_epi32(FLIP)); }
+    static inline Vec splat(const KeyType& key) { return _mm256_set1_epi32((int)key ^ FLIP); }
+    static inline unsigned int greater(Vec a, Vec b) { return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(a, b))); }
+#else
+    static const int LANES = 4;
+    typedef __m128i Vec;
+    static inline Vec load(const KeyType* p) { return _mm_xor_si128(_mm_loadu_si128((const __m128i*)p), _mm_set1_epi32(FLIP)); }
+    static inline Vec splat(const KeyType& key) { return _mm_set1_epi32((int)key ^ FLIP); }
+    static inline unsigned int greater(Vec a, Vec b) { return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(a, b))); }
+#endif
+    static const unsigned int ALL = (1 << LANES) - 1;
+public:
+    static inline int lower_scan(const KeyType* keys, int n, const KeyType& key)
+    {
+        Vec k = splat(key);
+        int i = 0;
+        for(; i + LANES <= n; i += LANES)
+        {
+            unsigned int less = greater(k, load(keys + i));
+            if(less != ALL)
+            {
+                return i + __builtin_popcount(less);
+            }
+        }
+        while(i < n && keys[i] < key)
+        {
+            i++;
+        }
+        return i;
+    }
+    static inline int upper_scan(const KeyType* keys, int n, const KeyType& key)
+    {
+        Vec k = splat(key);
+        int i = 0;
+        for(; i + LANES <= n; i += LANES)
+        {
+            unsigned int more = greater(load(keys + i), k);
+            if(more)
+            {
+                return i + __builtin_ctz(more);
+            }
+        }
+        while(i < n && !(key < keys[i]))
+        {
+            i++;
+        }
+        return i;
+    }
+};
+
+// 16 and 8-bit keys (such as ForBucket's offsets) take the byte movemask,
+// so a 16-bit lane sets BITS = 2 bits of it.
+template <class KeyType> class KeyScan<KeyType, 2, true>
+{
+    static const short FLIP = std::numeric_limits<KeyType>::is_signed ? 0 : (short)0x8000;
+#if defined __AVX2__
+    static const int LANES = 16;
+    typedef __m256i Vec;
+    static inline Vec load(const KeyType* p) { return _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)p), _mm256_set1_epi16(FLIP)); }
+    static inline Vec splat(const KeyType& key) { return _mm256_set1_epi16((short)key ^ FLIP); }
+    static inline unsigned int greater(Vec a, Vec b) { return _mm256_movemask_epi8(_mm256_cmpgt_epi16(a, b)); }
+#else
+    static const int LANES = 8;
+    typedef __m128i Vec;
+    static inline Vec load(const KeyType* p) { return _mm_xor_si128(_mm_loadu_si128((const __m128i*)p), _mm_set1_epi16(FLIP)); }
+    static inline Vec splat(const KeyType& key) { return _mm_set1_epi16((short)key ^ FLIP); }
+    static inline unsigned int greater(Vec a, Vec b) { return _mm_movemask_epi8(_mm_cmpgt_epi16(a, b)); }
+#endif
+    static const int BITS = 2;
+    static const unsigned int ALL = ~0U >> (32 - BITS * LANES);
+public:
+    static inline int lower_scan(const KeyType* keys, int n, const KeyType& key)
+    {
+        Vec k = splat(key);
+        int i = 0;
+        for(; i + LANES <= n; i += LANES)
+        {
+            unsigned int less = greater(k, load(keys + i));
+            if(less != ALL)
+            {
+                return i + __builtin_popcount(less) / BITS;
+            }
+        }
+        while(i < n && keys[i] < key)
+        {
+            i++;
+        }
+        return i;
+    }
+    static inline int upper_scan(const KeyType* keys, int n, const KeyType& key)
+    {
+        Vec k = splat(key);
+        int i = 0;
+        for(; i + LANES <= n; i += LANES)
+        {
+            unsigned int more = greater(load(keys + i), k);
+            if(more)
+            {
+                return i + __builtin_ctz(more) / BITS;
+            }
+        }
+        while(i < n && !(key < keys[i]))
+        {
+            i++;
+        }
+        return i;
+    }
+};
+
+template <class KeyType> class KeyScan<KeyType, 1, true>
+{
+    static const char FLIP = std::numeric_limits<KeyType>::is_signed ? 0 : (char)0x80;
+#if defined __AVX2__
+    static const int LANES = 32;
+    typedef __m256i Vec;
+    static inline Vec load(const KeyType* p) { return _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)p), _mm256_set1_epi8(FLIP)); }
+    static inline Vec splat(const KeyType& key) { return _mm256_set1_epi8((char)key ^ FLIP); }
+    static inline unsigned int greater(Vec a, Vec b) { return _mm256_movemask_epi8(_mm256_cmpgt_epi8(a, b)); }
+#else
+    static const int LANES = 16;
+    typedef __m128i Vec;
+    static inline Vec load(const KeyType* p) { return _mm_xor_si128(_mm_loadu_si128((const __m128i*)p), _mm_set1_epi8(FLIP)); }
+    static inline Vec splat(const KeyType& key) { return _mm_set1_epi8((char)key ^ FLIP); }
+    static inline unsigned int greater(Vec a, Vec b) { return _mm_movemask_epi8(_mm_cmpgt_epi8(a, b)); }
+#endif
+    static const unsigned int ALL = ~0U >> (32 - LANES);
+public:
+    static inline int lower_scan(const KeyType* keys, int n, const KeyType& key)
+    {
+        Vec k = splat(key);
+        int i = 0;
+        for(; i + LANES <= n; i += LANES)
+        {
+            unsigned int less = greater(k, load(keys + i));
+            if(less != ALL)
+            {
+                return i + __builtin_popcount(less);
+            }
+        }
+        while(i < n && keys[i] < key)
+        {
+            i++;
+        }
+        return i;
+    }
+    static inline int upper_scan(const KeyType* keys, int n, const KeyType& key)
+    {
+        Vec k = splat(key);
+        int i = 0;
+        for(; i + LANES <= n; i += LANES)
+        {
+            unsigned int more = greater(load(keys + i), k);
+            if(more)
+            {
+                return i + __builtin_ctz(more);
+            }
+        }
+        while(i < n && !(key < keys[i]))
+        {
+            i++;
+        }
+        return i;
+    }
+};
+
+#endif
+
+// lower_bound/upper_bound over a sorted array of keys, returning the index
+// found. Long arrays are first cut down by a (branch free) binary search,
+// since a scan would touch every cache line up to the key, then the scan 
+// finishes off the last SCAN_KEYS or so.
+template <class KeyType> class KeySearch
+{
+    typedef KeyScan<KeyType> Scan;
+    static const int SCAN_BYTES = 128;
+    static const int SCAN_KEYS = SCAN_BYTES / sizeof(KeyType) > 4 ? SCAN_BYTES / sizeof(KeyType) : 4;
+public:
+    static inline int lower_bound(const KeyType* keys, int n, const KeyType& key)
+    {
+        // The answer always lies in [base, base + n].
+        const KeyType* base = keys;
+        while(n > SCAN_KEYS)
+        {
+            int half = n >> 1;
+            base = base[half] < key ? base + half : base;
+            n -= half;
+        }
+        return (base - keys) + Scan::lower_scan(base, n, key);
+    }
+    static inline int upper_bound(const KeyType* keys, int n, const KeyType& key)
+    {
+        const KeyType* base = keys;
+        while(n > SCAN_KEYS)
+        {
+            int half = n >> 1;
+            base = key < base[half] ? base : base + half;
+            n -= half;
+        }
+        return (base - keys) + Scan::upper_scan(base, n, key);
+    }
+};
+
+#endif
@@ -3,67 +3,129 @@
 #define __SORTED_BUCKET_H
 
 #include <bucket_structs/common.h>
+#include <bucket_structs/key_search.h>
 #include <key_utils/key_utils.h>
 #include <count_alloc/count_alloc.h>
+#include <count_alloc/slab_alloc.h>
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
 
-template <class KeyType, class ValueType, bool count_mem = false> class SortedBucket
+// For a set (ValueType = void, see ValueTypeInfo) there's no values array:
+// values points at the keys, and inserts and removes only move keys.
+template <class KeyType, class ValueType, bool count_mem = false, class Alloc = HeapAlloc> class SortedBucket
 {
+    typedef KeySearch<KeyType> Search;
+    typedef ValueTypeInfo<KeyType, ValueType> ValueInfo;
 public:
+    typedef typename ValueInfo::Value Value;
+
+    ALLOC_MEMORY(Alloc, count_mem)
+
     typedef /*unsigned short*/unsigned int ChildIdx;
 
     int num_elems, capacity, max_capacity;
     SortedBucket* prev;
     SortedBucket* next;
     KeyType* keys;
-    ValueType* values;
+    Value* values;
 
     static const int GROWTH_FACTOR        = 2;
     static const int INITIAL_CAPACITY     = 2;
 
     SortedBucket(int capacity, int max_capacity) : num_elems(0), capacity(capacity), max_capacity(max_capacity), prev(0), next(0)
     {         
-        keys = new KeyType[capacity];
-        values = new ValueType[capacity];
-
-        update_mem_counter<count_mem,KeyType>(MemCounter::NEW, keys, capacity);
-        update_mem_counter<count_mem,ValueType>(MemCounter::NEW, values, capacity);
+        allocate();
         return;
     }
-    SortedBucket(const KeyType& key, const ValueType& value, int capacity, int max_capacity) : num_elems(1), capacity(capacity), max_capacity(max_capacity), prev(0), next(0)
+    SortedBucket(const KeyType& key, const Value& value, int capacity, int max_capacity) : num_elems(1), capacity(capacity), max_capacity(max_capacity), prev(0), next(0)
     {
-        keys = new KeyType[capacity];
-        values = new ValueType[capacity];
-
-        update_mem_counter<count_mem,KeyType>(MemCounter::NEW, keys, capacity);
-        update_mem_counter<count_mem,ValueType>(MemCounter::NEW, values, capacity);
+        allocate();
         
         keys[0] = key;
-        values[0] = value;
+        set_value(value, 0);
         return;
     }
-    void check_grow()
+    // A bucket holding copies of the n sorted keys in sorted_keys and their
+    // values (unused by a set).
+    SortedBucket(const KeyType* sorted_keys, const Value* sorted_values, int n, int max_capacity) : num_elems(n), capacity(INITIAL_CAPACITY), max_capacity(max_capacity), prev(0), next(0)
     {
-        if(num_elems == capacity)
+        while(capacity < n)
         {
             capacity *= GROWTH_FACTOR;
-//            capacity += (capacity >> 1);
-            KeyType* new_keys = new KeyType[capacity];
-            ValueType* new_values = new ValueType[capacity];
+        }
+        allocate();
 
-            update_mem_counter<count_mem,KeyType>(MemCounter::NEW, new_keys, capacity);
-            update_mem_counter<count_mem,ValueType>(MemCounter::NEW, new_values, capacity);
-    
-            memcpy(new_keys, keys, num_elems * sizeof(KeyType));
-            memcpy(new_values, values, num_elems * sizeof(ValueType));
+        memcpy(keys, sorted_keys, n * sizeof(KeyType));
+        move_values(values, sorted_values, n);
+        return;
+    }
+    // A copy of b, with b's place in the bucket list (see writable_bucket).
+    SortedBucket(const SortedBucket& b) : num_elems(b.num_elems), capacity(b.capacity), max_capacity(b.max_capacity), prev(b.prev), next(b.next)
+    {
+        allocate();
 
-            update_mem_counter<count_mem,KeyType>(MemCounter::DELETE, keys);
-            update_mem_counter<count_mem,ValueType>(MemCounter::DELETE, values);
-            
-            delete[] keys;
-            delete[] values;
-            keys = new_keys;
-            values = new_values;
+        memcpy(keys, b.keys, num_elems * sizeof(KeyType));
+        move_values(values, b.values, num_elems);
+        return;
+    }
+    // The keys and values live in one block: capacity keys, then (suitably
+    // aligned) capacity values. A set's values are its keys.
+    static inline size_t values_offset(int capacity)
+    {
+        if(ValueInfo::IS_SET)
+        {
+            return 0;
+        }
+        const size_t align = alignof(Value);
+        return (capacity * sizeof(KeyType) + align - 1) & ~(align - 1);
+    }
+    static inline size_t block_size(int capacity)
+    {
+        return ValueInfo::IS_SET ? capacity * sizeof(KeyType) : values_offset(capacity) + capacity * ValueInfo::STORED_BYTES;
+    }
+    // memmove n values from from to to, unless they're a set's keys.
+    static inline void move_values(Value* to, const Value* from, size_t n)
+    {
+        if(!ValueInfo::IS_SET)
+        {
+            memmove(to, from, n * sizeof(Value));
+        }
+        return;
+    }
+    void allocate()
+    {
+        char* block = static_cast<char*>(alloc_bytes<Alloc,count_mem>(block_size(capacity)));
+        keys = reinterpret_cast<KeyType*>(block);
+        values = reinterpret_cast<Value*>(block + values_offset(capacity));
+        return;
+    }
+    // Resizes the block to hold new_capacity keys and values, moving the values
+    // along so they stay after the keys.
+    void reallocate(int new_capacity)
+    {
+        char* block = reinterpret_cast<char*>(keys);
+        if(new_capacity < capacity)
+        {
+            move_values(reinterpret_cast<Value*>(block + values_offset(new_capacity)), values, num_elems);
+        }
+        block = static_cast<char*>(realloc_bytes<Alloc,count_mem>(block, block_size(capacity), block_size(new_capacity)));
+        if(new_capacity > capacity)
+        {
+            move_values(reinterpret_cast<Value*>(block + values_offset(new_capacity)), reinterpret_cast<Value*>(block + values_offset(capacity)), num_elems);
+        }
+        keys = reinterpret_cast<KeyType*>(block);
+        values = reinterpret_cast<Value*>(block + values_offset(new_capacity));
+        capacity = new_capacity;
+        return;
+    }
+    // Grows by GROWTH_FACTOR, but never past max_capacity, which needn't
+    // be a power of two.
+    void check_grow()
+    {
+        if(num_elems == capacity)
+        {
+            reallocate(std::max(std::min(capacity * GROWTH_FACTOR, max_capacity), num_elems + 1));
         }
         return;
     }
@@ -71,53 +133,32 @@ public:
     {
         if(num_elems <= (capacity / GROWTH_FACTOR) && capacity > INITIAL_CAPACITY)
         {
-            capacity /= GROWTH_FACTOR;
-//            capacity += (capacity >> 1);
-            KeyType* new_keys = new KeyType[capacity];
-            ValueType* new_values = new ValueType[capacity];
-
-            update_mem_counter<count_mem,KeyType>(MemCounter::NEW, new_keys, capacity);
-            update_mem_counter<count_mem,ValueType>(MemCounter::NEW, new_values, capacity);
-    
-            memcpy(new_keys, keys, num_elems * sizeof(KeyType));
-            memcpy(new_values, values, num_elems * sizeof(ValueType));
-
-            update_mem_counter<count_mem,KeyType>(MemCounter::DELETE, keys);
-            update_mem_counter<count_mem,ValueType>(MemCounter::DELETE, values);
-            
-            delete[] keys;
-            delete[] values;
-            keys = new_keys;
-            values = new_values;
+            reallocate(capacity / GROWTH_FACTOR);
         }
         return;
     }
 
     
-    void unchecked_insert(const KeyType& key, const ValueType& value)
+    void unchecked_insert(const KeyType& key, const Value& value)
     {
         check_grow();
         keys[num_elems] = key;
-        values[num_elems] = value;
+        set_value(value, num_elems);
         num_elems++;
         return;
     }
-    BucketData::INSERT_RESULT insert(const KeyType& key, const ValueType& value)
+    BucketData::INSERT_RESULT insert(const KeyType& key, const Value& value)
     {
         using namespace BucketData;
         INSERT_RESULT result;
 
-        KeyType* p = keys;
+        KeyType* p = keys + Search::lower_bound(keys, num_elems, key);
         KeyType* q = keys + num_elems;
 
-        while(p < q && *p < key)
-        { 
-            p++;
-        }
         size_t diff = p - keys;
         if(p < q && *p == key)
         {            
-            *(values + diff) = value;
+            set_value(value, diff);
             result = INSERT_UPDATED;
         }
         else if(num_elems == max_capacity)
@@ -138,45 +179,35 @@ public:
             // If here we know keys[i - 1] < key < keys[i]
             // So we need to shift keys[i], .., keys[s-1] into keys[i + 1], .., keys[s]
             // and similarly with the values
-            ValueType* r = values + num_elems;
-            q = keys + num_elems;
-            p = keys + diff;
-            while(q > p)
-            {
-                *r = *(r - 1);
-                *q = *(q - 1);
-                r--;
-                q--;
-            }
-            *p = key;
-            *(values + (p - keys)) = value;
+            size_t num_moved = num_elems - diff;
+            memmove(keys + diff + 1, keys + diff, num_moved * sizeof(KeyType));
+            move_values(values + diff + 1, values + diff, num_moved);
+            keys[diff] = key;
+            set_value(value, diff);
             num_elems++;
         }
         return result;
     }
-    ValueType* remove(const KeyType& key)
+    // The bucket fills at max_capacity keys (see insert). A bucket that
+    // already holds that many fills with its next new key instead.
+    inline void set_max_capacity(int n)
     {
-        KeyType* p = keys;
+        max_capacity = std::max(n, num_elems + 1);
+        return;
+    }
+    Value* remove(const KeyType& key)
+    {
+        KeyType* p = keys + Search::lower_bound(keys, num_elems, key);
         KeyType* q = keys + num_elems;
 
-        while(p < q && *p < key)
-        { 
-            p++;
-        }
         size_t diff = p - keys;
-        ValueType* result = 0;
+        Value* result = 0;
         if(p < q && *p == key)
         {            
             result = values + diff;
-            ValueType* r = values + diff;
-            q--;
-            while(p < q)
-            {
-                *r = *(r + 1);
-                *p = *(p + 1);
-                r++;
-                p++;
-            }
+            size_t num_moved = num_elems - diff - 1;
+            memmove(keys + diff, keys + diff + 1, num_moved * sizeof(KeyType));
+            move_values(values + diff, values + diff + 1, num_moved);
             num_elems--;
             check_shrink();
         }
@@ -193,27 +224,29 @@ public:
             // Can only split full buckets.
             return 0;
         }
-        num_elems /= 2;
-        SortedBucket* b = new SortedBucket<KeyType,ValueType,count_mem>(num_elems, max_capacity);
-        update_mem_counter<count_mem,SortedBucket>(MemCounter::NEW, b);
-        for(int i = 0; i < num_elems; i++)
+        // The new bucket takes the upper half, the bigger one if
+        // max_capacity is odd.
+        int half = num_elems / 2;
+        int rest = num_elems - half;
+        SortedBucket* b = new SortedBucket(rest, max_capacity);
+        for(int i = 0; i < rest; i++)
         {
-            b->keys[i] = keys[i + num_elems];
+            b->keys[i] = keys[i + half];
         }
-        for(int i = 0; i < num_elems; i++)
+        for(int i = 0; i < rest; i++)
         {
-            b->values[i] = values[i + num_elems];
+            b->set_value(values[i + half], i);
         }
-        b->num_elems = num_elems;
+        b->num_elems = rest;
+        num_elems = half;
         return b;
     }
     template <class INode, class Leaf> SortedBucket* burst_into(INode* node, Leaf*, int shift, int length)
     {
-        const KeyType& k = (KeyType)keys[0];
-        const KeyType& v = (KeyType)values[0];
+        const KeyType& k = keys[0];
+        const Value& v = values[0];
         int idx = (ChildIdx)KeyTypeInfo<KeyType>::extract_bits(k, shift, length);
-        SortedBucket* first_new = new SortedBucket<KeyType,ValueType,count_mem>(k, v, INITIAL_CAPACITY, max_capacity);
-        update_mem_counter<count_mem,SortedBucket>(MemCounter::NEW, first_new);
+        SortedBucket* first_new = new SortedBucket(k, v, INITIAL_CAPACITY, max_capacity);
         if(prev)
         {
             first_new->prev = prev;
@@ -221,24 +254,21 @@ public:
         }
 
         node->leaves[idx] = new Leaf(k, first_new);
-        update_mem_counter<count_mem,Leaf>(MemCounter::NEW, node->leaves[idx]);
 
         SortedBucket* b = first_new;
         for(int i = 1; i < num_elems; i++)
         {
-            const KeyType& k = (KeyType)keys[i];
-            const KeyType& v = (KeyType)values[i];
+            const KeyType& k = keys[i];
+            const Value& v = values[i];
             int idx = (ChildIdx)KeyTypeInfo<KeyType>::extract_bits(k, shift, length);
             if(!node->leaves[idx])
             {
-                SortedBucket* b_new = new SortedBucket<KeyType,ValueType,count_mem>(k, v, INITIAL_CAPACITY, max_capacity);
-                update_mem_counter<count_mem,SortedBucket>(MemCounter::NEW, b_new);
+                SortedBucket* b_new = new SortedBucket(k, v, INITIAL_CAPACITY, max_capacity);
 
                 b_new->prev = b;
                 b->next = b_new;
                 
                 node->leaves[idx] = new Leaf(k, b_new);
-                update_mem_counter<count_mem,Leaf>(MemCounter::NEW, node->leaves[idx]);
                 
                 b = b_new;
             }
@@ -265,65 +295,54 @@ public:
         }
         return true;
     }
-    ValueType* search(const KeyType& key)
+    Value* search(const KeyType& key)
     {
-        using namespace std;
-        /*KeyType* it = lower_bound(keys, keys + num_elems, key);
-          if(it != keys + num_elems)
-          {
-          value = *(values + (it - keys));
-          return true;
-          }*/
-        static const int BSEARCH_THRESHOLD = 10;
-        int first = 0, last = num_elems - 1;
-        KeyType *p = keys;
-        while(first - last >= BSEARCH_THRESHOLD) 
+        int i = Search::lower_bound(keys, num_elems, key);
+        if(i < num_elems && keys[i] == key)
         {
-            int mid = ((unsigned int) (first + last)) >> 1;
-            KeyType *q = p + mid;
-            if(key > *q)
-            {
-                first = mid + 1;
-            }
-            else if(key < *q)
-            {
-                last = mid - 1;
-            }
-            else
-            {
-                return values + mid;        
-            }
-        }
-        KeyType *q = p + last;
-        p += first;
-        while(*p < key)
-        {
-            p++;
-            if(p > q) 
-            {
-                return 0;
-            }
-        }
-        if(*p == key)
-        {
-            return values + (p - keys);
+            return values + i;
         }
         return 0;
     }
-    ValueType* locate_with_list(const KeyType& key)
+    // The index of the first key >= key (num_elems if there is none).
+    inline int lower_bound(const KeyType& key)
+    {
+        return Search::lower_bound(keys, num_elems, key);
+    }
+    Value* locate_with_list(const KeyType& key)
     {
-        if(key < keys[0]) {
+        if(!num_elems || key < keys[0]) {
             if (prev==nullptr) {
                 return nullptr;
             } else {
                 return prev->locate_with_list(key);
             }
         } else {
-            auto it = std::upper_bound(keys, keys + num_elems, key);
-            return (ValueType*)(--it);
+            return values + Search::upper_bound(keys, num_elems, key) - 1;
         }
     }
-    inline ValueType* get_max_value_ptr()
+    // The value of the largest key <= key, or 0 if every key is bigger.
+    Value* locate(const KeyType& key)
+    {
+        int i = Search::upper_bound(keys, num_elems, key);
+        return i ? values + i - 1 : 0;
+    }
+    // Prefetch the first things locate_with_list (if searching) or 
+    // get_max_value_ptr will touch.
+    inline void prefetch(bool searching)
+    {
+        if(searching)
+        {
+            __builtin_prefetch(keys);
+            __builtin_prefetch(keys + (num_elems >> 1));
+        }
+        else
+        {
+            __builtin_prefetch(values + num_elems - 1);
+        }
+        return;
+    }
+    inline Value* get_max_value_ptr()
     {
         return values + num_elems - 1;
     }
@@ -335,7 +354,7 @@ public:
     {
         return keys[idx];
     }
-    inline const ValueType& get_value(int idx)
+    inline const Value& get_value(int idx)
     {
         return values[idx];
     }
@@ -344,17 +363,18 @@ public:
         keys[idx] = key;
         return;
     }
-    inline void set_value(const ValueType& value, int idx)
+    // A set's values are its keys, so there's nothing to set.
+    inline void set_value(const Value& value, int idx)
     {
-        values[idx] = value;
+        if(!ValueInfo::IS_SET)
+        {
+            values[idx] = value;
+        }
         return;
     }
     ~SortedBucket()
     {
-        update_mem_counter<count_mem,KeyType>(MemCounter::DELETE, keys);
-        update_mem_counter<count_mem,ValueType>(MemCounter::DELETE, values);
-        delete[] keys;
-        delete[] values;
+        free_bytes<Alloc,count_mem>(keys, block_size(capacity));
         return;
     }
 };
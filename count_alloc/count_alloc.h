@@ -48,4 +48,28 @@ template <bool active, class T> void update_mem_counter(MemCounter::ALLOC_OP op,
    return;
 }
 
+// As update_mem_counter, but for allocations whose size is passed back when
+// they are freed (see slab_alloc.h), so bytes is the exact number of bytes 
+// the allocation takes and there's no need to look it up in size_map.
+template <bool active> void update_mem_counter_bytes(MemCounter::ALLOC_OP op, unsigned long bytes)
+{
+    if(!active)
+    {
+        return;
+    }
+    if(op == MemCounter::DELETE)
+    {
+        used_memory -= bytes;
+    }
+    else
+    {
+        used_memory += bytes;
+        if(used_memory > peak_memory)
+        {
+            peak_memory = used_memory;
+        }
+    }
+    return;
+}
+
 #endif
@@ -0,0 +1,183 @@
+#if !defined __EPOCH_ALLOC_H
+
+#define __EPOCH_ALLOC_H
+
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include <count_alloc/slab_alloc.h>
+
+// An allocator (see slab_alloc.h) for structures read by many threads while
+// one thread updates them. It allocates through Alloc, but a freed block is
+// only retired: it goes back to Alloc once no reader can still be looking at
+// it (epoch based reclamation).
+//
+// A reader holds a ReadGuard for as long as it might touch blocks from the
+// structure. The guard records the epoch the reader entered in; a block
+// retired in epoch e is given back once every reader still inside entered
+// after e. Only the writing thread may allocate or free, and it calls 
+// end_update after each update: a block may be freed before it's unlinked,
+// so retired blocks are only given back between updates.
+//
+// The state is static, so it's shared by everything allocating through the
+// same EpochAlloc<Alloc>, whatever the types of the structures: between
+// them they can only have one writing thread.
+template <class Alloc> class EpochAlloc
+{
+public:
+    static const size_t CACHE_LINE_SIZE = Alloc::CACHE_LINE_SIZE;
+    // The most threads that can hold a ReadGuard at once.
+    static const int MAX_READERS = 256;
+private:
+    // How many blocks are retired between attempts to give some back.
+    static const size_t RECLAIM_INTERVAL = 1024;
+    static const unsigned long INACTIVE = 0;
+
+    // Each reader's slot in its own cache line, so entering and leaving
+    // doesn't bounce lines between readers.
+    struct alignas(64) ReaderSlot
+    {
+        std::atomic<bool> claimed;
+        std::atomic<unsigned long> epoch;
+    };
+    struct Retired
+    {
+        void* p;
+        size_t bytes;
+        unsigned long epoch;
+    };
+    static ReaderSlot slots[MAX_READERS];
+    static std::atomic<unsigned long> global_epoch;
+    static std::vector<Retired> retired;
+    // Blocks retired since the last attempt to give some back.
+    static size_t num_unreclaimed;
+
+    // The calling thread's slot, claimed the first time it reads and
+    // given up when it exits.
+    class ThreadSlot
+    {
+    public:
+        ReaderSlot* slot;
+        ThreadSlot() : slot(0)
+        {
+            for(int i = 0; i < MAX_READERS; i++)
+            {
+                bool expected = false;
+                if(slots[i].claimed.compare_exchange_strong(expected, true))
+                {
+                    slot = slots + i;
+                    return;
+                }
+            }
+            throw std::bad_alloc();
+        }
+        ~ThreadSlot()
+        {
+            slot->claimed.store(false);
+            return;
+        }
+    };
+    static ReaderSlot* thread_slot()
+    {
+        static thread_local ThreadSlot ts;
+        return ts.slot;
+    }
+    // Give back the retired blocks no reader can be looking at.
+    static void reclaim()
+    {
+        // Readers entering from here on can't reach anything retired so far.
+        unsigned long min_epoch = global_epoch.fetch_add(1) + 1;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for(int i = 0; i < MAX_READERS; i++)
+        {
+            unsigned long e = slots[i].epoch.load();
+            if(e != INACTIVE && e < min_epoch)
+            {
+                min_epoch = e;
+            }
+        }
+        // Blocks are retired in epoch order.
+        size_t n = 0;
+        while(n < retired.size() && retired[n].epoch < min_epoch)
+        {
+            Alloc::deallocate(retired[n].p, retired[n].bytes);
+            n++;
+        }
+        retired.erase(retired.begin(), retired.begin() + n);
+        num_unreclaimed = 0;
+        return;
+    }
+public:
+    class ReadGuard
+    {
+        ReaderSlot* slot;
+    public:
+        ReadGuard() : slot(thread_slot())
+        {
+            slot->epoch.store(global_epoch.load(std::memory_order_relaxed), std::memory_order_release);
+            // Pairs with reclaim's fence: either reclaim sees this epoch, or
+            // this reader sees every unlink made before it and can't reach
+            // what reclaim gives back.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return;
+        }
+        ~ReadGuard()
+        {
+            slot->epoch.store(INACTIVE, std::memory_order_release);
+            return;
+        }
+    };
+
+    static inline void* allocate(size_t bytes)
+    {
+        return Alloc::allocate(bytes);
+    }
+    static inline void deallocate(void* p, size_t bytes)
+    {
+        Retired r = { p, bytes, global_epoch.load(std::memory_order_relaxed) };
+        retired.push_back(r);
+        num_unreclaimed++;
+        return;
+    }
+    // The writer has finished an update, so what it has freed is unlinked.
+    static inline void end_update()
+    {
+        if(num_unreclaimed >= RECLAIM_INTERVAL)
+        {
+            reclaim();
+        }
+        return;
+    }
+    // Never in place, since a reader may be looking at the old block.
+    static void* reallocate(void* p, size_t old_bytes, size_t new_bytes)
+    {
+        void* q = allocate(new_bytes);
+        memcpy(q, p, old_bytes < new_bytes ? old_bytes : new_bytes);
+        deallocate(p, old_bytes);
+        return q;
+    }
+    static inline size_t footprint(size_t bytes)
+    {
+        return Alloc::footprint(bytes);
+    }
+    // Give back every retired block. Only call this when there are no readers.
+    static void collect()
+    {
+        for(size_t i = 0; i < retired.size(); i++)
+        {
+            Alloc::deallocate(retired[i].p, retired[i].bytes);
+        }
+        retired.clear();
+        num_unreclaimed = 0;
+        return;
+    }
+};
+
+template <class Alloc> typename EpochAlloc<Alloc>::ReaderSlot EpochAlloc<Alloc>::slots[MAX_READERS];
+template <class Alloc> std::atomic<unsigned long> EpochAlloc<Alloc>::global_epoch(1);
+template <class Alloc> std::vector<typename EpochAlloc<Alloc>::Retired> EpochAlloc<Alloc>::retired;
+template <class Alloc> size_t EpochAlloc<Alloc>::num_unreclaimed = 0;
+
+#endif
@@ -0,0 +1,254 @@
+#if !defined __SLAB_ALLOC_H
+
+#define __SLAB_ALLOC_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#include <count_alloc/count_alloc.h>
+
+// The allocators used for trie nodes, leaves and buckets. An allocator is
+// a class with the static members
+//
+//   void* allocate(size_t bytes)
+//   void deallocate(void* p, size_t bytes)
+//   void* reallocate(void* p, size_t old_bytes, size_t new_bytes)
+//   size_t footprint(size_t bytes)
+//
+// deallocate and reallocate are always given the size p was allocated
+// with, and footprint is the number of bytes an allocation of bytes really
+// takes up. A block whose size is a multiple of CACHE_LINE_SIZE is cache
+// line aligned (but reallocate only promises the usual malloc alignment).
+
+// Straight malloc and free.
+class HeapAlloc
+{
+public:
+    static const size_t CACHE_LINE_SIZE = 64;
+
+    static inline void* allocate(size_t bytes)
+    {
+        void* p = 0;
+        if(bytes % CACHE_LINE_SIZE)
+        {
+            p = malloc(bytes);
+        }
+        else if(posix_memalign(&p, CACHE_LINE_SIZE, bytes))
+        {
+            p = 0;
+        }
+        if(!p)
+        {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+    static inline void deallocate(void* p, size_t)
+    {
+        free(p);
+        return;
+    }
+    static inline void* reallocate(void* p, size_t, size_t new_bytes)
+    {
+        p = realloc(p, new_bytes);
+        if(!p)
+        {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+    // The same estimate of malloc's overhead as update_mem_counter.
+    static inline size_t footprint(size_t bytes)
+    {
+        bytes += OVERHEAD;
+        return bytes < PARAGRAPH ? PARAGRAPH : bytes;
+    }
+};
+
+// Blocks of up to MAX_SMALL bytes are rounded up to a multiple of GRANULE
+// bytes, and each such size class is carved out of its own slab_size byte
+// slabs, with no per-block header. Freed blocks go on a free list for their
+// size class and are handed out again before the slab is cut into further.
+// Slabs are never given back to the system. Bigger blocks go to malloc.
+//
+// Each thread has its own slabs and free lists, so threads can allocate
+// at once without locking. A block freed by another thread than the one
+// that allocated it just joins the freeing thread's free list. When a 
+// thread exits, its free blocks and the uncut parts of its slabs go to a
+// pool shared by all the threads, which a thread takes blocks of a size
+// class from before it cuts a new slab for it.
+template <size_t slab_size = (1 << 16)> class SlabAlloc
+{
+public:
+    static const size_t CACHE_LINE_SIZE = 64;
+private:
+    static const size_t GRANULE = 16;
+    static const size_t MAX_SMALL = 4096;
+    static const size_t NUM_CLASSES = MAX_SMALL / GRANULE + 1;
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+    // For each size class: its free list, and the uncut part of its
+    // current slab.
+    static thread_local FreeBlock* free_lists[NUM_CLASSES];
+    static thread_local char* slab_next[NUM_CLASSES];
+    static thread_local char* slab_end[NUM_CLASSES];
+    // The shared pool's free list for each size class.
+    static FreeBlock* pool[NUM_CLASSES];
+    static std::mutex pool_lock;
+
+    // Gives the thread's free blocks to the pool when it exits. Made the
+    // first time the thread runs out of a size class, so threads that
+    // never allocate have none.
+    class ThreadExit
+    {
+    public:
+        ~ThreadExit()
+        {
+            std::lock_guard<std::mutex> guard(pool_lock);
+            for(size_t c = 1; c < NUM_CLASSES; c++)
+            {
+                size_t size = c * GRANULE;
+                while(slab_end[c] - slab_next[c] >= (std::ptrdiff_t)size)
+                {
+                    FreeBlock* b = reinterpret_cast<FreeBlock*>(slab_next[c]);
+                    b->next = free_lists[c];
+                    free_lists[c] = b;
+                    slab_next[c] += size;
+                }
+                while(free_lists[c])
+                {
+                    FreeBlock* b = free_lists[c];
+                    free_lists[c] = b->next;
+                    b->next = pool[c];
+                    pool[c] = b;
+                }
+            }
+            return;
+        }
+    };
+
+    static inline size_t size_class(size_t bytes)
+    {
+        return bytes ? (bytes + GRANULE - 1) / GRANULE : 1;
+    }
+    // Called when size class c's free list is empty.
+    static void* cut(size_t c)
+    {
+        size_t size = c * GRANULE;
+        if(slab_end[c] - slab_next[c] < (std::ptrdiff_t)size)
+        {
+            static thread_local ThreadExit thread_exit;
+            {
+                std::lock_guard<std::mutex> guard(pool_lock);
+                free_lists[c] = pool[c];
+                pool[c] = 0;
+            }
+            FreeBlock* b = free_lists[c];
+            if(b)
+            {
+                free_lists[c] = b->next;
+                return b;
+            }
+            // Whatever is left of the old slab is wasted.
+            void* slab = 0;
+            if(posix_memalign(&slab, CACHE_LINE_SIZE, slab_size))
+            {
+                throw std::bad_alloc();
+            }
+            slab_next[c] = static_cast<char*>(slab);
+            slab_end[c] = slab_next[c] + slab_size;
+        }
+        void* p = slab_next[c];
+        slab_next[c] += size;
+        return p;
+    }
+public:
+    static inline void* allocate(size_t bytes)
+    {
+        if(bytes > MAX_SMALL)
+        {
+            return HeapAlloc::allocate(bytes);
+        }
+        size_t c = size_class(bytes);
+        FreeBlock* b = free_lists[c];
+        if(b)
+        {
+            free_lists[c] = b->next;
+            return b;
+        }
+        return cut(c);
+    }
+    static inline void deallocate(void* p, size_t bytes)
+    {
+        if(bytes > MAX_SMALL)
+        {
+            HeapAlloc::deallocate(p, bytes);
+            return;
+        }
+        size_t c = size_class(bytes);
+        FreeBlock* b = static_cast<FreeBlock*>(p);
+        b->next = free_lists[c];
+        free_lists[c] = b;
+        return;
+    }
+    static void* reallocate(void* p, size_t old_bytes, size_t new_bytes)
+    {
+        if(old_bytes > MAX_SMALL && new_bytes > MAX_SMALL)
+        {
+            return HeapAlloc::reallocate(p, old_bytes, new_bytes);
+        }
+        if(old_bytes <= MAX_SMALL && new_bytes <= MAX_SMALL && size_class(old_bytes) == size_class(new_bytes))
+        {
+            return p;
+        }
+        void* q = allocate(new_bytes);
+        memcpy(q, p, old_bytes < new_bytes ? old_bytes : new_bytes);
+        deallocate(p, old_bytes);
+        return q;
+    }
+    static inline size_t footprint(size_t bytes)
+    {
+        return bytes > MAX_SMALL ? HeapAlloc::footprint(bytes) : size_class(bytes) * GRANULE;
+    }
+};
+
+template <size_t slab_size> thread_local typename SlabAlloc<slab_size>::FreeBlock* SlabAlloc<slab_size>::free_lists[NUM_CLASSES];
+template <size_t slab_size> thread_local char* SlabAlloc<slab_size>::slab_next[NUM_CLASSES];
+template <size_t slab_size> thread_local char* SlabAlloc<slab_size>::slab_end[NUM_CLASSES];
+template <size_t slab_size> typename SlabAlloc<slab_size>::FreeBlock* SlabAlloc<slab_size>::pool[NUM_CLASSES];
+template <size_t slab_size> std::mutex SlabAlloc<slab_size>::pool_lock;
+
+// Allocate, free and resize through Alloc, counting the footprint of each
+// block if active (see update_mem_counter_bytes).
+template <class Alloc, bool active> inline void* alloc_bytes(size_t bytes)
+{
+    update_mem_counter_bytes<active>(MemCounter::NEW, Alloc::footprint(bytes));
+    return Alloc::allocate(bytes);
+}
+template <class Alloc, bool active> inline void free_bytes(void* p, size_t bytes)
+{
+    update_mem_counter_bytes<active>(MemCounter::DELETE, Alloc::footprint(bytes));
+    Alloc::deallocate(p, bytes);
+    return;
+}
+template <class Alloc, bool active> inline void* realloc_bytes(void* p, size_t old_bytes, size_t new_bytes)
+{
+    update_mem_counter_bytes<active>(MemCounter::DELETE, Alloc::footprint(old_bytes));
+    update_mem_counter_bytes<active>(MemCounter::NEW, Alloc::footprint(new_bytes));
+    return Alloc::reallocate(p, old_bytes, new_bytes);
+}
+
+// In the style of LEDA_MEMORY: put this in a class declaration to make new
+// and delete of the class go through Alloc (and be counted if active).
+#define ALLOC_MEMORY(Alloc, active)\
+    static void* operator new(size_t bytes) { return alloc_bytes<Alloc,active>(bytes); }\
+    static void* operator new(size_t, void* p) { return p; }\
+    static void operator delete(void* p, size_t bytes) { free_bytes<Alloc,active>(p, bytes); }
+
+#endif
@@ -6,7 +6,7 @@ import time
 num_runs = 30
 
 # N.B. these should in same order as in perf_test.cpp
-data_structs = ( "map", "btree", "stree", "lpcbtrie", "lpcqtrie" )
+data_structs = ( "map", "btree", "stree", "lpcbtrie", "lpcqtrie", "bptree", "lpcbtrie_for", "lpcqtrie_for" )
 trace_names = ( "top_trace_bin", "amarok_trace_bin", "konq_trace_bin", "kpdf_trace_bin" )
 
 timing_binary = "./timing_perf_test"
@@ -51,7 +51,7 @@ os.system("make clean")
 print "---------------------------------------"
 print "----------> Done."
 
-print "----------> Running make USE_MEM_COUNTING=-DUSE_MEM_COUNTING (LPCBTrie/LPCQTrie mem-counting build)"
+print "----------> Running make USE_MEM_COUNTING=-DUSE_MEM_COUNTING (LPCBTrie/LPCQTrie/BPTree mem-counting build)"
 print "---------------------------------------"
 os.system("make USE_MEM_COUNTING=-DUSE_MEM_COUNTING")
 os.system("mv ./perf_test " + lpc_mem_binary)
@@ -116,6 +116,9 @@ sys.stdout.flush()
 
 os.system(lpc_mem_binary + " 3 irandom > %s/lpcbtrie_irandom_mem"%(results_dir))
 os.system(lpc_mem_binary + " 4 irandom > %s/lpcqtrie_irandom_mem"%(results_dir))
+os.system(lpc_mem_binary + " 5 irandom > %s/bptree_irandom_mem"%(results_dir))
+os.system(lpc_mem_binary + " 6 irandom > %s/lpcbtrie_for_irandom_mem"%(results_dir))
+os.system(lpc_mem_binary + " 7 irandom > %s/lpcqtrie_for_irandom_mem"%(results_dir))
 
 os.system(other_mem_binary + " 0 irandom > %s/map_irandom_mem"%(results_dir))
 os.system(other_mem_binary + " 1 irandom > %s/btree_irandom_mem"%(results_dir))
@@ -126,6 +129,9 @@ sys.stdout.flush()
 
 os.system(lpc_mem_binary + " 3 genome %s/set6_genome.dat > %s/lpcbtrie_genome_mem"%(data_dir, results_dir))
 os.system(lpc_mem_binary + " 4 genome %s/set6_genome.dat > %s/lpcqtrie_genome_mem"%(data_dir, results_dir))
+os.system(lpc_mem_binary + " 5 genome %s/set6_genome.dat > %s/bptree_genome_mem"%(data_dir, results_dir))
+os.system(lpc_mem_binary + " 6 genome %s/set6_genome.dat > %s/lpcbtrie_for_genome_mem"%(data_dir, results_dir))
+os.system(lpc_mem_binary + " 7 genome %s/set6_genome.dat > %s/lpcqtrie_for_genome_mem"%(data_dir, results_dir))
 
 os.system(other_mem_binary + " 0 genome %s/set6_genome.dat > %s/map_genome_mem"%(data_dir, results_dir))
 os.system(other_mem_binary + " 1 genome %s/set6_genome.dat > %s/btree_genome_mem"%(data_dir, results_dir))
@@ -137,6 +143,9 @@ sys.stdout.flush()
 for t in trace_names:
     os.system(lpc_mem_binary + " 3 valgrind %s/%s > %s/lpcbtrie_valgrind_%s_mem"%(data_dir, t, results_dir, t))
     os.system(lpc_mem_binary + " 4 valgrind %s/%s > %s/lpcqtrie_valgrind_%s_mem"%(data_dir, t, results_dir, t))
+    os.system(lpc_mem_binary + " 5 valgrind %s/%s > %s/bptree_valgrind_%s_mem"%(data_dir, t, results_dir, t))
+    os.system(lpc_mem_binary + " 6 valgrind %s/%s > %s/lpcbtrie_for_valgrind_%s_mem"%(data_dir, t, results_dir, t))
+    os.system(lpc_mem_binary + " 7 valgrind %s/%s > %s/lpcqtrie_for_valgrind_%s_mem"%(data_dir, t, results_dir, t))
     os.system(other_mem_binary + " 0 valgrind %s/%s > %s/map_valgrind_%s_mem"%(data_dir, t, results_dir, t))
     os.system(other_mem_binary + " 1 valgrind %s/%s > %s/btree_valgrind_%s_mem"%(data_dir, t, results_dir, t))
     os.system(other_mem_binary + " 2 valgrind %s/%s > %s/stree_valgrind_%s_mem"%(data_dir, t, results_dir, t))
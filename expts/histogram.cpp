@@ -0,0 +1,40 @@
+#include "histogram.h"
+#include <cstring>
+
+Histogram::Histogram() : num_samples(0), max_latency(0)
+{
+    memset(counts, 0, sizeof(counts));
+    return;
+}
+
+unsigned long long Histogram::bucket_max(int b)
+{
+    if(b < SUB_BUCKETS)
+    {
+        return b;
+    }
+    int shift = (b >> SUB_BITS) - 1;
+    unsigned long long first = (unsigned long long)(SUB_BUCKETS + (b & (SUB_BUCKETS - 1))) << shift;
+    return first + (1ULL << shift) - 1;
+}
+
+unsigned long long Histogram::percentile(double p) const
+{
+    unsigned long long rank = p * num_samples;
+    if(rank >= num_samples)
+    {
+        return max_latency;
+    }
+    unsigned long long seen = 0;
+    for(int b = 0; b < NUM_BUCKETS; b++)
+    {
+        seen += counts[b];
+        if(seen > rank)
+        {
+            // Never report more than was actually seen.
+            unsigned long long m = bucket_max(b);
+            return m < max_latency ? m : max_latency;
+        }
+    }
+    return max_latency;
+}
@@ -0,0 +1,57 @@
+#if !defined __HISTOGRAM_H
+
+#define __HISTOGRAM_H
+
+#include <time.h>
+
+// A histogram of latencies in nanoseconds, with log-sized buckets in the
+// style of HdrHistogram: each power of two is split into SUB_BUCKETS equal
+// buckets, so a latency is only ever out by 1 / SUB_BUCKETS (about 3%) when
+// it is read back.
+class Histogram
+{
+    static const int SUB_BITS = 5;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int NUM_BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    unsigned long long counts[NUM_BUCKETS];
+    unsigned long long num_samples;
+    unsigned long long max_latency;
+
+    static inline int bucket(unsigned long long ns)
+    {
+        if(ns < SUB_BUCKETS)
+        {
+            return ns;
+        }
+        int shift = 63 - __builtin_clzll(ns) - SUB_BITS;
+        return ((shift + 1) << SUB_BITS) + ((ns >> shift) & (SUB_BUCKETS - 1));
+    }
+    // The largest latency that falls in bucket b.
+    static unsigned long long bucket_max(int b);
+public:
+    Histogram();
+    inline void record(unsigned long long ns)
+    {
+        counts[bucket(ns)]++;
+        num_samples++;
+        if(ns > max_latency)
+        {
+            max_latency = ns;
+        }
+        return;
+    }
+    // The latency that fraction p of the samples are at or below.
+    unsigned long long percentile(double p) const;
+    unsigned long long max() const { return max_latency; }
+};
+
+// A monotonic clock in nanoseconds, for timing single operations.
+inline unsigned long long now_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,120 @@
+#include "perf_counters.h"
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+const char* PerfCounters::event_names[NUM_EVENTS] = { "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "dtlb_misses" };
+
+// There is no glibc wrapper for perf_event_open.
+static int perf_event_open(perf_event_attr* attr)
+{
+    return syscall(__NR_perf_event_open, attr, 0, -1, -1, 0);
+}
+
+static unsigned long long cache_miss(unsigned long long cache)
+{
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+PerfCounters::PerfCounters()
+{
+    const unsigned int types[NUM_EVENTS] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, 
+                                             PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE };
+    const unsigned long long configs[NUM_EVENTS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, cache_miss(PERF_COUNT_HW_CACHE_L1D),
+                                                     PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES, cache_miss(PERF_COUNT_HW_CACHE_DTLB) };
+    for(int i = 0; i < NUM_EVENTS; i++)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = types[i];
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fds[i] = perf_event_open(&attr);
+    }
+    return;
+}
+
+PerfCounters::~PerfCounters()
+{
+    for(int i = 0; i < NUM_EVENTS; i++)
+    {
+        if(fds[i] >= 0)
+        {
+            close(fds[i]);
+        }
+    }
+    return;
+}
+
+bool PerfCounters::is_open() const
+{
+    for(int i = 0; i < NUM_EVENTS; i++)
+    {
+        if(fds[i] >= 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PerfCounters::start()
+{
+    for(int i = 0; i < NUM_EVENTS; i++)
+    {
+        if(fds[i] >= 0)
+        {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    return;
+}
+
+void PerfCounters::read(Counts& counts)
+{
+    for(int i = 0; i < NUM_EVENTS; i++)
+    {
+        if(fds[i] >= 0)
+        {
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for(int i = 0; i < NUM_EVENTS; i++)
+    {
+        // The count, then the time enabled and the time actually counting.
+        unsigned long long values[3];
+        counts.count[i] = -1;
+        if(fds[i] >= 0 && ::read(fds[i], values, sizeof(values)) == sizeof(values) && values[2])
+        {
+            counts.count[i] = values[0] * ((double) values[1] / values[2]);
+        }
+    }
+    return;
+}
+
+void print_per_op(std::ostream& out, const PerfCounters::Counts& counts, unsigned long num_ops)
+{
+    for(int i = 0; i < PerfCounters::NUM_EVENTS; i++)
+    {
+        if(i)
+        {
+            out << " ";
+        }
+        if(counts.count[i] < 0)
+        {
+            out << "-";
+        }
+        else
+        {
+            out << counts.count[i] / num_ops;
+        }
+    }
+    return;
+}
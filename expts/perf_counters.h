@@ -0,0 +1,42 @@
+#if !defined __PERF_COUNTERS_H
+
+#define __PERF_COUNTERS_H
+
+#include <ostream>
+
+// Hardware event counters for the calling thread, opened directly through
+// Linux's perf_event_open, so no PAPI. Used like Timer: start() at the
+// start of a phase and read() at the end. Only user space is counted.
+//
+// Each event is opened on its own rather than as a group, so an event
+// the CPU (or the kernel's perf_event_paranoid setting) won't allow is
+// just left out. If there are more events than hardware counters the
+// kernel takes turns at them, and the counts are scaled up by the
+// fraction of the phase each was actually counting for.
+class PerfCounters
+{
+public:
+    enum Event { CYCLES = 0, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCH_MISSES, DTLB_MISSES, NUM_EVENTS };
+    static const char* event_names[NUM_EVENTS];
+
+    // The count of each event over a phase, negative if it wasn't counted.
+    struct Counts
+    {
+        double count[NUM_EVENTS];
+    };
+private:
+    int fds[NUM_EVENTS];
+public:
+    PerfCounters();
+    ~PerfCounters();
+    // Whether any of the events could be opened.
+    bool is_open() const;
+    void start();
+    void read(Counts& counts);
+};
+
+// Print each count in counts divided by num_ops, separated by spaces,
+// with a - for an event that wasn't counted.
+void print_per_op(std::ostream& out, const PerfCounters::Counts& counts, unsigned long num_ops);
+
+#endif
@@ -1,15 +1,27 @@
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
 #include <expts/timer.h>
+#include <expts/histogram.h>
+#include <expts/perf_counters.h>
+#include <expts/skewed_keys.h>
 
 #include <xor_gens/xor_gens.h>
 
 #include <stdmap/stdmap.h>
 #include <qtrie/lpcqtrie.h>
 #include <btrie/lpcbtrie.h>
+#include <btrie/concurrent_lpcbtrie.h>
 #include <btree/btree.h>
 #include <veb/stree.h>
+#include <bptree/bptree.h>
 
 #include <count_alloc/count_alloc.h>
 
@@ -17,15 +29,120 @@ const int NUM_SIZES          = 14;
 const int RAND_SET_SIZES[NUM_SIZES] = { 1 << 14, 1 << 15, 1 << 16, 1 << 17, 1 << 18, 1 << 19, 1 << 20, 
                                         1 << 21, 1 << 22, 1 << 23, 1 << 24, 1 << 25, 1 << 26, 1 << 27 };
 
-const int NUM_STRUCTS = 5;
-enum DATA_STRUCT_ID { STDMAP = 0, BTREE, STREE, LPCBTRIE, QTRIE };
-const char* data_struct_names[] = { "stdmap", "btree", "stree", "lpcbtrie", "lpcqtrie" };
+// lpcbtrie_conc (ConcurrentLPCBTrie) only runs the update workload.
+const int NUM_STRUCTS = 9;
+enum DATA_STRUCT_ID { STDMAP = 0, BTREE, STREE, LPCBTRIE, QTRIE, BPTREE, FOR_LPCBTRIE, FOR_QTRIE, CONC_LPCBTRIE };
+const char* data_struct_names[] = { "stdmap", "btree", "stree", "lpcbtrie", "lpcqtrie", "bptree", "lpcbtrie_for", "lpcqtrie_for", "lpcbtrie_conc" };
 
 
-const int MAX_INSERT_SIZES[NUM_STRUCTS] = { 1 << 26, 1 << 27, 1 << 25,  1 << 27, 1 << 27 };
-const int MAX_DELETE_SIZES[NUM_STRUCTS] = { 1 << 26, 1 << 27, 1 << 21,  1 << 27, 1 << 27 };
+const int MAX_INSERT_SIZES[NUM_STRUCTS] = { 1 << 26, 1 << 27, 1 << 25,  1 << 27, 1 << 27, 1 << 27, 1 << 27, 1 << 27, 1 << 27 };
+const int MAX_DELETE_SIZES[NUM_STRUCTS] = { 1 << 26, 1 << 27, 1 << 21,  1 << 27, 1 << 27, 1 << 27, 1 << 27, 1 << 27, 1 << 27 };
 
-enum WORKLOAD_ID { INSERT_LOCATE_OPS = 0, INSERT_DELETE_OPS, VALGRIND_TRACES, GENOME };
+enum WORKLOAD_ID { INSERT_LOCATE_OPS = 0, INSERT_DELETE_OPS, VALGRIND_TRACES, GENOME, BATCH_LOCATE_OPS, ZIPF_LOCATE_OPS, HOT_SET_LOCATE_OPS, RANGE_SCAN_OPS, CLUSTERED_OPS, SWEEP_OPS, TEST_OPS, UPDATE_OPS };
+
+const int DEFAULT_BATCH_SIZE = 256;
+
+const double DEFAULT_ZIPF_THETA = 0.99;
+// The hot set workload: HOT_FRACTION of the keys get HOT_PROB of the locates,
+// and the hot set moves NUM_HOT_SETS - 1 times over the locates.
+const double HOT_FRACTION = 0.01;
+const double HOT_PROB = 0.9;
+const int NUM_HOT_SETS = 16;
+
+// The range workload scans runs of each of these many consecutive keys,
+// making enough scans to visit about as many keys as were inserted (but 
+// at least MIN_SCANS scans).
+const int NUM_RANGE_LENGTHS = 5;
+const int RANGE_LENGTHS[NUM_RANGE_LENGTHS] = { 1, 10, 100, 1000, 10000 };
+const int MIN_SCANS = 100;
+
+// The clustered workload's keys have one of NUM_CLUSTERS random prefixes
+// and random low CLUSTER_BITS bits, so the tries have long path compression
+// strings (36 bits or more with 64-bit keys) above each cluster.
+const int NUM_CLUSTERS = 16;
+const int CLUSTER_BITS = 24;
+
+// The sweep workload builds a bucketed trie of SWEEP_KEYS keys with each of
+// these bucket sizes in turn, then with adaptive sizing. The dense keys are
+// drawn from below DENSE_RANGE times their number.
+const int NUM_SWEEP_SIZES = 9;
+const int SWEEP_BUCKET_SIZES[NUM_SWEEP_SIZES] = { 8, 16, 32, 64, 128, 256, 512, 1024, 2048 };
+const int SWEEP_KEYS = 1 << 22;
+const int DENSE_RANGE = 4;
+
+// The update workload's readers each locate UPDATE_KEYS random keys in a
+// structure holding UPDATE_KEYS keys, while its writer inserts UPDATE_PASS
+// new keys and removes them again, over and over.
+const int UPDATE_KEYS = 1 << 22;
+const int UPDATE_PASS = 1 << 16;
+
+// The test workload checks each structure against std::map on each of these
+// key sets, looking up TEST_QUERIES random keys, each key and its neighbours,
+// and the multiples of 2^TEST_STEP_BITS. Each scan starts at a key looked up
+// and runs over TEST_SCAN_LENGTH keys (or to the end).
+const int NUM_TEST_SETS = 4;
+enum TEST_SET_ID { RANDOM_TEST = 0, PREFIX_TEST, CLUSTERED_TEST, DENSE_TEST };
+const char* test_set_names[] = { "random", "prefix", "clustered", "dense" };
+const int TEST_KEYS = 1 << 16;
+const int TEST_QUERIES = 1 << 16;
+const int TEST_STEP_BITS = 56;
+const int TEST_SCAN_LENGTH = 16;
+// The prefix set: TEST_PREFIX_KEYS random keys with the top byte TEST_PREFIX,
+// then TEST_PREFIX_ABOVE. Looking up TEST_PREFIX_QUERY, which lies between
+// them, misses the path compression string the first keys share, so its
+// locate is the largest of the first keys and its lower bound TEST_PREFIX_ABOVE.
+const unsigned long TEST_PREFIX = 0x22;
+const int TEST_PREFIX_KEYS = 200;
+const unsigned long TEST_PREFIX_ABOVE = 0x3000000000000000;
+const unsigned long TEST_PREFIX_QUERY = 0x2a00000000000000;
+
+// The test workload's randomized check of the bucketed tries runs
+// TEST_MIX_OPS operations at each bucket size, and then adapting from the
+// smallest. A third of them have each of these shares of locates, so the
+// adaptive size moves through its range.
+const int NUM_TEST_MIXES = 3;
+const double TEST_LOCATE_SHARES[NUM_TEST_MIXES] = { 0.3, 0.9, 0.99 };
+const int TEST_MIX_OPS = 3 << 17;
+const unsigned long TEST_MIX_DENSE_MASK = 0xffff;
+
+// The number of successful locates is added in here, so that the compiler
+// can't throw away locates whose results are otherwise unused.
+volatile unsigned long num_located = 0;
+// The number of wrong answers the test workload found.
+unsigned long num_wrong = 0;
+
+// Only set with -p. The hardware counters are then read over each timed
+// phase, and printed per operation after the timings.
+PerfCounters* perf_counters = 0;
+
+inline void start_counters()
+{
+    if(perf_counters)
+    {
+        perf_counters->start();
+    }
+    return;
+}
+
+inline void read_counters(PerfCounters::Counts& counts)
+{
+    if(perf_counters)
+    {
+        perf_counters->read(counts);
+    }
+    return;
+}
+
+// Print a space then the counts per operation, if -p was given.
+void print_counts(const PerfCounters::Counts& counts, unsigned long num_ops)
+{
+    if(perf_counters)
+    {
+        std::cout << " ";
+        print_per_op(std::cout, counts, num_ops);
+    }
+    return;
+}
 
 #if defined REDEF_NEW
 
@@ -42,39 +159,52 @@ void *operator new(size_t size) throw(std::bad_alloc)
 #endif
 
 
-template <class DataStruct> void apply_insert_locate(DataStruct* ds, int size, float& insert_time, float& locate_time)
+template <class DataStruct> void apply_insert_locate(DataStruct* ds, int size, float& insert_time, float& locate_time, 
+                                                     PerfCounters::Counts& insert_counts, PerfCounters::Counts& locate_counts)
 {
     using namespace std;
     Timer t;
     if(sizeof(unsigned long) == 4)
     {
+        start_counters();
         t.start();
         for(int i = 0; i < size; i++)
         {
             ds->insert(xor4096s(), i);
         }
         insert_time = t.elapsed();
+        read_counters(insert_counts);
+        unsigned long found = 0;
+        start_counters();
         t.start();
         for(int i = 0; i < size; i++)
         {
-            ds->locate(xor4096s());
+            found += ds->locate(xor4096s()) != 0;
         }
         locate_time = t.elapsed();
+        read_counters(locate_counts);
+        num_located += found;
     }
     else if(sizeof(unsigned long) == 8)
     {
+        start_counters();
         t.start();
         for(int i = 0; i < size; i++)
         {
             ds->insert(xor4096l(), i);
         }
         insert_time = t.elapsed();
+        read_counters(insert_counts);
+        unsigned long found = 0;
+        start_counters();
         t.start();
         for(int i = 0; i < size; i++)
         {
-            ds->locate(xor4096l());
+            found += ds->locate(xor4096l()) != 0;
         }
         locate_time = t.elapsed();
+        read_counters(locate_counts);
+        num_located += found;
     }
     else
     {
@@ -87,6 +217,7 @@ template <class DataStruct> void apply_insert_locate(DataStruct* ds, int size, f
 template <class DataStruct> void do_insert_locate(int max_size)
 {
     float insert_time, locate_time;
+    PerfCounters::Counts insert_counts, locate_counts;
     using namespace std;
     for(int i = 0; i < NUM_SIZES; i++)
     {
@@ -99,210 +230,1361 @@ template <class DataStruct> void do_insert_locate(int max_size)
         {
             break;
         }
-        apply_insert_locate(ds, size, insert_time, locate_time);
+        apply_insert_locate(ds, size, insert_time, locate_time, insert_counts, locate_counts);
 #if defined REDEF_NEW || defined USE_MEM_COUNTING
         cout << size << " " << peak_memory / (float) size << endl;
 #else
-        cout << size << " " << 1e6 * insert_time / size << " " << 1e6 * locate_time / size << endl;
+        cout << size << " " << 1e6 * insert_time / size << " " << 1e6 * locate_time / size;
+        print_counts(insert_counts, size);
+        print_counts(locate_counts, size);
+        cout << endl;
 #endif        
         delete ds;
     }
     return;
 }
 
-template <class DataStruct> void apply_delete_mix(DataStruct* ds, long* workload, bool* is_insert, int size, float& time)
+// As apply_insert_locate, but each key located is one of those inserted, 
+// chosen by ranks.next() (a rank being a position in the order of insertion,
+// which is random in key order). The keys are made up front, so neither the
+// generator nor the rank distribution is timed.
+template <class DataStruct, class Ranks> void apply_skewed_locate(DataStruct* ds, int size, Ranks& ranks, float& insert_time, float& locate_time, 
+                                                                  PerfCounters::Counts& insert_counts, PerfCounters::Counts& locate_counts)
 {
-    using namespace std;
+    typedef unsigned long ul;
     Timer t;
+    ul* keys = new ul[size];
+    ul* locate_keys = new ul[size];
+    for(int i = 0; i < size; i++)
+    {
+        keys[i] = sizeof(ul) == 4 ? xor4096s() : xor4096l();
+    }
+    for(int i = 0; i < size; i++)
+    {
+        locate_keys[i] = keys[ranks.next()];
+    }
+    start_counters();
     t.start();
     for(int i = 0; i < size; i++)
     {
-        if(is_insert[i])
+        ds->insert(keys[i], i);
+    }
+    insert_time = t.elapsed();
+    read_counters(insert_counts);
+    unsigned long found = 0;
+    start_counters();
+    t.start();
+    for(int i = 0; i < size; i++)
+    {
+        found += ds->locate(locate_keys[i]) != 0;
+    }
+    locate_time = t.elapsed();
+    read_counters(locate_counts);
+    num_located += found;
+    delete[] keys;
+    delete[] locate_keys;
+    return;
+}
+
+// As do_insert_locate, with the locates skewed: Zipf(theta) if hot_set is
+// false, otherwise by a moving hot set.
+template <class DataStruct> void do_skewed_locate(int max_size, bool hot_set, double theta)
+{
+    float insert_time, locate_time;
+    PerfCounters::Counts insert_counts, locate_counts;
+    using namespace std;
+    for(int i = 0; i < NUM_SIZES; i++)
+    {
+        int size = RAND_SET_SIZES[i];
+        if(size > max_size) 
         {
-            ds->insert(workload[i], i);
+            break;
+        }
+        DataStruct* ds = new DataStruct;
+        if(hot_set)
+        {
+            HotSetRanks ranks(size, HOT_FRACTION, HOT_PROB, size / NUM_HOT_SETS);
+            apply_skewed_locate(ds, size, ranks, insert_time, locate_time, insert_counts, locate_counts);
         }
         else
         {
-            ds->remove(workload[rand() % (i + 1)]);
+            ZipfRanks ranks(size, theta);
+            apply_skewed_locate(ds, size, ranks, insert_time, locate_time, insert_counts, locate_counts);
         }
+        cout << size << " " << 1e6 * insert_time / size << " " << 1e6 * locate_time / size;
+        print_counts(insert_counts, size);
+        print_counts(locate_counts, size);
+        cout << endl;
+        delete ds;
     }
-    time = t.elapsed();
     return;
 }
 
-template <class DataStruct> void do_delete_mix(int max_size)
+// As apply_insert_locate, but with the keys inserted and located drawn from
+// the clusters.
+template <class DataStruct> void apply_clustered_insert_locate(DataStruct* ds, int size, float& insert_time, float& locate_time, 
+                                                               PerfCounters::Counts& insert_counts, PerfCounters::Counts& locate_counts)
+{
+    typedef unsigned long ul;
+    const ul low_mask = (1UL << CLUSTER_BITS) - 1;
+    Timer t;
+    ul prefixes[NUM_CLUSTERS];
+    for(int i = 0; i < NUM_CLUSTERS; i++)
+    {
+        prefixes[i] = (sizeof(ul) == 4 ? xor4096s() : xor4096l()) & ~low_mask;
+    }
+    ul* keys = new ul[size];
+    ul* locate_keys = new ul[size];
+    for(int i = 0; i < size; i++)
+    {
+        keys[i] = prefixes[xor4096l() % NUM_CLUSTERS] | (xor4096l() & low_mask);
+        locate_keys[i] = prefixes[xor4096l() % NUM_CLUSTERS] | (xor4096l() & low_mask);
+    }
+    start_counters();
+    t.start();
+    for(int i = 0; i < size; i++)
+    {
+        ds->insert(keys[i], i);
+    }
+    insert_time = t.elapsed();
+    read_counters(insert_counts);
+    unsigned long found = 0;
+    start_counters();
+    t.start();
+    for(int i = 0; i < size; i++)
+    {
+        found += ds->locate(locate_keys[i]) != 0;
+    }
+    locate_time = t.elapsed();
+    read_counters(locate_counts);
+    num_located += found;
+    delete[] keys;
+    delete[] locate_keys;
+    return;
+}
+
+template <class DataStruct> void do_clustered_insert_locate(int max_size)
 {
+    float insert_time, locate_time;
+    PerfCounters::Counts insert_counts, locate_counts;
     using namespace std;
     for(int i = 0; i < NUM_SIZES; i++)
     {
-        DataStruct* ds = new DataStruct;
         int size = RAND_SET_SIZES[i];
         if(size > max_size) 
         {
             break;
         }
-        bool* mix_mask = new bool[size];
-        long* workload = new long[size];
-        for(int j = 0; j < size; j++)
-        {        
-            mix_mask[j] = rand() / (RAND_MAX + 1.0) >= 0.5;                
-            if(sizeof(long) == 4)
-            {
-                workload[j] = xor4096s();
-            }
-            else
-            {
-                workload[j] = xor4096l();
-            }
-        }    
-        float time;
-        apply_delete_mix(ds, workload, mix_mask, size, time);
-        cout << size << " " << 1e6 * time / size << endl;
+        DataStruct* ds = new DataStruct;
+        apply_clustered_insert_locate(ds, size, insert_time, locate_time, insert_counts, locate_counts);
+        cout << size << " " << 1e6 * insert_time / size << " " << 1e6 * locate_time / size;
+        print_counts(insert_counts, size);
+        print_counts(locate_counts, size);
+        cout << endl;
         delete ds;
-        delete[] mix_mask;
-        delete[] workload;
     }
     return;
 }
 
-template <class DataStruct> void apply_genome(char* genome_file_name)
+// Set the bucket size of the structures that have buckets (see BucketSizer),
+// returning false for the others.
+template <class DataStruct> bool set_bucket_size(DataStruct*, int, bool)
 {
-    using namespace std;
+    return false;
+}
 
-    const int STR_LEN = 9;
-    ifstream in(genome_file_name);
-    if(!in)
+template <class KeyType, class ValueType, bool count_mem, class Alloc, template <class, class, bool, class> class BucketT> bool set_bucket_size(LPCBTrie<KeyType, ValueType, count_mem, Alloc, BucketT>* ds, int size, bool adaptive)
+{
+    ds->set_bucket_size(size, adaptive);
+    return true;
+}
+
+template <class KeyType, class ValueType, bool count_mem, class Alloc, template <class, class, bool, class> class BucketT> bool set_bucket_size(LPCQTrie<KeyType, ValueType, count_mem, Alloc, BucketT>* ds, int size, bool adaptive)
+{
+    ds->set_bucket_size(size, adaptive);
+    return true;
+}
+
+// Insert the size keys, then locate the size locate_keys.
+template <class DataStruct> void apply_sweep(DataStruct* ds, const unsigned long* keys, const unsigned long* locate_keys, int size, float& insert_time, float& locate_time)
+{
+    Timer t;
+    t.start();
+    for(int i = 0; i < size; i++)
     {
-        cerr << "FATAL ERROR: Couldn't open genome file: " << genome_file_name << endl;
-        return;
+        ds->insert(keys[i], i);
     }
-    int size;
-    in >> size;
-    unsigned long* data = new unsigned long[size];
+    insert_time = t.elapsed();
+    unsigned long found = 0;
+    t.start();
     for(int i = 0; i < size; i++)
     {
-        string s;
-        in >> s;
-        data[i] = 0;
-        for(int j = 0; j < STR_LEN; j++)
-        {
-            switch(s[j])
-            {
-                case 'a':
-                break;
-                case 'c':
-                    data[i] |= 1;
-                break;
-                case 'g':
-                    data[i] |= 2;
-                break;
-                case 't':
-                    data[i] |= 3;
-                break;
-            }
-            data[i] <<= 2;
-        }         
+        found += ds->locate(locate_keys[i]) != 0;
     }
-    in.close();
+    locate_time = t.elapsed();
+    num_located += found;
+    return;
+}
 
-    peak_memory = 0; // ignore the data just allocated
-    DataStruct ds;
-    Timer t;
-    
-    for(int i = 0; i < size; i++)
+template <class DataStruct> void do_sweep(int max_size)
+{
+    typedef unsigned long ul;
+    using namespace std;
+    DataStruct* probe = new DataStruct;
+    bool has_buckets = set_bucket_size(probe, BucketSizer<ul>::DEFAULT_SIZE, false);
+    delete probe;
+    if(!has_buckets)
     {
-        data[i] = (data[i] << 18) | data[(i + 1) % size];
+        cerr << "Only the bucketed tries have a bucket size to sweep." << endl;
+        return;
     }
-    t.start();
-    for(int i = 0; i < size; i++)
+    int size = SWEEP_KEYS < max_size ? SWEEP_KEYS : max_size;
+    ul* keys[2];
+    ul* locate_keys[2];
+    for(int d = 0; d < 2; d++)
     {
-        ds.insert(data[i], i);
+        keys[d] = new ul[size];
+        locate_keys[d] = new ul[size];
     }
-#if !defined REDEF_NEW && !defined USE_MEM_COUNTING
-    cout << t.elapsed() << " ";
-    t.start();
     for(int i = 0; i < size; i++)
     {
-        ds.locate(data[i]);
+        keys[0][i] = sizeof(ul) == 4 ? xor4096s() : xor4096l();
+        locate_keys[0][i] = sizeof(ul) == 4 ? xor4096s() : xor4096l();
+        keys[1][i] = xor4096l() % ((ul)DENSE_RANGE * size);
+        locate_keys[1][i] = xor4096l() % ((ul)DENSE_RANGE * size);
     }
+    for(int j = 0; j <= NUM_SWEEP_SIZES; j++)
+    {
+        bool adaptive = j == NUM_SWEEP_SIZES;
+        int bucket_size = adaptive ? BucketSizer<ul>::DEFAULT_SIZE : SWEEP_BUCKET_SIZES[j];
+        cout << (adaptive ? 0 : bucket_size);
+        for(int d = 0; d < 2; d++)
+        {
+#if defined REDEF_NEW || defined USE_MEM_COUNTING
+            peak_memory = 0;
 #endif
-
+            DataStruct* ds = new DataStruct;
+            set_bucket_size(ds, bucket_size, adaptive);
+            float insert_time, locate_time;
+            apply_sweep(ds, keys[d], locate_keys[d], size, insert_time, locate_time);
 #if defined REDEF_NEW || defined USE_MEM_COUNTING
-    cout << peak_memory << endl;
+            cout << " " << peak_memory / (float) size;
 #else
-    cout << t.elapsed() << endl;
-#endif    
-
-    delete[] data;
+            cout << " " << 1e6 * insert_time / size << " " << 1e6 * locate_time / size;
+#endif
+            delete ds;
+        }
+        cout << endl;
+    }
+    for(int d = 0; d < 2; d++)
+    {
+        delete[] keys[d];
+        delete[] locate_keys[d];
+    }
     return;
 }
 
-template <class DataStruct> void apply_valgrind_trace(char* file_name)
+// num_scans scans of ds, the i-th from los[i] to his[i]. Returns the number
+// of keys visited. Their values are summed into num_located, like the
+// locate results.
+template <class DataStruct> unsigned long apply_range_scan(DataStruct* ds, const unsigned long* los, const unsigned long* his, int num_scans, 
+                                                           float& time, PerfCounters::Counts& counts)
 {
-    using namespace std;
-    ifstream in(file_name, ios::binary);
-    if(!in)
+    typedef unsigned long ul;
+    Timer t;
+    ul num_keys = 0, sum = 0;
+    start_counters();
+    t.start();
+    for(int i = 0; i < num_scans; i++)
     {
-        cerr << "Couldn't open valgrind trace: " << file_name << endl;
-        return;
+        ds->scan(los[i], his[i], [&](const ul&, const ul& value) { num_keys++; sum += value; });
     }
-    unsigned long* ops;
-    bool* is_store;
-    unsigned long num_ops;
-    in >> num_ops;
-    in.get();
-    ops = new unsigned long[num_ops];
-    is_store = new bool[num_ops];
-
-    in.read((char*) is_store, num_ops * sizeof(*is_store));
-    in.read((char*) ops, num_ops * sizeof(*ops));
+    time = t.elapsed();
+    read_counters(counts);
+    num_located += sum;
+    return num_keys;
+}
 
-    peak_memory = 0;
-    DataStruct ds;
-    Timer t;
-    t.start();
-    for(unsigned long i = 0; i < num_ops; i++)
+// Insert size random keys, then for each range length L scan from random
+// inserted keys to the key L - 1 places after them in key order, so every
+// scan visits exactly L keys.
+template <class DataStruct> void do_range_scan(int max_size)
+{
+    typedef unsigned long ul;
+    using namespace std;
+    for(int i = 0; i < NUM_SIZES; i++)
     {
-        if(is_store[i])
+        int size = RAND_SET_SIZES[i];
+        if(size > max_size) 
         {
-            ds.insert(ops[i], i);
+            break;
         }
-        else
+        DataStruct* ds = new DataStruct;
+        vector<ul> keys(size);
+        for(int j = 0; j < size; j++)
+        {
+            keys[j] = sizeof(ul) == 4 ? xor4096s() : xor4096l();
+            ds->insert(keys[j], j);
+        }
+        sort(keys.begin(), keys.end());
+        keys.erase(unique(keys.begin(), keys.end()), keys.end());
+        int num_keys = keys.size();
+
+        float times[NUM_RANGE_LENGTHS];
+        unsigned long num_visited[NUM_RANGE_LENGTHS];
+        PerfCounters::Counts counts[NUM_RANGE_LENGTHS];
+        int num_lengths = 0;
+        for(; num_lengths < NUM_RANGE_LENGTHS && RANGE_LENGTHS[num_lengths] <= num_keys; num_lengths++)
+        {
+            int length = RANGE_LENGTHS[num_lengths];
+            int num_scans = max(num_keys / length, MIN_SCANS);
+            vector<ul> los(num_scans), his(num_scans);
+            for(int j = 0; j < num_scans; j++)
+            {
+                int first = xor4096l() % (num_keys - length + 1);
+                los[j] = keys[first];
+                his[j] = keys[first + length - 1];
+            }
+            num_visited[num_lengths] = apply_range_scan(ds, &los[0], &his[0], num_scans, times[num_lengths], counts[num_lengths]);
+        }
+        cout << size;
+        for(int j = 0; j < num_lengths; j++)
+        {
+            cout << " " << 1e-6 * num_visited[j] / times[j];
+        }
+        for(int j = 0; j < num_lengths; j++)
         {
-            ds.locate(ops[i]);
+            print_counts(counts[j], num_visited[j]);
         }
+        cout << endl;
+        delete ds;
     }
-#if defined REDEF_NEW || defined USE_MEM_COUNTING
-    cout << peak_memory << endl;
-#else
-    cout << t.elapsed() << endl;
-#endif    
-    delete[] ops;
-    delete[] is_store;
     return;
 }
 
-template <class DataStruct> void apply_workload(WORKLOAD_ID workload, DATA_STRUCT_ID data_struct, char* file_name)
+// Print the p50, p99, p99.9 and max latencies in h, in microseconds.
+void print_latencies(const Histogram& h)
 {
-    switch(workload)
+    using namespace std;
+    cout << 1e-3 * h.percentile(0.5) << " " << 1e-3 * h.percentile(0.99) << " " << 1e-3 * h.percentile(0.999) << " " << 1e-3 * h.max();
+    return;
+}
+
+// As apply_insert_locate, but each insert and locate is timed on its own,
+// into a histogram. The keys are made up front, so the generator isn't
+// timed. Each latency also takes in the cost of recording the last.
+template <class DataStruct> void apply_latency_insert_locate(DataStruct* ds, int size, Histogram& insert_hist, Histogram& locate_hist)
+{
+    typedef unsigned long ul;
+    ul* keys = new ul[size];
+    for(int i = 0; i < size; i++)
     {
-        case INSERT_LOCATE_OPS:
-            do_insert_locate<DataStruct>(MAX_INSERT_SIZES[data_struct]);
-        break;
-        case INSERT_DELETE_OPS:
-            do_delete_mix<DataStruct>(MAX_DELETE_SIZES[data_struct]);
-        break;
-        case VALGRIND_TRACES:
-            apply_valgrind_trace<DataStruct>(file_name);
-        break;
-        case GENOME:
-            apply_genome<DataStruct>(file_name);
-        break;
+        keys[i] = sizeof(ul) == 4 ? xor4096s() : xor4096l();
+    }
+    unsigned long long last = now_ns();
+    for(int i = 0; i < size; i++)
+    {
+        ds->insert(keys[i], i);
+        unsigned long long t = now_ns();
+        insert_hist.record(t - last);
+        last = t;
+    }
+    for(int i = 0; i < size; i++)
+    {
+        keys[i] = sizeof(ul) == 4 ? xor4096s() : xor4096l();
     }
+    unsigned long found = 0;
+    last = now_ns();
+    for(int i = 0; i < size; i++)
+    {
+        found += ds->locate(keys[i]) != 0;
+        unsigned long long t = now_ns();
+        locate_hist.record(t - last);
+        last = t;
+    }
+    num_located += found;
+    delete[] keys;
     return;
 }
 
-int main(int argc, char** argv)
+template <class DataStruct> void do_latency_insert_locate(int max_size)
+{
+    using namespace std;
+    for(int i = 0; i < NUM_SIZES; i++)
+    {
+        int size = RAND_SET_SIZES[i];
+        if(size > max_size) 
+        {
+            break;
+        }
+        DataStruct* ds = new DataStruct;
+        Histogram insert_hist, locate_hist;
+        apply_latency_insert_locate(ds, size, insert_hist, locate_hist);
+        cout << size << " ";
+        print_latencies(insert_hist);
+        cout << " ";
+        print_latencies(locate_hist);
+        cout << endl;
+        delete ds;
+    }
+    return;
+}
+
+// Locate each of keys[0], .., keys[n - 1], one at a time. The overloads below
+// pick up the structures that have a batched locate of their own.
+template <class DataStruct, class KeyType, class ValueType> void locate_batch(DataStruct* ds, const KeyType* keys, size_t n, ValueType** out)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        out[i] = ds->locate(keys[i]);
+    }
+    return;
+}
+
+template <class KeyType, class ValueType, bool count_mem, class Alloc, template <class, class, bool, class> class BucketT> void locate_batch(LPCBTrie<KeyType, ValueType, count_mem, Alloc, BucketT>* ds, const KeyType* keys, size_t n, typename ValueTypeInfo<KeyType, ValueType>::Value** out)
+{
+    ds->locate_batch(keys, n, out);
+    return;
+}
+
+template <class KeyType, class ValueType, bool count_mem, class Alloc, template <class, class, bool, class> class BucketT> void locate_batch(LPCQTrie<KeyType, ValueType, count_mem, Alloc, BucketT>* ds, const KeyType* keys, size_t n, typename ValueTypeInfo<KeyType, ValueType>::Value** out)
+{
+    ds->locate_batch(keys, n, out);
+    return;
+}
+
+// As apply_insert_locate, but the random keys to locate are generated up front
+// and located in batches of batch_size, first by the scalar loop and
+// then by locate_batch.
+template <class DataStruct> void apply_batch_locate(DataStruct* ds, int size, int batch_size, float& insert_time, float& scalar_time, float& batch_time, PerfCounters::Counts* counts)
+{
+    typedef unsigned long ul;
+    Timer t;
+    ul* keys = new ul[size];
+    ul** out = new ul*[batch_size];
+
+    start_counters();
+    t.start();
+    for(int i = 0; i < size; i++)
+    {
+        ds->insert(sizeof(ul) == 4 ? xor4096s() : xor4096l(), i);
+    }
+    insert_time = t.elapsed();
+    read_counters(counts[0]);
+    for(int i = 0; i < size; i++)
+    {
+        keys[i] = sizeof(ul) == 4 ? xor4096s() : xor4096l();
+    }
+    unsigned long found = 0;
+    start_counters();
+    t.start();
+    for(int i = 0; i < size; i += batch_size)
+    {
+        int n = size - i < batch_size ? size - i : batch_size;
+        for(int j = 0; j < n; j++)
+        {
+            out[j] = ds->locate(keys[i + j]);
+        }
+        found += out[n - 1] != 0;
+    }
+    scalar_time = t.elapsed();
+    read_counters(counts[1]);
+    start_counters();
+    t.start();
+    for(int i = 0; i < size; i += batch_size)
+    {
+        int n = size - i < batch_size ? size - i : batch_size;
+        locate_batch(ds, keys + i, n, out);
+        found += out[n - 1] != 0;
+    }
+    batch_time = t.elapsed();
+    read_counters(counts[2]);
+    num_located += found;
+
+    delete[] keys;
+    delete[] out;
+    return;
+}
+
+template <class DataStruct> void do_batch_locate(int max_size, int batch_size)
+{
+    float insert_time, scalar_time, batch_time;
+    PerfCounters::Counts counts[3];
+    using namespace std;
+    for(int i = 0; i < NUM_SIZES; i++)
+    {
+        int size = RAND_SET_SIZES[i];
+        if(size > max_size) 
+        {
+            break;
+        }
+        DataStruct* ds = new DataStruct;
+        apply_batch_locate(ds, size, batch_size, insert_time, scalar_time, batch_time, counts);
+        cout << size << " " << 1e6 * insert_time / size << " " << 1e6 * scalar_time / size << " " << 1e6 * batch_time / size;
+        for(int j = 0; j < 3; j++)
+        {
+            print_counts(counts[j], size);
+        }
+        cout << endl;
+        delete ds;
+    }
+    return;
+}
+
+// Key set set_id of the test workload, and the keys to look up in it.
+void make_test_set(TEST_SET_ID set_id, std::vector<unsigned long>& keys, std::vector<unsigned long>& queries)
+{
+    typedef unsigned long ul;
+    const ul low_mask = (1UL << CLUSTER_BITS) - 1;
+    ul prefixes[NUM_CLUSTERS];
+    for(int i = 0; i < NUM_CLUSTERS; i++)
+    {
+        prefixes[i] = xor4096l() & ~low_mask;
+    }
+    switch(set_id)
+    {
+        case RANDOM_TEST:
+            for(int i = 0; i < TEST_KEYS; i++)
+            {
+                keys.push_back(xor4096l());
+            }
+        break;
+        case PREFIX_TEST:
+            for(int i = 0; i < TEST_PREFIX_KEYS; i++)
+            {
+                keys.push_back((TEST_PREFIX << 56) | (xor4096l() >> 8));
+            }
+            keys.push_back(TEST_PREFIX_ABOVE);
+            queries.push_back(TEST_PREFIX_QUERY);
+        break;
+        case CLUSTERED_TEST:
+            for(int i = 0; i < TEST_KEYS; i++)
+            {
+                keys.push_back(prefixes[xor4096l() % NUM_CLUSTERS] | (xor4096l() & low_mask));
+            }
+            // Miss each cluster's path compression string (36 bits or more)
+            // at every bit, from either side.
+            for(int i = 0; i < NUM_CLUSTERS; i++)
+            {
+                for(int b = CLUSTER_BITS; b < 64; b++)
+                {
+                    queries.push_back((prefixes[i] ^ (1UL << b)) | (xor4096l() & low_mask));
+                }
+            }
+        break;
+        case DENSE_TEST:
+            for(int i = 0; i < TEST_KEYS; i++)
+            {
+                keys.push_back(xor4096l() % ((ul)DENSE_RANGE * TEST_KEYS));
+            }
+        break;
+    }
+    for(int i = 0; i < TEST_QUERIES; i++)
+    {
+        queries.push_back(xor4096l());
+    }
+    for(size_t i = 0; i < keys.size(); i++)
+    {
+        queries.push_back(keys[i] - 1);
+        queries.push_back(keys[i]);
+        queries.push_back(keys[i] + 1);
+    }
+    for(ul i = 0; i < (1UL << (64 - TEST_STEP_BITS)); i++)
+    {
+        queries.push_back(i << TEST_STEP_BITS);
+    }
+    return;
+}
+
+// Whether the value v a structure found (0 for none) is the value of m's
+// entry at it (m.end() for none). Each key is its own value, so a set's
+// locates (which find the key) agree.
+bool same_entry(const unsigned long* v, const std::map<unsigned long, unsigned long>& m, std::map<unsigned long, unsigned long>::const_iterator it)
+{
+    return it == m.end() ? !v : v && *v == it->second;
+}
+
+// Insert keys into ds and m (each key as its own value), remove every third,
+// then check ds's locates (one at a time and in a batch), lower bounds and
+// scans from queries against m. Returns the number of wrong answers.
+template <class DataStruct> unsigned long apply_test(DataStruct* ds, const std::vector<unsigned long>& keys, const std::vector<unsigned long>& queries)
+{
+    typedef unsigned long ul;
+    typedef std::map<ul, ul>::const_iterator MapIt;
+    std::map<ul, ul> m;
+    for(size_t i = 0; i < keys.size(); i++)
+    {
+        ds->insert(keys[i], keys[i]);
+        m[keys[i]] = keys[i];
+    }
+    for(size_t i = 0; i < keys.size(); i += 3)
+    {
+        ds->remove(keys[i]);
+        m.erase(keys[i]);
+    }
+    unsigned long wrong = 0;
+    std::vector<ul*> out(queries.size());
+    locate_batch(ds, &queries[0], queries.size(), &out[0]);
+    for(size_t i = 0; i < queries.size(); i++)
+    {
+        MapIt pred = m.upper_bound(queries[i]);
+        pred = pred == m.begin() ? m.end() : --pred;
+        wrong += !same_entry(ds->locate(queries[i]), m, pred);
+        wrong += !same_entry(out[i], m, pred);
+
+        MapIt lb = m.lower_bound(queries[i]);
+        typename DataStruct::Iterator it = ds->lower_bound(queries[i]);
+        wrong += lb == m.end() ? it.valid() : !it.valid() || it.key() != lb->first;
+
+        // The scan should visit lb and the keys after it up to hi, in order.
+        MapIt last = lb;
+        for(int j = 1; j < TEST_SCAN_LENGTH && last != m.end(); j++)
+        {
+            ++last;
+        }
+        ul hi = last == m.end() ? ~0UL : last->first;
+        MapIt next = lb;
+        bool scan_ok = true;
+        ds->scan(queries[i], hi, [&](const ul& key, const ul& value)
+        {
+            scan_ok = scan_ok && next != m.end() && key == next->first && value == next->second;
+            if(next != m.end())
+            {
+                ++next;
+            }
+        });
+        wrong += !scan_ok || next != (last == m.end() ? m.end() : ++last);
+    }
+    return wrong;
+}
+
+// TEST_MIX_OPS random inserts, removes and locates on ds and m, checking
+// each locate against m. Half the keys are random, half in clusters of
+// dense keys (differing only in TEST_MIX_DENSE_MASK), so buckets both burst into path compressed nodes and miss
+// them. Returns the number of wrong answers.
+template <class DataStruct> unsigned long apply_test_mix(DataStruct* ds)
+{
+    typedef unsigned long ul;
+    typedef std::map<ul, ul>::const_iterator MapIt;
+    const ul low_mask = (1UL << CLUSTER_BITS) - 1;
+    ul prefixes[NUM_CLUSTERS];
+    for(int i = 0; i < NUM_CLUSTERS; i++)
+    {
+        prefixes[i] = xor4096l() & ~low_mask;
+    }
+    std::map<ul, ul> m;
+    std::vector<ul> inserted;
+    unsigned long wrong = 0;
+    for(int i = 0; i < TEST_MIX_OPS; i++)
+    {
+        double locate_share = TEST_LOCATE_SHARES[i / (TEST_MIX_OPS / NUM_TEST_MIXES)];
+        ul key = xor4096l() & 1 ? xor4096l() : prefixes[xor4096l() % NUM_CLUSTERS] | (xor4096l() & TEST_MIX_DENSE_MASK);
+        if(xor4096l() < locate_share * ~0UL)
+        {
+            MapIt pred = m.upper_bound(key);
+            pred = pred == m.begin() ? m.end() : --pred;
+            wrong += !same_entry(ds->locate(key), m, pred);
+        }
+        else if(inserted.empty() || xor4096l() % 3)
+        {
+            ds->insert(key, key);
+            m[key] = key;
+            inserted.push_back(key);
+        }
+        else
+        {
+            key = inserted[xor4096l() % inserted.size()];
+            ds->remove(key);
+            m.erase(key);
+        }
+    }
+    return wrong;
+}
+
+// Check the structure against std::map on each key set, then, for the
+// bucketed tries, check a random mix of operations with each bucket size
+// from BucketSizer::MIN_SIZE to twice that, then each power of two up to
+// BucketSizer::MAX_SIZE, then adapting from BucketSizer::MIN_SIZE.
+// output is, for each key set: name, number of keys and number of wrong answers,
+// then for each bucket size: mix, the bucket size (0 for adaptive), number of
+// operations and number of wrong answers
+template <class DataStruct> void do_test()
+{
+    using namespace std;
+    typedef BucketSizer<unsigned long> Sizer;
+    for(int i = 0; i < NUM_TEST_SETS; i++)
+    {
+        vector<unsigned long> keys, queries;
+        make_test_set(static_cast<TEST_SET_ID>(i), keys, queries);
+        DataStruct* ds = new DataStruct;
+        unsigned long wrong = apply_test(ds, keys, queries);
+        cout << test_set_names[i] << " " << keys.size() << " " << wrong << endl;
+        num_wrong += wrong;
+        delete ds;
+    }
+    vector<int> bucket_sizes;
+    for(int size = Sizer::MIN_SIZE; size <= Sizer::MAX_SIZE; size += size < 2 * Sizer::MIN_SIZE ? 1 : size)
+    {
+        bucket_sizes.push_back(size);
+    }
+    bucket_sizes.push_back(0);
+    for(size_t i = 0; i < bucket_sizes.size(); i++)
+    {
+        bool adaptive = !bucket_sizes[i];
+        DataStruct* ds = new DataStruct;
+        if(!set_bucket_size(ds, adaptive ? Sizer::MIN_SIZE : bucket_sizes[i], adaptive))
+        {
+            delete ds;
+            break;
+        }
+        unsigned long wrong = apply_test_mix(ds);
+        cout << "mix " << bucket_sizes[i] << " " << TEST_MIX_OPS << " " << wrong << endl;
+        num_wrong += wrong;
+        delete ds;
+    }
+    return;
+}
+
+template <class DataStruct> void apply_delete_mix(DataStruct* ds, long* workload, bool* is_insert, int size, float& time, PerfCounters::Counts& counts)
+{
+    using namespace std;
+    Timer t;
+    start_counters();
+    t.start();
+    for(int i = 0; i < size; i++)
+    {
+        if(is_insert[i])
+        {
+            ds->insert(workload[i], i);
+        }
+        else
+        {
+            ds->remove(workload[rand() % (i + 1)]);
+        }
+    }
+    time = t.elapsed();
+    read_counters(counts);
+    return;
+}
+
+// As apply_delete_mix, but each operation is timed on its own, into h.
+template <class DataStruct> void apply_latency_delete_mix(DataStruct* ds, long* workload, bool* is_insert, int size, Histogram& h)
+{
+    unsigned long long last = now_ns();
+    for(int i = 0; i < size; i++)
+    {
+        if(is_insert[i])
+        {
+            ds->insert(workload[i], i);
+        }
+        else
+        {
+            ds->remove(workload[rand() % (i + 1)]);
+        }
+        unsigned long long t = now_ns();
+        h.record(t - last);
+        last = t;
+    }
+    return;
+}
+
+template <class DataStruct> void do_delete_mix(int max_size, bool latency)
+{
+    using namespace std;
+    for(int i = 0; i < NUM_SIZES; i++)
+    {
+        DataStruct* ds = new DataStruct;
+        int size = RAND_SET_SIZES[i];
+        if(size > max_size) 
+        {
+            break;
+        }
+        bool* mix_mask = new bool[size];
+        long* workload = new long[size];
+        for(int j = 0; j < size; j++)
+        {        
+            mix_mask[j] = rand() / (RAND_MAX + 1.0) >= 0.5;                
+            if(sizeof(long) == 4)
+            {
+                workload[j] = xor4096s();
+            }
+            else
+            {
+                workload[j] = xor4096l();
+            }
+        }    
+        if(latency)
+        {
+            Histogram h;
+            apply_latency_delete_mix(ds, workload, mix_mask, size, h);
+            cout << size << " ";
+            print_latencies(h);
+            cout << endl;
+        }
+        else
+        {
+            float time;
+            PerfCounters::Counts counts;
+            apply_delete_mix(ds, workload, mix_mask, size, time, counts);
+            cout << size << " " << 1e6 * time / size;
+            print_counts(counts, size);
+            cout << endl;
+        }
+        delete ds;
+        delete[] mix_mask;
+        delete[] workload;
+    }
+    return;
+}
+
+// Read the genome file into a new array of keys, returning 0 if it can't be
+// opened.
+unsigned long* read_genome(char* genome_file_name, int& size)
+{
+    using namespace std;
+
+    const int STR_LEN = 9;
+    ifstream in(genome_file_name);
+    if(!in)
+    {
+        cerr << "FATAL ERROR: Couldn't open genome file: " << genome_file_name << endl;
+        return 0;
+    }
+    in >> size;
+    unsigned long* data = new unsigned long[size];
+    for(int i = 0; i < size; i++)
+    {
+        string s;
+        in >> s;
+        data[i] = 0;
+        for(int j = 0; j < STR_LEN; j++)
+        {
+            switch(s[j])
+            {
+                case 'a':
+                break;
+                case 'c':
+                    data[i] |= 1;
+                break;
+                case 'g':
+                    data[i] |= 2;
+                break;
+                case 't':
+                    data[i] |= 3;
+                break;
+            }
+            data[i] <<= 2;
+        }         
+    }
+    in.close();
+    for(int i = 0; i < size; i++)
+    {
+        data[i] = (data[i] << 18) | data[(i + 1) % size];
+    }
+    return data;
+}
+
+template <class DataStruct> void apply_genome(char* genome_file_name)
+{
+    using namespace std;
+    int size;
+    unsigned long* data = read_genome(genome_file_name, size);
+    if(!data)
+    {
+        return;
+    }
+
+    peak_memory = 0; // ignore the data just allocated
+    DataStruct ds;
+    Timer t;
+    
+    start_counters();
+    t.start();
+    for(int i = 0; i < size; i++)
+    {
+        ds.insert(data[i], i);
+    }
+#if !defined REDEF_NEW && !defined USE_MEM_COUNTING
+    PerfCounters::Counts insert_counts, locate_counts;
+    cout << t.elapsed() << " ";
+    read_counters(insert_counts);
+    unsigned long found = 0;
+    start_counters();
+    t.start();
+    for(int i = 0; i < size; i++)
+    {
+        found += ds.locate(data[i]) != 0;
+    }
+    num_located += found;
+#endif
+
+#if defined REDEF_NEW || defined USE_MEM_COUNTING
+    cout << peak_memory << endl;
+#else
+    cout << t.elapsed();
+    read_counters(locate_counts);
+    print_counts(insert_counts, size);
+    print_counts(locate_counts, size);
+    cout << endl;
+#endif    
+
+    delete[] data;
+    return;
+}
+
+// Read a valgrind trace into new arrays of keys and whether each is a store,
+// returning false if it can't be opened.
+bool read_valgrind_trace(char* file_name, unsigned long*& ops, bool*& is_store, unsigned long& num_ops)
+{
+    using namespace std;
+    ifstream in(file_name, ios::binary);
+    if(!in)
+    {
+        cerr << "Couldn't open valgrind trace: " << file_name << endl;
+        return false;
+    }
+    in >> num_ops;
+    in.get();
+    ops = new unsigned long[num_ops];
+    is_store = new bool[num_ops];
+
+    in.read((char*) is_store, num_ops * sizeof(*is_store));
+    in.read((char*) ops, num_ops * sizeof(*ops));
+    return true;
+}
+
+template <class DataStruct> void apply_valgrind_trace(char* file_name)
+{
+    using namespace std;
+    unsigned long* ops;
+    bool* is_store;
+    unsigned long num_ops;
+    if(!read_valgrind_trace(file_name, ops, is_store, num_ops))
+    {
+        return;
+    }
+
+    peak_memory = 0;
+    DataStruct ds;
+    Timer t;
+    unsigned long found = 0;
+    start_counters();
+    t.start();
+    for(unsigned long i = 0; i < num_ops; i++)
+    {
+        if(is_store[i])
+        {
+            ds.insert(ops[i], i);
+        }
+        else
+        {
+            found += ds.locate(ops[i]) != 0;
+        }
+    }
+    num_located += found;
+#if defined REDEF_NEW || defined USE_MEM_COUNTING
+    cout << peak_memory << endl;
+#else
+    PerfCounters::Counts counts;
+    cout << t.elapsed();
+    read_counters(counts);
+    print_counts(counts, num_ops);
+    cout << endl;
+#endif    
+    delete[] ops;
+    delete[] is_store;
+    return;
+}
+
+// Run work(t) on num_threads threads, t = 0, .., num_threads - 1, which are
+// all released together once they have started. times[t] is set to the
+// time thread t took, and the wall clock time from the release until the
+// last thread finished is returned.
+template <class Work> float run_threads(int num_threads, Work work, float* times)
+{
+    using namespace std;
+    atomic<int> num_ready(0);
+    atomic<bool> go(false);
+    vector<thread> threads;
+    for(int i = 0; i < num_threads; i++)
+    {
+        threads.push_back(thread([&, i]()
+        {
+            num_ready++;
+            while(!go)
+            {
+                this_thread::yield();
+            }
+            Timer t;
+            t.start();
+            work(i);
+            times[i] = t.elapsed();
+        }));
+    }
+    while(num_ready < num_threads)
+    {
+        this_thread::yield();
+    }
+    Timer wall;
+    wall.start();
+    go = true;
+    for(int i = 0; i < num_threads; i++)
+    {
+        threads[i].join();
+    }
+    return wall.elapsed();
+}
+
+// Print the throughput (millions of operations a second) of each thread,
+// then of all the threads together.
+void print_throughput(int num_threads, const unsigned long* num_ops, const float* times, float wall_time)
+{
+    using namespace std;
+    unsigned long total = 0;
+    for(int i = 0; i < num_threads; i++)
+    {
+        cout << 1e-6 * num_ops[i] / times[i] << " ";
+        total += num_ops[i];
+    }
+    cout << 1e-6 * total / wall_time << endl;
+    return;
+}
+
+// Locate keys[0], .., keys[size - 1] in ds, which is only read, split evenly
+// over num_threads threads. The throughput is printed.
+template <class DataStruct> void threaded_locate(DataStruct* ds, const unsigned long* keys, int size, int num_threads)
+{
+    using namespace std;
+    vector<unsigned long> found(num_threads), num_ops(num_threads);
+    vector<float> times(num_threads);
+    float wall_time = run_threads(num_threads, [&](int i)
+    {
+        int first = (long) size * i / num_threads;
+        int last = (long) size * (i + 1) / num_threads;
+        unsigned long f = 0;
+        for(int j = first; j < last; j++)
+        {
+            f += ds->locate(keys[j]) != 0;
+        }
+        found[i] = f;
+        num_ops[i] = last - first;
+    }, &times[0]);
+    for(int i = 0; i < num_threads; i++)
+    {
+        num_located += found[i];
+    }
+    print_throughput(num_threads, &num_ops[0], &times[0], wall_time);
+    return;
+}
+
+// As do_insert_locate, but the locates are spread over num_threads threads
+// sharing the one (read-only) instance.
+template <class DataStruct> void do_threaded_insert_locate(int max_size, int num_threads)
+{
+    typedef unsigned long ul;
+    using namespace std;
+    for(int i = 0; i < NUM_SIZES; i++)
+    {
+        int size = RAND_SET_SIZES[i];
+        if(size > max_size) 
+        {
+            break;
+        }
+        DataStruct* ds = new DataStruct;
+        Timer t;
+        t.start();
+        for(int j = 0; j < size; j++)
+        {
+            ds->insert(sizeof(ul) == 4 ? xor4096s() : xor4096l(), j);
+        }
+        float insert_time = t.elapsed();
+        // The generators aren't thread safe, so make the keys up front.
+        ul* keys = new ul[size];
+        for(int j = 0; j < size; j++)
+        {
+            keys[j] = sizeof(ul) == 4 ? xor4096s() : xor4096l();
+        }
+        cout << size << " " << 1e6 * insert_time / size << " ";
+        threaded_locate(ds, keys, size, num_threads);
+        delete[] keys;
+        delete ds;
+    }
+    return;
+}
+
+// How the update workload reads and updates a structure from several threads:
+// holding update_lock, except for ConcurrentLPCBTrie, which needs no lock.
+std::mutex update_lock;
+template <class DataStruct> bool shared_locate(DataStruct* ds, unsigned long key)
+{
+    std::lock_guard<std::mutex> guard(update_lock);
+    return ds->locate(key) != 0;
+}
+template <class DataStruct> void shared_insert(DataStruct* ds, unsigned long key, unsigned long value)
+{
+    std::lock_guard<std::mutex> guard(update_lock);
+    ds->insert(key, value);
+    return;
+}
+template <class DataStruct> void shared_remove(DataStruct* ds, unsigned long key)
+{
+    std::lock_guard<std::mutex> guard(update_lock);
+    ds->remove(key);
+    return;
+}
+template <class KeyType, class ValueType, bool count_mem> bool shared_locate(ConcurrentLPCBTrie<KeyType, ValueType, count_mem>* ds, unsigned long key)
+{
+    ValueType value;
+    return ds->locate(key, value);
+}
+template <class KeyType, class ValueType, bool count_mem> void shared_insert(ConcurrentLPCBTrie<KeyType, ValueType, count_mem>* ds, unsigned long key, unsigned long value)
+{
+    ds->insert(key, value);
+    return;
+}
+template <class KeyType, class ValueType, bool count_mem> void shared_remove(ConcurrentLPCBTrie<KeyType, ValueType, count_mem>* ds, unsigned long key)
+{
+    ds->remove(key);
+    return;
+}
+
+// Insert max_size (at most UPDATE_KEYS) random keys, then have num_threads
+// threads each locate as many random keys, starting at different places in
+// the one array of them, while another thread updates (see UPDATE_PASS) until
+// they're done. The throughput is printed, the writer's first.
+template <class DataStruct> void do_update(int max_size, int num_threads)
+{
+    typedef unsigned long ul;
+    using namespace std;
+    int size = max_size < UPDATE_KEYS ? max_size : UPDATE_KEYS;
+    DataStruct* ds = new DataStruct;
+    for(int j = 0; j < size; j++)
+    {
+        ds->insert(sizeof(ul) == 4 ? xor4096s() : xor4096l(), j);
+    }
+    // The generators aren't thread safe, so make the keys up front.
+    ul* keys = new ul[size];
+    for(int j = 0; j < size; j++)
+    {
+        keys[j] = sizeof(ul) == 4 ? xor4096s() : xor4096l();
+    }
+    ul* new_keys = new ul[UPDATE_PASS];
+    for(int j = 0; j < UPDATE_PASS; j++)
+    {
+        new_keys[j] = sizeof(ul) == 4 ? xor4096s() : xor4096l();
+    }
+    atomic<int> num_reading(num_threads);
+    vector<unsigned long> found(num_threads), num_ops(num_threads + 1);
+    vector<float> times(num_threads + 1);
+    float wall_time = run_threads(num_threads + 1, [&](int i)
+    {
+        if(i == num_threads)
+        {
+            unsigned long n = 0;
+            while(num_reading)
+            {
+                for(int j = 0; j < UPDATE_PASS; j++)
+                {
+                    shared_insert(ds, new_keys[j], j);
+                }
+                for(int j = 0; j < UPDATE_PASS; j++)
+                {
+                    shared_remove(ds, new_keys[j]);
+                }
+                n += 2 * UPDATE_PASS;
+            }
+            num_ops[i] = n;
+            return;
+        }
+        int first = (long) size * i / num_threads;
+        unsigned long f = 0;
+        for(int j = first; j < size; j++)
+        {
+            f += shared_locate(ds, keys[j]);
+        }
+        for(int j = 0; j < first; j++)
+        {
+            f += shared_locate(ds, keys[j]);
+        }
+        found[i] = f;
+        num_ops[i] = size;
+        num_reading--;
+    }, &times[0]);
+    for(int i = 0; i < num_threads; i++)
+    {
+        num_located += found[i];
+    }
+    cout << size << " " << 1e-6 * num_ops[num_threads] / times[num_threads] << " ";
+    print_throughput(num_threads, &num_ops[0], &times[0], wall_time);
+    delete[] new_keys;
+    delete[] keys;
+    delete ds;
+    return;
+}
+
+// As apply_genome, but the self-search is spread over num_threads threads.
+template <class DataStruct> void apply_threaded_genome(char* genome_file_name, int num_threads)
+{
+    using namespace std;
+    int size;
+    unsigned long* data = read_genome(genome_file_name, size);
+    if(!data)
+    {
+        return;
+    }
+    DataStruct ds;
+    Timer t;
+    t.start();
+    for(int i = 0; i < size; i++)
+    {
+        ds.insert(data[i], i);
+    }
+    cout << t.elapsed() << " ";
+    threaded_locate(&ds, data, size, num_threads);
+    delete[] data;
+    return;
+}
+
+// As apply_valgrind_trace, but the trace is sharded over num_threads threads
+// by a hash of the key. Each thread replays its share of the trace, in order,
+// on an instance of its own.
+template <class DataStruct> void apply_threaded_valgrind_trace(char* file_name, int num_threads)
+{
+    using namespace std;
+    unsigned long* ops;
+    bool* is_store;
+    unsigned long num_ops;
+    if(!read_valgrind_trace(file_name, ops, is_store, num_ops))
+    {
+        return;
+    }
+    vector<vector<unsigned long> > shard_ops(num_threads);
+    vector<vector<bool> > shard_is_store(num_threads);
+    for(unsigned long i = 0; i < num_ops; i++)
+    {
+        int shard = ((ops[i] * 0x9e3779b97f4a7c15ULL) >> 32) % num_threads;
+        shard_ops[shard].push_back(ops[i]);
+        shard_is_store[shard].push_back(is_store[i]);
+    }
+    delete[] ops;
+    delete[] is_store;
+
+    vector<DataStruct*> ds(num_threads);
+    for(int i = 0; i < num_threads; i++)
+    {
+        ds[i] = new DataStruct;
+    }
+    vector<unsigned long> found(num_threads), shard_num_ops(num_threads);
+    vector<float> times(num_threads);
+    float wall_time = run_threads(num_threads, [&](int i)
+    {
+        unsigned long f = 0;
+        for(unsigned long j = 0; j < shard_ops[i].size(); j++)
+        {
+            if(shard_is_store[i][j])
+            {
+                ds[i]->insert(shard_ops[i][j], j);
+            }
+            else
+            {
+                f += ds[i]->locate(shard_ops[i][j]) != 0;
+            }
+        }
+        found[i] = f;
+        shard_num_ops[i] = shard_ops[i].size();
+    }, &times[0]);
+    for(int i = 0; i < num_threads; i++)
+    {
+        num_located += found[i];
+        delete ds[i];
+    }
+    print_throughput(num_threads, &shard_num_ops[0], &times[0], wall_time);
+    return;
+}
+
+template <class DataStruct> void apply_workload(WORKLOAD_ID workload, DATA_STRUCT_ID data_struct, char* file_name, int batch_size, double theta, int num_threads, bool latency)
+{
+    if(latency)
+    {
+        switch(workload)
+        {
+            case INSERT_LOCATE_OPS:
+                do_latency_insert_locate<DataStruct>(MAX_INSERT_SIZES[data_struct]);
+            break;
+            case INSERT_DELETE_OPS:
+                do_delete_mix<DataStruct>(MAX_DELETE_SIZES[data_struct], true);
+            break;
+            default:
+                std::cerr << "-l only applies to the irandom and drandom workloads." << std::endl;
+            break;
+        }
+        return;
+    }
+    if(num_threads)
+    {
+        switch(workload)
+        {
+            case INSERT_LOCATE_OPS:
+                do_threaded_insert_locate<DataStruct>(MAX_INSERT_SIZES[data_struct], num_threads);
+            break;
+            case VALGRIND_TRACES:
+                apply_threaded_valgrind_trace<DataStruct>(file_name, num_threads);
+            break;
+            case GENOME:
+                apply_threaded_genome<DataStruct>(file_name, num_threads);
+            break;
+            case UPDATE_OPS:
+                do_update<DataStruct>(MAX_INSERT_SIZES[data_struct], num_threads);
+            break;
+            default:
+                std::cerr << "-t only applies to the irandom, valgrind, genome and update workloads." << std::endl;
+            break;
+        }
+        return;
+    }
+    switch(workload)
+    {
+        case INSERT_LOCATE_OPS:
+            do_insert_locate<DataStruct>(MAX_INSERT_SIZES[data_struct]);
+        break;
+        case INSERT_DELETE_OPS:
+            do_delete_mix<DataStruct>(MAX_DELETE_SIZES[data_struct], false);
+        break;
+        case VALGRIND_TRACES:
+            apply_valgrind_trace<DataStruct>(file_name);
+        break;
+        case GENOME:
+            apply_genome<DataStruct>(file_name);
+        break;
+        case BATCH_LOCATE_OPS:
+            do_batch_locate<DataStruct>(MAX_INSERT_SIZES[data_struct], batch_size);
+        break;
+        case ZIPF_LOCATE_OPS:
+            do_skewed_locate<DataStruct>(MAX_INSERT_SIZES[data_struct], false, theta);
+        break;
+        case HOT_SET_LOCATE_OPS:
+            do_skewed_locate<DataStruct>(MAX_INSERT_SIZES[data_struct], true, theta);
+        break;
+        case RANGE_SCAN_OPS:
+            do_range_scan<DataStruct>(MAX_INSERT_SIZES[data_struct]);
+        break;
+        case CLUSTERED_OPS:
+            do_clustered_insert_locate<DataStruct>(MAX_INSERT_SIZES[data_struct]);
+        break;
+        case SWEEP_OPS:
+            do_sweep<DataStruct>(MAX_INSERT_SIZES[data_struct]);
+        break;
+        case TEST_OPS:
+            do_test<DataStruct>();
+        break;
+        case UPDATE_OPS:
+            // Needs -t (see main).
+        break;
+    }
+    return;
+}
+
+int main(int argc, char** argv)
 {
     using namespace std;
     if(argc < 3)
@@ -319,6 +1601,63 @@ int main(int argc, char** argv)
         // In the third usage, we test insertion and self-search time on the genome
         // output is insert_time search_time memory
         cerr << "Usage 4: " << argv[0] << " <data structure> genome <genome file>" << endl;
+        // Scalar against batched locates of random keys
+        // output is: size insert_time scalar_locate_time batch_locate_time
+        cerr << "Usage 5: " << argv[0] << " <data structure> batch [batch size]" << endl;
+        // As Usage 1, but the keys located are drawn from those inserted: Zipf(theta)
+        // (0 <= theta < 1, default 0.99), or 90% of them from a hot set of 1% of
+        // the keys that moves 15 times over the run.
+        // output is: size insert_time locate_time
+        cerr << "Usage 6: " << argv[0] << " <data structure> zipf [theta]" << endl;
+        cerr << "Usage 7: " << argv[0] << " <data structure> hotset" << endl;
+        // Range scans over random keys, each visiting 1, 10, 100, 1000 and then
+        // 10000 consecutive keys.
+        // output is: size, then the millions of keys scanned per second for each length
+        cerr << "Usage 8: " << argv[0] << " <data structure> range" << endl;
+        // As Usage 1, but the keys inserted and located are in 16 clusters, sharing
+        // all but their low 24 bits.
+        // output is: size insert_time locate_time
+        cerr << "Usage 9: " << argv[0] << " <data structure> clustered" << endl;
+        // For the bucketed tries only: 2^22 random keys, inserted then located,
+        // with each bucket size from 8 to 2048, then adaptive bucket sizing.
+        // Dense keys are random below 4 times their number.
+        // output is: bucket size (0 for adaptive), then the sparse keys' insert_time
+        // locate_time and the dense keys' (memory per key of each, counting memory)
+        cerr << "Usage 10: " << argv[0] << " <data structure> sweep" << endl;
+        // Check the structure's answers against std::map, on random keys, keys
+        // sharing long prefixes, clustered keys and dense keys. Exits with 1 if
+        // any were wrong.
+        // output is, for each key set: name, number of keys and number of wrong answers
+        // For the bucketed tries, a random mix of operations follows at each bucket
+        // size from 8 to 16, then each power of two up to 2048, then adaptive.
+        // output is then, for each: mix, bucket size (0 for adaptive), operations
+        // and number of wrong answers
+        cerr << "Usage 11: " << argv[0] << " <data structure> test" << endl;
+        // Only with -t N: N threads locate random keys while another inserts
+        // and removes keys, holding a lock around each operation, except with
+        // lpcbtrie_conc, whose readers take none.
+        // output is: size, the writer's throughput, then as for -t below.
+        cerr << "Usage 12: " << argv[0] << " <data structure> update -t <threads>" << endl;
+        // Usages 1, 3 and 4 can end with -t N to run the locates (or, for traces,
+        // the whole trace) on N threads. Sharing one read-only instance, except 
+        // for traces, which are sharded by key over an instance per thread.
+        // output is as above, but with the throughput of each thread and then of
+        // all of them (millions of ops/s) in place of the locate or trace time.
+        cerr << "       " << argv[0] << " <data structure> <workload> [file name] -t <threads>" << endl;
+        // Usages 1 and 2 can end with -l to time each operation on its own.
+        // output is: size, then the p50 p99 p99.9 and max latencies (us) of the inserts
+        // then the locates (Usage 1), or of all the operations (Usage 2).
+        cerr << "       " << argv[0] << " <data structure> <workload> -l" << endl;
+        // Any usage but -t and -l can end with -p to read the hardware counters
+        // (through perf_event_open) over each timed phase. After the usual output
+        // come, for each timed phase in turn, the cycles, instructions, L1D read
+        // misses, LLC misses, branch misses and dTLB read misses per operation
+        // (- if the event couldn't be counted).
+        cerr << "       " << argv[0] << " <data structure> <workload> [file name] -p" << endl;
+        // Any usage can end with -s to run the structure's set mode (ValueType
+        // void), which stores no values: locates find the predecessor key.
+        // stree and the _for tries have no set mode.
+        cerr << "       " << argv[0] << " <data structure> <workload> [file name] -s" << endl;
 
         cerr << "----------------------" << endl;
         cerr << "Valid data structures:" << endl;
@@ -329,10 +1668,83 @@ int main(int argc, char** argv)
         }
         return 0;
     }
+    // Pull out any -t N, -l, -p and -s, leaving the other arguments where they were.
+    int num_threads = 0;
+    bool latency = false;
+    bool count_events = false;
+    bool set_mode = false;
+    for(int i = 3; i < argc; )
+    {
+        int num_used = 0;
+        if(!strcmp(argv[i], "-t") && i + 1 < argc)
+        {
+            num_threads = atoi(argv[i + 1]);
+            if(num_threads < 1)
+            {
+                cerr << "The number of threads must be at least 1." << endl;
+                return 0;
+            }
+            num_used = 2;
+        }
+        else if(!strcmp(argv[i], "-l"))
+        {
+            latency = true;
+            num_used = 1;
+        }
+        else if(!strcmp(argv[i], "-p"))
+        {
+            count_events = true;
+            num_used = 1;
+        }
+        else if(!strcmp(argv[i], "-s"))
+        {
+            set_mode = true;
+            num_used = 1;
+        }
+        else
+        {
+            i++;
+            continue;
+        }
+        for(int j = i; j + num_used < argc; j++)
+        {
+            argv[j] = argv[j + num_used];
+        }
+        argc -= num_used;
+    }
+    if(num_threads && latency)
+    {
+        cerr << "-t and -l can't be used together." << endl;
+        return 0;
+    }
+    if(count_events && (num_threads || latency))
+    {
+        cerr << "-p can't be used with -t or -l." << endl;
+        return 0;
+    }
+#if defined REDEF_NEW || defined USE_MEM_COUNTING
+    if(num_threads || count_events)
+    {
+        cerr << "-t and -p can't be used when counting memory." << endl;
+        return 0;
+    }
+#endif
+    if(count_events)
+    {
+        perf_counters = new PerfCounters;
+        if(!perf_counters->is_open())
+        {
+            cerr << "Couldn't open any hardware counters (see /proc/sys/kernel/perf_event_paranoid)." << endl;
+            delete perf_counters;
+            return 0;
+        }
+    }
     DATA_STRUCT_ID data_struct = static_cast<DATA_STRUCT_ID>(atoi(argv[1]));
 
     WORKLOAD_ID workload;
     char* file_name = 0;
+    int batch_size = DEFAULT_BATCH_SIZE;
+    double theta = DEFAULT_ZIPF_THETA;
     switch(argv[2][0])
     {
         case 'i':
@@ -349,41 +1761,153 @@ int main(int argc, char** argv)
             workload = GENOME;           
             file_name = argv[3];
         break;
+        case 'b':
+            workload = BATCH_LOCATE_OPS;
+            if(argc > 3)
+            {
+                batch_size = atoi(argv[3]);
+            }
+        break;
+        case 'z':
+            workload = ZIPF_LOCATE_OPS;
+            if(argc > 3)
+            {
+                theta = atof(argv[3]);
+            }
+            if(theta < 0 || theta >= 1)
+            {
+                cerr << "The Zipf theta must be at least 0 and less than 1." << endl;
+                return 0;
+            }
+        break;
+        case 'h':
+            workload = HOT_SET_LOCATE_OPS;
+        break;
+        case 'r':
+            workload = RANGE_SCAN_OPS;
+        break;
+        case 'c':
+            workload = CLUSTERED_OPS;
+        break;
+        case 's':
+            workload = SWEEP_OPS;
+        break;
+        case 't':
+            workload = TEST_OPS;
+        break;
+        case 'u':
+            workload = UPDATE_OPS;
+            if(!num_threads)
+            {
+                cerr << "The update workload needs -t." << endl;
+                return 0;
+            }
+        break;
         default:
             cerr << "Invalid workload specified." << endl;
             return 0;
         break;
     }
     typedef unsigned long ul;
+    if(data_struct == CONC_LPCBTRIE)
+    {
+        if(workload != UPDATE_OPS || set_mode)
+        {
+            cerr << "lpcbtrie_conc only runs the update workload, and has no set mode." << endl;
+            return 0;
+        }
+        do_update<ConcurrentLPCBTrie<ul, ul> >(MAX_INSERT_SIZES[data_struct], num_threads);
+        return 0;
+    }
+    if(set_mode)
+    {
+        switch(data_struct)
+        {
+            case STDMAP:
+                apply_workload<STDMap<ul, void> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
+            break;
+            case BTREE:
+                apply_workload<BTree<ul, void> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
+            break;
+            case LPCBTRIE:
+#if defined USE_MEM_COUNTING
+                apply_workload<LPCBTrie<ul, void, true> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
+#else
+                apply_workload<LPCBTrie<ul, void> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
+#endif
+            break;
+            case QTRIE:
+#if defined USE_MEM_COUNTING
+                apply_workload<LPCQTrie<ul, void, true> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
+#else
+                apply_workload<LPCQTrie<ul, void> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
+#endif
+            break;
+            case BPTREE:
+#if defined USE_MEM_COUNTING
+                apply_workload<BPTree<ul, void, true> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
+#else
+                apply_workload<BPTree<ul, void> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
+#endif
+            break;
+            default:
+                cerr << "That data structure has no set mode!" << endl;
+            break;
+        }
+        delete perf_counters;
+        return num_wrong != 0;
+    }
     switch(data_struct)
     {
         case STDMAP:
-            apply_workload<STDMap<ul, ul> >(workload, data_struct, file_name);
+            apply_workload<STDMap<ul, ul> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
         break;
         case BTREE:
-            apply_workload<BTree<ul, ul> >(workload, data_struct, file_name);
+            apply_workload<BTree<ul, ul> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
         break;
         case STREE:
-            apply_workload<STree<ul, ul> >(workload, data_struct, file_name);
+            apply_workload<STree<ul, ul> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
         break;
         case LPCBTRIE:
 #if defined USE_MEM_COUNTING
-            apply_workload<LPCBTrie<ul, ul, true> >(workload, data_struct, file_name);
+            apply_workload<LPCBTrie<ul, ul, true> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
 #else
-            apply_workload<LPCBTrie<ul, ul> >(workload, data_struct, file_name);
+            apply_workload<LPCBTrie<ul, ul> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
 #endif            
         break;
         case QTRIE:
 #if defined USE_MEM_COUNTING
-        apply_workload<LPCQTrie<ul, ul, true> >(workload, data_struct, file_name);
+        apply_workload<LPCQTrie<ul, ul, true> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
 #else
-        apply_workload<LPCQTrie<ul, ul> >(workload, data_struct, file_name);
+        apply_workload<LPCQTrie<ul, ul> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
 #endif        
+        break;
+        case BPTREE:
+#if defined USE_MEM_COUNTING
+            apply_workload<BPTree<ul, ul, true> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
+#else
+            apply_workload<BPTree<ul, ul> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
+#endif
+        break;
+        case FOR_LPCBTRIE:
+#if defined USE_MEM_COUNTING
+            apply_workload<LPCBTrie<ul, ul, true, SlabAlloc<>, ForBucket> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
+#else
+            apply_workload<LPCBTrie<ul, ul, false, SlabAlloc<>, ForBucket> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
+#endif
+        break;
+        case FOR_QTRIE:
+#if defined USE_MEM_COUNTING
+            apply_workload<LPCQTrie<ul, ul, true, SlabAlloc<>, ForBucket> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
+#else
+            apply_workload<LPCQTrie<ul, ul, false, SlabAlloc<>, ForBucket> >(workload, data_struct, file_name, batch_size, theta, num_threads, latency);
+#endif
         break;
         default:
             cerr << "Invalid data structure specified!" << endl;
         break;
     }
-    return 0;
+    delete perf_counters;
+    return num_wrong != 0;
 }
 
@@ -0,0 +1,56 @@
+#include "skewed_keys.h"
+#include <cmath>
+#include <xor_gens/xor_gens.h>
+
+ZipfRanks::ZipfRanks(unsigned long n, double theta) : n(n), theta(theta)
+{
+    zeta_n = 0;
+    for(unsigned long i = 1; i <= n; i++)
+    {
+        zeta_n += 1 / pow(i, theta);
+    }
+    double zeta_2 = 1 + 1 / pow(2, theta);
+    alpha = 1 / (1 - theta);
+    eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta_2 / zeta_n);
+    return;
+}
+
+unsigned long ZipfRanks::next()
+{
+    double u = xor4096d();
+    double uz = u * zeta_n;
+    if(uz < 1)
+    {
+        return 0;
+    }
+    if(uz < 1 + pow(0.5, theta))
+    {
+        return 1;
+    }
+    unsigned long r = n * pow(eta * u - eta + 1, alpha);
+    return r < n ? r : n - 1;
+}
+
+HotSetRanks::HotSetRanks(unsigned long n, double hot_fraction, double hot_prob, unsigned long period) : n(n), hot_prob(hot_prob), period(period), hot_start(0), num_drawn(0)
+{
+    hot_size = n * hot_fraction;
+    if(!hot_size)
+    {
+        hot_size = 1;
+    }
+    return;
+}
+
+unsigned long HotSetRanks::next()
+{
+    if(num_drawn++ == period)
+    {
+        num_drawn = 1;
+        hot_start = (hot_start + hot_size) % n;
+    }
+    if(xor4096d() < hot_prob)
+    {
+        return (hot_start + (unsigned long)(xor4096d() * hot_size)) % n;
+    }
+    return xor4096d() * n;
+}
@@ -0,0 +1,38 @@
+#if !defined __SKEWED_KEYS_H
+
+#define __SKEWED_KEYS_H
+
+// Generators of skewed ranks in 0, .., n - 1, for choosing which of n
+// inserted keys to look up. Both draw from xor4096d.
+
+// Rank r with probability proportional to 1 / (r + 1)^theta, where 
+// 0 <= theta < 1 (0 is uniform). Uses the method of Gray et al., "Quickly
+// generating billion-record synthetic databases" (as YCSB does): O(n) to 
+// set up, then O(1) a draw.
+class ZipfRanks
+{
+    unsigned long n;
+    double theta;
+    double alpha, zeta_n, eta;
+public:
+    ZipfRanks(unsigned long n, double theta);
+    unsigned long next();
+};
+
+// A hot set of hot_fraction of the ranks gets hot_prob of the draws, and
+// the rest are uniform over all the ranks. The hot set is a block of ranks
+// that moves on to the next block after every period draws.
+class HotSetRanks
+{
+    unsigned long n;
+    unsigned long hot_size;
+    double hot_prob;
+    unsigned long period;
+    unsigned long hot_start;
+    unsigned long num_drawn;
+public:
+    HotSetRanks(unsigned long n, double hot_fraction, double hot_prob, unsigned long period);
+    unsigned long next();
+};
+
+#endif
@@ -3,38 +3,168 @@
 #define __KEY_UTILS_H
 
 #include <limits>
+#include <type_traits>
 
-template <class KeyType> class KeyTypeInfo 
+#if defined __BMI__
+#include <immintrin.h>
+#endif
+
+// The bit twiddling behind KeyTypeInfo, for keys of size bytes. Every
+// field width from 0 up to all of the key's bits is allowed, so path
+// compression strings can be as long as the key. Integer keys of 4 and 8
+// bytes extract with BMI's bextr when available (it copes with any start
+// and length by itself), and count leading zeros with the builtins; 16-byte
+// keys count theirs a half at a time.
+template <class KeyType, int size = sizeof(KeyType), bool is_integer = std::numeric_limits<KeyType>::is_integer> class KeyBits
 {
 public:
     static const int NUM_BITS = std::numeric_limits<KeyType>::digits;
-    typedef char BitIdx; // It's handy to have this as a signed type for looping conditions (i.e. >= 0 etc)
 
+    static inline KeyType mask(int num_bits)
+    {
+        return num_bits < NUM_BITS ? ((KeyType)1 << num_bits) - 1 : ~(KeyType)0;
+    }
+    static inline KeyType extract(const KeyType& key, int shift, int num_bits)
+    {
+        return shift < NUM_BITS ? (key >> shift) & mask(num_bits) : 0;
+    }
+    // Of a non-zero x.
+    static inline int leading_zeros(const KeyType& x)
+    {
+        int n = 0;
+        while(!(x >> (NUM_BITS - 1 - n) & 1))
+        {
+            n++;
+        }
+        return n;
+    }
+};
+
+template <class KeyType> class KeyBits<KeyType, 4, true>
+{
+public:
+    static const int NUM_BITS = 32;
+
+    static inline KeyType mask(int num_bits)
+    {
+        return num_bits < NUM_BITS ? (1U << num_bits) - 1 : ~0U;
+    }
+    static inline KeyType extract(const KeyType& key, int shift, int num_bits)
+    {
+#if defined __BMI__
+        return _bextr_u32(key, shift, num_bits);
+#else
+        return shift < NUM_BITS ? ((unsigned int)key >> shift) & mask(num_bits) : 0;
+#endif
+    }
+    static inline int leading_zeros(const KeyType& x)
+    {
+        return __builtin_clz(x);
+    }
+};
+
+template <class KeyType> class KeyBits<KeyType, 8, true>
+{
+public:
+    static const int NUM_BITS = 64;
+
+    static inline KeyType mask(int num_bits)
+    {
+        return num_bits < NUM_BITS ? (1ULL << num_bits) - 1 : ~0ULL;
+    }
+    static inline KeyType extract(const KeyType& key, int shift, int num_bits)
+    {
+#if defined __BMI__
+        return _bextr_u64(key, shift, num_bits);
+#else
+        return shift < NUM_BITS ? ((unsigned long long)key >> shift) & mask(num_bits) : 0;
+#endif
+    }
+    static inline int leading_zeros(const KeyType& x)
+    {
+        return __builtin_clzll(x);
+    }
+};
+
+template <class KeyType> class KeyBits<KeyType, 16, true>
+{
+public:
+    static const int NUM_BITS = 128;
+
+    static inline KeyType mask(int num_bits)
+    {
+        return num_bits < NUM_BITS ? ((KeyType)1 << num_bits) - 1 : ~(KeyType)0;
+    }
+    static inline KeyType extract(const KeyType& key, int shift, int num_bits)
+    {
+        return shift < NUM_BITS ? (key >> shift) & mask(num_bits) : 0;
+    }
+    static inline int leading_zeros(const KeyType& x)
+    {
+        unsigned long long hi = (unsigned long long)(x >> 64);
+        return hi ? __builtin_clzll(hi) : 64 + __builtin_clzll((unsigned long long)x);
+    }
+};
+
+template <class KeyType> class KeyTypeInfo
+{
+    typedef KeyBits<KeyType> Bits;
+public:
+    static const int NUM_BITS = std::numeric_limits<KeyType>::digits;
+    // It's handy to have this as a signed type for looping conditions (i.e. >= 0 etc).
+    // A char holds any bit index of a key of up to 64 bits.
+    typedef typename std::conditional<(NUM_BITS < 128), char, short>::type BitIdx;
+
+    // The num_bits least significant bits set.
+    static inline KeyType mask(BitIdx num_bits)
+    {
+        return Bits::mask(num_bits);
+    }
+    // The num_bits bits of key from bit shift up, for any num_bits from 0
+    // to NUM_BITS.
     static inline KeyType extract_bits(const KeyType& key, BitIdx shift, BitIdx num_bits)
     {
-        return (key >> shift) & ((1 << num_bits) - 1);
-    }    
+        return Bits::extract(key, shift, num_bits);
+    }
     static inline BitIdx get_match_len(BitIdx skip, BitIdx chunk_size, const KeyType& k1, const KeyType& k2)
     {
-        // Ignoring the first skip most significant bits of k1 and k2, 
+        // Ignoring the first skip most significant bits of k1 and k2,
         // how long a common prefix do k1 and k2 have, in chunk_size chunks?
         // The answer is computed by this function and stored in len.
-        // 
+        //
         // E.g. skip = 16, k1 = 0xFFAABBCC
         //                 k2 = 0xFFAABBDD
         //
         // len = 8 in this case, since the "BB"s match, the "FFAA" is ignored due to skip
         // (Assuming chunk_size = 8).
         //
-        BitIdx shift = NUM_BITS - chunk_size - skip; 
-        BitIdx len = 0;
-        while(shift >= 0 && extract_bits(k1, shift, chunk_size) == extract_bits(k2, shift, chunk_size))
-        {
-            len += chunk_size;
-            shift -= chunk_size;
-        }
-        return len;
+        // Only whole chunks count, so it's the leading zeros of k1 ^ k2
+        // (after the skip) rounded down to a multiple of chunk_size.
+        BitIdx rest = NUM_BITS - skip;
+        KeyType diff = extract_bits(k1 ^ k2, 0, rest);
+        BitIdx same = diff ? Bits::leading_zeros(diff) - skip : rest;
+        return same - same % chunk_size;
     }
 };
 
+// A structure given ValueType = void is a set: it stores no values, and
+// a key's value is the key itself, so locate hands back a pointer to the
+// predecessor key. Value is what a structure's value pointers point to, and
+// STORED_BYTES what each value takes up in it.
+template <class KeyType, class ValueType> class ValueTypeInfo
+{
+public:
+    typedef ValueType Value;
+    static const bool IS_SET = false;
+    static const int STORED_BYTES = sizeof(ValueType);
+};
+
+template <class KeyType> class ValueTypeInfo<KeyType, void>
+{
+public:
+    typedef KeyType Value;
+    static const bool IS_SET = true;
+    static const int STORED_BYTES = 0;
+};
+
 #endif
@@ -4,26 +4,110 @@
 
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
+#include <new>
 #include <list>
+#include <vector>
 
 #include <key_utils/key_utils.h>
 #include <node_structs/node_structs.h>
 #include <count_alloc/count_alloc.h>
+#include <count_alloc/slab_alloc.h>
 
-template <class KeyType, class ValueType, class NodeStruct = LinearBitSearcher<false>, bool count_mem = false> class LPCTrie
+// If single_block is true each INode is allocated as one cache line aligned
+// block holding the node header, the node structure, the child pointers
+// and the node structure's own storage, rather than as three separate 
+// heap allocations.
+//
+// Nodes, leaves and child arrays are allocated through Alloc (see slab_alloc.h).
+//
+// How LPCTrie's updates change what readers may be looking at.
+//
+// With InPlaceUpdates nothing else reads the trie while it's updated, so
+// nodes, leaves and buckets are changed where they are.
+//
+// With CopyOnWriteUpdates other threads may read it (see read_leaf and
+// read_predecessor_leaf) while one thread updates it. A branch of a node
+// that's linked in, the root and a leaf's value are only changed by a
+// release store, of something complete, and readers follow them with
+// acquire loads. A node that's linked in never has its path compression
+// string changed (see repath), and a bucket that's linked in never has its
+// keys or values changed (see writable_bucket): a copy is changed instead,
+// and takes its place. What's replaced is freed straight away, so Alloc has
+// to hold it back until the update is over and the readers are done with
+// it (see EpochAlloc). Incremental expansion changes nodes in place, so
+// expand_slice has to be 0.
+class InPlaceUpdates
+{
+public:
+    static const bool COPY_ON_WRITE = false;
+    template <class T> static inline T load(const T& p)
+    {
+        return p;
+    }
+    template <class T> static inline void store(T& p, T value)
+    {
+        p = value;
+        return;
+    }
+    template <class T> static inline T* writable(T* p)
+    {
+        return p;
+    }
+};
+class CopyOnWriteUpdates
+{
+public:
+    static const bool COPY_ON_WRITE = true;
+    template <class T> static inline T load(const T& p)
+    {
+        return __atomic_load_n(&p, __ATOMIC_ACQUIRE);
+    }
+    template <class T> static inline void store(T& p, T value)
+    {
+        __atomic_store_n(&p, value, __ATOMIC_RELEASE);
+        return;
+    }
+    // A copy of *p to change in its place.
+    template <class T> static inline T* writable(T* p)
+    {
+        return new T(*p);
+    }
+};
+
+// If expand_slice is non-zero, expanding a node with more than expand_slice
+// branches doesn't move all of them into the bigger node at once. The new
+// node takes the old one's place straight away, and each later insert moves
+// another expand_slice branches across (see expand_step). Until the old node
+// is empty, lookups follow a branch that hasn't moved yet into the old node.
+//
+// Updates is InPlaceUpdates or CopyOnWriteUpdates (see above).
+template <class KeyType, class ValueType, class NodeStruct = LinearBitSearcher<false>, bool count_mem = false, bool single_block = false, class Alloc = HeapAlloc, class Updates = InPlaceUpdates> class LPCTrie
 {    
     typedef KeyTypeInfo<KeyType> KeyInfo;
     typedef typename KeyInfo::BitIdx BitIdx;
 public:  
     class INode;
     class Leaf;
+    typedef Updates UpdatePolicy;
 
     static const BitIdx NUM_KEY_BITS = KeyInfo::NUM_BITS;
     typedef /*unsigned short*/unsigned int ChildIdx;
+    static const unsigned int CACHE_LINE_SIZE = 64;
 private:
     INode* root;
     int min_children_bits, max_children_bits;
     float expand_threshold, contract_threshold;
+    ChildIdx expand_slice;
+
+    // An incremental expansion in progress: node is the new node, and
+    // shift is where the branches of the old node were found in the key.
+    struct Expansion
+    {
+        INode* node;
+        BitIdx shift;
+    };
+    std::vector<Expansion> expansions;
 public:
     class DefaultMatchTester
     {
@@ -38,11 +122,10 @@ public:
         ValueType value;
     public:
         DefaultCreateLeaf(ValueType value) : value(value) {}
-        inline void operator()(INode* parent, const KeyType& leaf_idx, const KeyType& key)
+        inline void operator()(INode* parent, const KeyType& leaf_idx, const KeyType& key, Leaf*, bool)
         {
             Leaf *l = new Leaf(key, value);
             parent->add_leaf(l, (ChildIdx)leaf_idx);
-            update_mem_counter<count_mem,Leaf>(MemCounter::NEW, l);           
             return;
         }
     };
@@ -54,7 +137,7 @@ public:
         inline void operator()(INode* n, const KeyType& key, BitIdx shift)
         {
             ChildIdx idx = (ChildIdx)KeyInfo::extract_bits(key, shift, n->num_children_bits);
-            n->leaves[idx]->value = value;
+            Updates::store(n->leaves[idx]->value, value);
             return;
         }
         inline void connect(INode* parent, INode* node, ChildIdx idx, BitIdx shift)
@@ -76,47 +159,102 @@ public:
     class Leaf
     {
     public:
+        ALLOC_MEMORY(Alloc, count_mem)
+
         ValueType value;
         KeyType key;
         Leaf() {}
         Leaf(const KeyType& key, const ValueType& value) : value(value), key(key) {}
     };
+    // A branch of an INode is either null, a Leaf* or an INode*. Internal 
+    // nodes are distinguished from leaves by setting the low bit of the 
+    // pointer (the same bit-in-pointer trick as the vEB handles use), so
+    // following a branch is a single load.
+    typedef std::ptrdiff_t ChildPtr;
+    static inline bool is_inode(ChildPtr c) { return c & 1; }
+    static inline INode* to_inode(ChildPtr c) { return reinterpret_cast<INode*>(c & ~ChildPtr(1)); }
+    static inline ChildPtr from_inode(INode* n) { return reinterpret_cast<ChildPtr>(n) | 1; }
+
     class INode // An Internal trie Node.
     {
     public:    
+        ALLOC_MEMORY(Alloc, count_mem)
+
         BitIdx num_children_bits;
         NodeStruct* node_struct;        
         union
         {
-            INode** inodes;
-            Leaf** leaves;
+            ChildPtr* children; // Tagged, see ChildPtr.
+            Leaf** leaves;      // Only valid at indices that are not internal.
         };
-        bool* is_internal; // is_internal[i] == true only if i-th branch is to a non-null, non-leaf node.
         BitIdx num_skipped;
         KeyType skipped_bits;
         ChildIdx num_empty_internal;
+        // While this node is replacing migrating_from a slice at a time, 
+        // the branches of migrating_from from num_migrated on are yet to be 
+        // moved, and are still found there. The old node's migrating_to 
+        // points back here.
+        ChildIdx num_migrated;
+        INode* migrating_from;
+        INode* migrating_to;
 
         INode(int num_children_bits) : num_children_bits(num_children_bits),
-                                       num_skipped(0), skipped_bits(0), num_empty_internal(0)
+                                       num_skipped(0), skipped_bits(0), num_empty_internal(0),
+                                       num_migrated(0), migrating_from(0), migrating_to(0)
         {
             unsigned int num_children = 1 << num_children_bits;
-            inodes = new INode*[num_children];
-            update_mem_counter<count_mem,INode*>(MemCounter::NEW, inodes, num_children);
+            children = static_cast<ChildPtr*>(alloc_bytes<Alloc,count_mem>(num_children * sizeof(ChildPtr)));
+            void* p = alloc_bytes<Alloc,count_mem>(sizeof(NodeStruct));
+            node_struct = new (p) NodeStruct((void**) children, num_children_bits);
 
-            node_struct = new NodeStruct((void**) inodes, num_children_bits);
-            update_mem_counter<count_mem,NodeStruct>(MemCounter::NEW, node_struct);
+            memset(children, 0, num_children * sizeof(*children));
+            return;
+        }
+        // Construct the node at the start of a block of block_size(num_children_bits) 
+        // bytes, and carve the remaining arrays out of the rest of that block:
+        //
+        // [INode | NodeStruct | pad] [children ... ] [node struct storage]
+        //
+        // The child pointers always start on a cache line boundary.
+        INode(int num_children_bits, char* block) : num_children_bits(num_children_bits),
+                                                    num_skipped(0), skipped_bits(0), num_empty_internal(0),
+                                                    num_migrated(0), migrating_from(0), migrating_to(0)
+        {
+            unsigned int num_children = 1 << num_children_bits;
+            children = reinterpret_cast<ChildPtr*>(block + header_size());
+            char* storage = block + storage_offset(num_children_bits);
+            node_struct = new (block + sizeof(INode)) NodeStruct((void**) children, num_children_bits, storage);
 
-            is_internal = new bool[num_children];
-            update_mem_counter<count_mem,bool>(MemCounter::NEW, is_internal, num_children);
-            
-            memset(inodes, 0, num_children * sizeof(*inodes));
-            memset(is_internal, 0, num_children * sizeof(*is_internal));
+            memset(children, 0, num_children * sizeof(*children));
             return;
         }
+        static size_t header_size()
+        {
+            size_t header = sizeof(INode) + sizeof(NodeStruct);
+            return (header + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+        }
+        static size_t storage_offset(int num_children_bits)
+        {
+            return header_size() + ((size_t)1 << num_children_bits) * sizeof(ChildPtr);
+        }
+        static size_t block_size(int num_children_bits)
+        {
+            size_t size = storage_offset(num_children_bits) + NodeStruct::storage_size(num_children_bits);
+            return (size + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+        }
+        inline bool is_internal(ChildIdx idx) { return is_inode(children[idx]); }
+        inline INode* get_inode(ChildIdx idx) { return to_inode(children[idx]); }
+        // Point branch idx at c, a node or leaf that is complete. Doesn't
+        // touch the node structure, so there must already be a branch at idx.
+        inline void set_child(ChildIdx idx, ChildPtr c) { Updates::store(children[idx], c); }
+        // As set_child, for a node (see add_inode).
+        inline void set_inode(INode* n, ChildIdx idx) { set_child(idx, from_inode(n)); }
         bool is_full_enough(float expand_threshold)
         {
             return num_empty_internal >= expand_threshold * (1 << num_children_bits);
         }
+        // Part of an incremental expansion, as either the old or new node.
+        bool is_migrating() { return migrating_from || migrating_to; }
         bool is_empty_enough(float contract_threshold)
         {
             return node_struct->get_num_set_bits() < 0.5f + contract_threshold * (1 << num_children_bits);
@@ -128,24 +266,22 @@ public:
         }
         void add_inode(INode* n, ChildIdx idx)
         {
-            inodes[idx] = n;
-            is_internal[idx] = true;
+            set_inode(n, idx);
             node_struct->set_bit(idx);
             return;
         }
         void add_leaf(Leaf* l, ChildIdx idx)
         {
-            leaves[idx] = l;
+            set_child(idx, reinterpret_cast<ChildPtr>(l));
             node_struct->set_bit(idx);
             return;
         }
         void remove_leaf(ChildIdx idx)
         {
-            update_mem_counter<count_mem,Leaf>(MemCounter::DELETE, leaves[idx]);
-            
             node_struct->unset_bit(idx);
-            delete leaves[idx];
-            leaves[idx] = 0;
+            Leaf* l = leaves[idx];
+            set_child(idx, 0);
+            delete l;
             return;
         }
 
@@ -158,27 +294,86 @@ public:
         
         void destroy()
         {
-            update_mem_counter<count_mem,bool>(MemCounter::DELETE, is_internal);
-            delete[] is_internal;
-
-            update_mem_counter<count_mem,INode*>(MemCounter::DELETE, inodes);
-            delete[] inodes;
+            if(single_block)
+            {
+                // Everything lives in the block that is freed with the node.
+                node_struct->~NodeStruct();
+                return;
+            }
+            free_bytes<Alloc,count_mem>(children, ((size_t)1 << num_children_bits) * sizeof(ChildPtr));
 
-            update_mem_counter<count_mem,NodeStruct>(MemCounter::DELETE, node_struct);
-            delete node_struct;
+            node_struct->~NodeStruct();
+            free_bytes<Alloc,count_mem>(node_struct, sizeof(NodeStruct));
             return;
         }
     };
-    LPCTrie(int min_children_bits, int max_children_bits, float expand_threshold, float contract_threshold) : min_children_bits(min_children_bits), 
+    // Allocate and free internal nodes. Everything that creates or destroys
+    // an INode (including the bursters) should go through these two.
+    static INode* new_inode(int num_children_bits)
+    {
+        INode* n;
+        if(single_block)
+        {
+            // The block size is a multiple of the cache line size, so
+            // Alloc hands it back cache line aligned.
+            void* block = alloc_bytes<Alloc,count_mem>(INode::block_size(num_children_bits));
+            n = new (block) INode(num_children_bits, static_cast<char*>(block));
+        }
+        else
+        {
+            n = new INode(num_children_bits);
+        }
+        return n;
+    }
+    static void delete_inode(INode* n)
+    {
+        n->destroy();
+        if(single_block)
+        {
+            size_t size = INode::block_size(n->num_children_bits);
+            n->~INode();
+            free_bytes<Alloc,count_mem>(n, size);
+        }
+        else
+        {
+            delete n;
+        }
+        return;
+    }
+    // Give n the path compression string of num_skipped bits skipped_bits,
+    // and return it. With CopyOnWriteUpdates n may be linked in, so a copy
+    // of it is given the string and returned instead, for the caller to
+    // link in in n's place, and n is freed.
+    static INode* repath(INode* n, KeyType skipped_bits, BitIdx num_skipped)
+    {
+        if(Updates::COPY_ON_WRITE)
+        {
+            INode* copy = new_inode(n->num_children_bits);
+            memcpy(copy->children, n->children, ((size_t)1 << n->num_children_bits) * sizeof(ChildPtr));
+            copy->update_node_struct();
+            copy->num_empty_internal = n->num_empty_internal;
+            delete_inode(n);
+            n = copy;
+        }
+        n->skipped_bits = skipped_bits;
+        n->num_skipped = num_skipped;
+        return n;
+    }
+    LPCTrie(int min_children_bits, int max_children_bits, float expand_threshold, float contract_threshold, ChildIdx expand_slice = 0) : min_children_bits(min_children_bits), 
                                                                                                               max_children_bits(max_children_bits), 
                                                                                                               expand_threshold(expand_threshold), 
-                                                                                                              contract_threshold(contract_threshold)
+                                                                                                              contract_threshold(contract_threshold),
+                                                                                                              expand_slice(expand_slice)
     {
-        root = new INode(min_children_bits); 
-        update_mem_counter<count_mem,INode>(MemCounter::NEW, root);
+        root = new_inode(min_children_bits); 
     }
     // Add the mapping key -> value to the trie.
     // Return true only if we update rather than create the mapping.
+    //
+    // A new leaf is made by create_leaf(node, idx, key, neighbour, is_pred),
+    // which hangs it at branch idx of node. neighbour is the leaf next to
+    // the new one in key order, found on the way down: its predecessor if
+    // is_pred, else its successor. It's 0 only if no key is smaller.
     // N.B. the true/false thing isn't working at the moment w.r.t the
     // burst trie
     bool insert(const KeyType& key, const ValueType& value)
@@ -191,38 +386,53 @@ public:
             CreateLeaf create_leaf, 
             UpdateLeaf update_leaf)
     {        
+        if(!expansions.empty())
+        {
+            expand_step(update_leaf);
+        }
         BitIdx shift = NUM_KEY_BITS - root->num_children_bits;
         ChildIdx idx = (ChildIdx)KeyInfo::extract_bits(key, shift, root->num_children_bits);
 
         ChildIdx parent_idx = 0;
         INode* parent = 0;
         INode* node = root;
-        INode* child = root->inodes[idx];
+        follow_migration(node, idx, shift);
+        ChildPtr c = node->children[idx];
+        INode* child = to_inode(c); // Only meaningful if is_inode(c)
         
         // Loop until we are at the bottom of the trie 
         // (i.e. when shift == 0 or we're at a leaf) or
         // when the path compression bits don't match the key's bits.
-        while(shift > 0 && node->is_internal[idx] && child->skipped_bits == KeyInfo::extract_bits(key, shift - child->num_skipped, child->num_skipped))
+        while(shift > 0 && is_inode(c) && child->skipped_bits == KeyInfo::extract_bits(key, shift - child->num_skipped, child->num_skipped))
         {
             shift -= child->num_children_bits + child->num_skipped;
             parent_idx = idx; // node is found at parent_idx in parent
             idx = (ChildIdx)KeyInfo::extract_bits(key, shift, child->num_children_bits);
             parent = node;
             node = child;
-            child = node->inodes[idx];
+            follow_migration(node, idx, shift);
+            c = node->children[idx];
+            child = to_inode(c);
         }
         using namespace std;
         bool found = false;
-        if(!child)
+        if(!c)
         {
             using namespace std;
-           // This is the simplest case. 
+            // This is the simplest case. 
             // There is no child coming from node, so just
-            // create a leaf.
-            create_leaf(node, idx, key);                   
+            // create a leaf, next to the closest of node's other branches.
+            bool is_pred;
+            Leaf* neighbour = neighbour_in_node(node, idx, is_pred);
+            if(!neighbour)
+            {
+                neighbour = predecessor_leaf(key);
+                is_pred = true;
+            }
+            create_leaf(node, idx, key, neighbour, is_pred);
             //
         }
-        else if(!node->is_internal[idx])
+        else if(!is_inode(c))
         {
             // In this case, we are at a leaf, so we might
             // need to split its path compression string (which
@@ -268,13 +478,7 @@ public:
                 // Where S' is the longest prefix shared by the key in the
                 // original leaf, and the new key.
                 //
-                INode* splitter = new INode(min_children_bits);
-                update_mem_counter<count_mem,INode>(MemCounter::NEW, splitter);
-                // Make the splitter a child of the node at idx, which
-                // is where we found this leaf.
-                
-                node->is_internal[idx] = true;
-                node->inodes[idx] = splitter;
+                INode* splitter = new_inode(min_children_bits);
                 
                 // Now we want to determine the longest prefix shared by
                 // key and leaf->key, but we need to exclude all bits up
@@ -296,9 +500,13 @@ public:
                 // splitter using them.
                 tmp -= splitter->num_children_bits;
 
-                create_leaf(splitter, KeyInfo::extract_bits(key, tmp, splitter->num_children_bits), key);
+                create_leaf(splitter, KeyInfo::extract_bits(key, tmp, splitter->num_children_bits), key, leaf, leaf->key < key);
                 splitter->add_leaf(leaf, (ChildIdx)KeyInfo::extract_bits(leaf->key, tmp, splitter->num_children_bits));
 
+                // Make the splitter a child of the node at idx, which
+                // is where we found this leaf, now that it is complete.
+                node->set_inode(splitter, idx);
+
                 if(!splitter->num_skipped)
                 {
                     node->num_empty_internal++;           
@@ -345,14 +553,9 @@ public:
             // that are now branched on in the splitter (i.e. S = S'T)
             //
             
-            // Add the splitter as a child at idx of node, where the mismatch
-            // occured.
-            INode* splitter = new INode(min_children_bits);
-            update_mem_counter<count_mem,INode>(MemCounter::NEW, splitter);
-            // We don't call add_inode here because that would update
-            // internal node data structures that don't require updating
-            // in this case.
-            node->inodes[idx] = splitter;
+            // The splitter goes at idx of node, where the mismatch occured.
+            // It isn't linked in until it is complete (see CopyOnWriteUpdates).
+            INode* splitter = new_inode(min_children_bits);
             
             // Now find the longest prefix of the key matching the path
             // compression string in len.
@@ -364,16 +567,24 @@ public:
             splitter->skipped_bits = KeyInfo::extract_bits(child->skipped_bits, ns - len, len);
             
             // The new leaf contains the key to be inserted, so find the right chunk of bits to branch
-            // on in the splitter and add the leaf there.
-            create_leaf(splitter, KeyInfo::extract_bits(key, shift - len - splitter->num_children_bits, splitter->num_children_bits), key);
+            // on in the splitter and add the leaf there. It sits just after or just before
+            // all of child's sub-trie, whichever way the key differs from its string.
+            bool is_pred = KeyInfo::extract_bits(key, shift - ns, ns) > child->skipped_bits;
+            Leaf* neighbour = is_pred ? last_leaf_below(node, idx) : first_leaf_below(node, idx);
+            create_leaf(splitter, KeyInfo::extract_bits(key, shift - len - splitter->num_children_bits, splitter->num_children_bits), key, neighbour, is_pred);
 
             // Now we add in the sub-trie that originally had the non-matching path
-            // compression string. 
-            splitter->add_inode(child, (ChildIdx)KeyInfo::extract_bits(child->skipped_bits, ns - len - splitter->num_children_bits, splitter->num_children_bits));
+            // compression string, with the suffix of that string.
+            ChildIdx child_idx = (ChildIdx)KeyInfo::extract_bits(child->skipped_bits, ns - len - splitter->num_children_bits, splitter->num_children_bits);
+            BitIdx rest = ns - len - splitter->num_children_bits;
+            child = repath(child, child->skipped_bits & KeyInfo::mask(rest), rest);
+            splitter->add_inode(child, child_idx);
+
+            // We don't call add_inode here because that would update
+            // internal node data structures that don't require updating
+            // in this case.
+            node->set_inode(splitter, idx);
 
-            // Now update the child with the suffix of its original path compression string.
-            child->num_skipped = ns - len - splitter->num_children_bits;
-            child->skipped_bits &= ((1 << child->num_skipped) - 1);
             if(!child->num_skipped)
             {
                 splitter->num_empty_internal++;
@@ -386,6 +597,22 @@ public:
         }
         return found;
     }
+    // Build the trie bottom-up from keys[0], .., keys[n - 1], which must be sorted
+    // and distinct. The trie must be empty. The keys are grouped by prefix
+    // as though a leaf held up to max_leaf_keys of them (as in the burst trie),
+    // and create_leaf(node, idx, first, last) is called, in key order, to hang
+    // the leaf for keys[first], .., keys[last - 1] at branch idx of node.
+    //
+    // Each node is given its final size up front, by the same test check_expand
+    // makes, so no splitting or expansion takes place.
+    template <class CreateLeafRange> void bulk_load(const KeyType* keys, size_t n, size_t max_leaf_keys, CreateLeafRange create_leaf)
+    {
+        destroy();
+        BitIdx num_bits = choose_children_bits(keys, 0, n, NUM_KEY_BITS, max_leaf_keys);
+        root = new_inode(num_bits);
+        bulk_load_node(root, NUM_KEY_BITS - num_bits, keys, 0, n, max_leaf_keys, create_leaf);
+        return;
+    }
     void remove(const KeyType& key)
     {
         remove_if(key, DefaultMatchTester(), DefaultRemovePred());
@@ -404,16 +631,18 @@ public:
         INode* parent_parent = 0; // The parent of the parent of node
         INode* parent = 0;    // The parent of node
         INode* node = root;   // Well, this is just plain old node :)
+        follow_migration(node, idx, shift);
         
-        INode* child = root->inodes[idx];
+        ChildPtr c = node->children[idx];
         
         // Loop until we are at the bottom of the trie 
         // (i.e. when shift == 0 or we're at a leaf) or
         // when the path compression bits don't match the key's bits.
         
         using namespace std;
-        while(shift > 0 && node->is_internal[idx])
+        while(shift > 0 && is_inode(c))
         {
+            INode* child = to_inode(c);
             shift -= child->num_children_bits + child->num_skipped;
             parent_parent_idx = parent_idx;
             parent_idx = idx; // node is found at parent_idx in parent
@@ -421,9 +650,10 @@ public:
             parent_parent = parent;
             parent = node;
             node = child;
-            child = node->inodes[idx];
+            follow_migration(node, idx, shift);
+            c = node->children[idx];
         }
-        if(!child)
+        if(!c)
         {
             return;
         }
@@ -433,7 +663,9 @@ public:
         {
             return;
         }
-        if(parent && node->node_struct->get_num_set_bits() == 2)
+        // The two halves of an expansion in progress are left as they are
+        // until it finishes, even if that leaves one with a single branch.
+        if(parent && node->node_struct->get_num_set_bits() == 2 && !node->is_migrating())
         {
             int other_idx;
             if(idx == node->first_branch())
@@ -455,28 +687,23 @@ public:
                 // always has a non-empty path compression string or a leaf)
                 parent->num_empty_internal--;
             }
-            if(node->is_internal[other_idx])
+            if(node->is_internal(other_idx))
             {
-                INode* x = node->inodes[other_idx];
-                parent->inodes[parent_idx] = x;                
+                INode* x = node->get_inode(other_idx);
                 
                 // Concatenate the path compression strings, and the node index.
-                x->skipped_bits |= (node->skipped_bits << (x->num_skipped + node->num_children_bits)) | (idx << x->num_skipped);
-                x->num_skipped += node->num_skipped + node->num_children_bits;
+                x = repath(x, x->skipped_bits | (node->skipped_bits << (x->num_skipped + node->num_children_bits)) | ((KeyType)other_idx << x->num_skipped),
+                           x->num_skipped + node->num_skipped + node->num_children_bits);
+                parent->set_inode(x, parent_idx);
             }
             else
             {                
                 // Don't need to update the node structure for parent,
                 // since there was already a branch at parent_idx to node
-                parent->is_internal[parent_idx] = false;
-                parent->leaves[parent_idx] = node->leaves[other_idx];
+                parent->set_child(parent_idx, node->children[other_idx]);
             }
-            node->destroy();
-           
-            update_mem_counter<count_mem,INode>(MemCounter::DELETE, node);            
-            delete node;
+            delete_inode(node);
 
-            update_mem_counter<count_mem,Leaf>(MemCounter::DELETE, leaf);
             delete leaf;
         
             check_contract(parent_parent, parent_parent_idx, parent); 
@@ -504,7 +731,7 @@ public:
             ChildIdx divider_start = k & (~(num_divider_children - 1)); 
             ChildIdx divider_end = divider_start + num_divider_children;
             ChildIdx first_branch = k;
-            if(!node->inodes[k])
+            if(!node->children[k])
             {
                 first_branch = node->closest_branch_after(k);
             }
@@ -524,36 +751,32 @@ public:
                     // node, just pull up the sub-trie at first_branch
                     k = next_branch;
                     
-                    INode* n = node->inodes[first_branch];
-                    parent->inodes[parent_offset + i] = n;
-                    if(node->is_internal[first_branch])
+                    if(node->is_internal(first_branch))
+                    {
+                        INode* n = node->get_inode(first_branch);
+                        n = repath(n, n->skipped_bits | (KeyType)((first_branch - divider_start) & (num_divider_children - 1)) << n->num_skipped,
+                                   n->num_skipped + sbits);
+                        parent->set_inode(n, parent_offset + i);
+                    }
+                    else
                     {
-                        parent->is_internal[parent_offset + i] = true;
-                        n->skipped_bits |= ((first_branch - divider_start) & (num_divider_children - 1)) << n->num_skipped;
-                        n->num_skipped += sbits;
+                        parent->set_child(parent_offset + i, node->children[first_branch]);
                     }
                 }
                 else
                 {
-                    INode* divider = new INode(sbits);
-                    update_mem_counter<count_mem,INode>(MemCounter::NEW, divider);
-
-                    // Link in the divider to the parent
-                    parent->inodes[parent_offset + i] = divider;
-                    parent->num_empty_internal++;
-                    parent->is_internal[parent_offset + i] = true;
+                    INode* divider = new_inode(sbits);
 
-                    // Finally link the appropriate children from the 
-                    // node we are dividing's children into the divider
+                    // Link the appropriate children from the node
+                    // we are dividing's children into the divider
                     //
                     ChildIdx j = k - divider_start;
                     while(k < divider_end)
                     {
-                        divider->inodes[j] = node->inodes[k];
-                        if(node->is_internal[k])
+                        divider->children[j] = node->children[k];
+                        if(node->is_internal(k))
                         {
-                            divider->is_internal[j] = true;
-                            if(!node->inodes[k]->num_skipped)
+                            if(!node->get_inode(k)->num_skipped)
                             {
                                 divider->num_empty_internal++;
                             }
@@ -562,25 +785,109 @@ public:
                         j++;
                     }
                     divider->update_node_struct(); 
+
+                    // Finally link in the divider to the parent
+                    parent->set_inode(divider, parent_offset + i);
+                    parent->num_empty_internal++;
+                }
+            }
+        }
+        return;
+    }
+    // The number of bits a node branching on the shift bits below its path compression
+    // string should have, if it holds keys[lo], .., keys[hi - 1]. Starting at
+    // min_children_bits, keep expanding while check_expand would, i.e. while enough
+    // branches would lead to internal nodes with no path compression string.
+    BitIdx choose_children_bits(const KeyType* keys, size_t lo, size_t hi, BitIdx shift, size_t max_leaf_keys)
+    {
+        BitIdx num_bits = min_children_bits;
+        while(num_bits + min_children_bits <= max_children_bits && num_bits + min_children_bits <= shift)
+        {
+            BitIdx child_shift = shift - num_bits;
+            ChildIdx num_empty = 0;
+            size_t i = lo;
+            while(i < hi)
+            {
+                KeyType bits = KeyInfo::extract_bits(keys[i], child_shift, num_bits);
+                size_t j = i + 1;
+                while(j < hi && KeyInfo::extract_bits(keys[j], child_shift, num_bits) == bits)
+                {
+                    j++;
+                }
+                // Sorted, so the next chunk differs somewhere in the group
+                // exactly when it differs between its first and last keys.
+                if(j - i > max_leaf_keys && 
+                   KeyInfo::extract_bits(keys[i], child_shift - min_children_bits, min_children_bits) != 
+                   KeyInfo::extract_bits(keys[j - 1], child_shift - min_children_bits, min_children_bits))
+                {
+                    num_empty++;
+                }
+                i = j;
+            }
+            if(num_empty < expand_threshold * (1 << num_bits))
+            {
+                break;
+            }
+            num_bits += min_children_bits;
+        }
+        return num_bits;
+    }
+    // Fill in node, which holds keys[lo], .., keys[hi - 1] and branches on the shift + num_children_bits
+    // to shift bits of them, for bulk_load.
+    template <class CreateLeafRange> void bulk_load_node(INode* node, BitIdx shift, const KeyType* keys, size_t lo, size_t hi, size_t max_leaf_keys, CreateLeafRange& create_leaf)
+    {
+        size_t i = lo;
+        while(i < hi)
+        {
+            ChildIdx idx = (ChildIdx)KeyInfo::extract_bits(keys[i], shift, node->num_children_bits);
+            size_t j = i + 1;
+            while(j < hi && (ChildIdx)KeyInfo::extract_bits(keys[j], shift, node->num_children_bits) == idx)
+            {
+                j++;
+            }
+            if(j - i <= max_leaf_keys || !shift)
+            {
+                create_leaf(node, idx, i, j);
+            }
+            else
+            {
+                // The path compression string is the prefix shared by 
+                // the whole group, so by its first and last keys.
+                BitIdx len = KeyInfo::get_match_len(NUM_KEY_BITS - shift, min_children_bits, keys[i], keys[j - 1]);
+                BitIdx num_bits = choose_children_bits(keys, i, j, shift - len, max_leaf_keys);
+                INode* child = new_inode(num_bits);
+                child->num_skipped = len;
+                child->skipped_bits = KeyInfo::extract_bits(keys[i], shift - len, len);
+                node->set_inode(child, idx);
+                if(!len)
+                {
+                    node->num_empty_internal++;
                 }
+                bulk_load_node(child, shift - len - num_bits, keys, i, j, max_leaf_keys, create_leaf);
             }
+            i = j;
         }
+        node->update_node_struct();
         return;
     }
     template <class UpdateLeaf> void compress_into(INode* parent, INode* node, ChildIdx parent_offset, ChildIdx idx, BitIdx num_consumed, UpdateLeaf update_leaf)
     // Compress the children of node into parent
     {
-        if(node->is_internal[idx])
+        if(node->is_internal(idx))
         {
-            INode* n = node->inodes[idx];
+            INode* n = node->get_inode(idx);
+            if(n->migrating_from && !n->num_skipped)
+            {
+                // n is about to be taken apart, so it had better be whole.
+                finish_expansion(n, update_leaf);
+            }
             BitIdx num_bits = n->num_children_bits;
             if(n->num_skipped)
             {
                 ChildIdx pidx = parent_offset + (ChildIdx)KeyInfo::extract_bits(n->skipped_bits, n->num_skipped - min_children_bits, min_children_bits);
-                parent->inodes[pidx] = n;
-                parent->is_internal[pidx] = true;    
-                n->num_skipped -= min_children_bits;
-                n->skipped_bits &= ((1 << n->num_skipped) - 1);
+                BitIdx rest = n->num_skipped - min_children_bits;
+                n = repath(n, n->skipped_bits & KeyInfo::mask(rest), rest);
+                parent->set_inode(n, pidx);
                 if(!n->num_skipped)
                 {
                     parent->num_empty_internal++;
@@ -593,9 +900,7 @@ public:
                 // we need to divide the node.
                 //
                 divide_node(n, parent, parent_offset);
-                update_mem_counter<count_mem,INode>(MemCounter::DELETE, n);
-                n->destroy(); 
-                delete n;
+                delete_inode(n);
             }
             else 
             {
@@ -605,16 +910,13 @@ public:
                 //
                 for(int i = 0; i < (1 << num_bits); i++)
                 {                    
-                    parent->inodes[parent_offset + i] = n->inodes[i];
-                    if(n->is_internal[i])
+                    parent->children[parent_offset + i] = n->children[i];
+                    if(n->is_internal(i))
                     {                     
-                        parent->is_internal[parent_offset + i] = true;
                         parent->num_empty_internal++;
                     }
                 }
-                update_mem_counter<count_mem,INode>(MemCounter::DELETE, n);
-                n->destroy();
-                delete n;
+                delete_inode(n);
             }
         }
         else if(node->leaves[idx])        
@@ -626,21 +928,51 @@ public:
     template <class UpdateLeaf> void check_expand(INode* parent, ChildIdx parent_idx, BitIdx shift, INode* node, UpdateLeaf update_leaf)
     {       
         
-        if(node->num_children_bits >= max_children_bits || !node->is_full_enough(expand_threshold))
+        if(node->num_children_bits >= max_children_bits || node->is_migrating() || !node->is_full_enough(expand_threshold))
         {
             return;
         }
-        INode* new_node = new INode(node->num_children_bits + min_children_bits);            
-        update_mem_counter<count_mem,INode>(MemCounter::NEW, new_node);
-
+        INode* new_node = new_inode(node->num_children_bits + min_children_bits);            
 
+        BitIdx num_bits = node->num_children_bits;
+        if(expand_slice && (ChildIdx)(1 << num_bits) > expand_slice)
+        {
+            // Link in new_node empty, and leave the branches to expand_step.
+            new_node->migrating_from = node;
+            node->migrating_to = new_node;
+            new_node->num_skipped = node->num_skipped;
+            new_node->skipped_bits = node->skipped_bits;
+            if(parent)
+            {
+                parent->set_inode(new_node, parent_idx);
+                if(!node->num_skipped)
+                {
+                    parent->num_empty_internal++;
+                }
+            }
+            else
+            {
+                Updates::store(root, new_node);
+            }
+            Expansion e = { new_node, shift };
+            expansions.push_back(e);
+            return;
+        }
+        for(int i = 0; i < (1 << num_bits); i++)
+        {
+            compress_into(new_node, node, 
+                    i << min_children_bits, i, 
+                    NUM_KEY_BITS - shift + min_children_bits, update_leaf);
+        }
+        new_node->update_node_struct();
+        // Only link in new_node once it is complete (see CopyOnWriteUpdates).
         if(parent)
         {
-            parent->inodes[parent_idx] = new_node;
-
             new_node->num_skipped = node->num_skipped;
             new_node->skipped_bits = node->skipped_bits;
 
+            parent->set_inode(new_node, parent_idx);
+
             if(!node->num_skipped)
             {
                 parent->num_empty_internal++;
@@ -648,30 +980,80 @@ public:
         }
         else
         {
-            root = new_node;
+            Updates::store(root, new_node);
         }
-        BitIdx num_bits = node->num_children_bits;
-        for(int i = 0; i < (1 << num_bits); i++)
+        delete_inode(node);
+        return;
+    }
+    // Move the next expand_slice branches of the most recently started
+    // incremental expansion into its new node.
+    template <class UpdateLeaf> void expand_step(UpdateLeaf& update_leaf)
+    {
+        Expansion e = expansions.back();
+        ChildIdx end = 1 << e.node->migrating_from->num_children_bits;
+        ChildIdx stop = e.node->num_migrated + expand_slice;
+        migrate(e, stop < end ? stop : end, update_leaf);
+        return;
+    }
+    // Move all the remaining branches into node, which is being expanded.
+    template <class UpdateLeaf> void finish_expansion(INode* node, UpdateLeaf& update_leaf)
+    {
+        size_t i = 0;
+        while(expansions[i].node != node)
         {
-            compress_into(new_node, node, 
-                    i << min_children_bits, i, 
-                    NUM_KEY_BITS - shift + min_children_bits, update_leaf);
+            i++;
+        }
+        migrate(expansions[i], 1 << node->migrating_from->num_children_bits, update_leaf);
+        return;
+    }
+    // Move branches num_migrated, .., stop - 1 of the old node of e into its new 
+    // node, just as check_expand moves them all. Once the old node is empty 
+    // it is deleted and the expansion is over.
+    template <class UpdateLeaf> void migrate(Expansion e, ChildIdx stop, UpdateLeaf& update_leaf)
+    {
+        INode* node = e.node;
+        INode* old = node->migrating_from;
+        ChildIdx num_split = 1 << min_children_bits;
+        while(node->num_migrated < stop)
+        {
+            ChildIdx i = node->num_migrated;
+            if(old->children[i])
+            {
+                ChildIdx first = i << min_children_bits;
+                compress_into(node, old, first, i, NUM_KEY_BITS - e.shift + min_children_bits, update_leaf);
+                for(ChildIdx j = first; j < first + num_split; j++)
+                {
+                    if(node->children[j])
+                    {
+                        node->node_struct->set_bit(j);
+                    }
+                }
+                old->children[i] = 0;
+                old->node_struct->unset_bit(i);
+            }
+            node->num_migrated++;
+        }
+        if(stop == (ChildIdx)(1 << old->num_children_bits))
+        {
+            size_t i = 0;
+            while(expansions[i].node != node)
+            {
+                i++;
+            }
+            expansions.erase(expansions.begin() + i);
+            node->migrating_from = 0;
+            delete_inode(old);
         }
-        new_node->update_node_struct();
-        node->destroy();
-        update_mem_counter<count_mem,INode>(MemCounter::DELETE, node);
-        delete node;
         return;
     }
     void check_contract(INode* parent, ChildIdx parent_idx, INode* node)
     {
-        if(node->num_children_bits <= min_children_bits || !node->is_empty_enough(contract_threshold))
+        if(node->num_children_bits <= min_children_bits || node->is_migrating() || !node->is_empty_enough(contract_threshold))
         {
             return;
         }
 
-        INode* new_node = new INode(min_children_bits);
-        update_mem_counter<count_mem,INode>(MemCounter::NEW, new_node);
+        INode* new_node = new_inode(min_children_bits);
         
         divide_node(node, new_node, 0);
         new_node->update_node_struct();
@@ -680,41 +1062,41 @@ public:
         {
             if(new_node->node_struct->get_num_set_bits() == 1)
             {
+                // Pull the only branch up into parent, prefixing its path
+                // compression string with node's string and the branch index.
                 ChildIdx idx = new_node->first_branch();
-                INode* n = new_node->inodes[idx];
-                parent->inodes[parent_idx] = n;
-                n->skipped_bits = (node->skipped_bits << min_children_bits) | idx;
-                n->num_skipped = node->num_skipped + min_children_bits;
-                               
-                new_node->destroy();
-                update_mem_counter<count_mem,INode>(MemCounter::DELETE, new_node);
-                delete new_node;
+                if(new_node->is_internal(idx))
+                {
+                    INode* n = new_node->get_inode(idx);
+                    n = repath(n, n->skipped_bits | (node->skipped_bits << (n->num_skipped + min_children_bits)) | ((KeyType)idx << n->num_skipped),
+                               n->num_skipped + node->num_skipped + min_children_bits);
+                    parent->set_inode(n, parent_idx);
+                }
+                else
+                {
+                    parent->set_child(parent_idx, new_node->children[idx]);
+                }
+                if(!node->num_skipped)
+                {
+                    parent->num_empty_internal--;
+                }
+                delete_inode(new_node);
             }
             else
             {
-                parent->inodes[parent_idx] = new_node;
                 new_node->skipped_bits = node->skipped_bits;
                 new_node->num_skipped = node->num_skipped;
+                parent->set_inode(new_node, parent_idx);
             } 
         }
         else
         {
-            if(new_node->node_struct->get_num_set_bits() == 1)
-            {
-                root = new_node->inodes[new_node->first_branch()];
-                new_node->destroy();
-                update_mem_counter<count_mem,INode>(MemCounter::DELETE, new_node);
-                delete new_node;
-            }
-            else
-            {
-                root = new_node;
-            }
+            // The root has no path compression string, so it is
+            // replaced by new_node even if that has a single branch.
+            Updates::store(root, new_node);
         }
 
-        node->destroy();
-        update_mem_counter<count_mem,INode>(MemCounter::DELETE, node);
-        delete node;        
+        delete_inode(node);
         return;
     }
 
@@ -728,15 +1110,18 @@ public:
         ChildIdx idx = (ChildIdx)KeyInfo::extract_bits(key, shift, root->num_children_bits);
 
         INode* node = root;
-        INode* child = root->inodes[idx];
-        while(shift > 0 && node->is_internal[idx])            
+        follow_migration(node, idx, shift);
+        ChildPtr c = node->children[idx];
+        while(shift > 0 && is_inode(c))            
         {
+            INode* child = to_inode(c);
             shift -= child->num_children_bits + child->num_skipped;
             idx = (ChildIdx)KeyInfo::extract_bits(key, shift, child->num_children_bits);
             node = child;
-            child = node->inodes[idx];
+            follow_migration(node, idx, shift);
+            c = node->children[idx];
         }    
-        if(!child)
+        if(!c)
         {
             return 0;
         }
@@ -747,55 +1132,468 @@ public:
         }
         return 0; 
     }
+    // The readers. They don't look at the node structures or follow
+    // incremental expansions, so with CopyOnWriteUpdates any number of
+    // threads may call them while another updates the trie.
+    //
+    // The leaf key leads to, or 0 if it leads to an empty branch or a 
+    // path compression string that doesn't match.
+    Leaf* read_leaf(const KeyType& key) const
+    {
+        INode* node = Updates::load(root);
+        BitIdx shift = NUM_KEY_BITS - node->num_children_bits;
+        ChildPtr c = Updates::load(node->children[(ChildIdx)KeyInfo::extract_bits(key, shift, node->num_children_bits)]);
+        while(is_inode(c))
+        {
+            node = to_inode(c);
+            if(KeyInfo::extract_bits(key, shift - node->num_skipped, node->num_skipped) != node->skipped_bits)
+            {
+                return 0;
+            }
+            shift -= node->num_skipped + node->num_children_bits;
+            c = Updates::load(node->children[(ChildIdx)KeyInfo::extract_bits(key, shift, node->num_children_bits)]);
+        }
+        return reinterpret_cast<Leaf*>(c);
+    }
+    // The leaf key leads to if at_or_before(leaf), which says whether it 
+    // has anything at or before key, and otherwise the closest leaf before 
+    // it. 0 if there is none.
+    template <class LeafTest> Leaf* read_predecessor_leaf(const KeyType& key, LeafTest at_or_before) const
+    {
+        // Each node on the way down, and the branch taken from it.
+        INode* path[NUM_KEY_BITS];
+        ChildIdx path_idx[NUM_KEY_BITS];
+        int depth = 0;
+
+        INode* node = Updates::load(root);
+        BitIdx shift = NUM_KEY_BITS - node->num_children_bits;
+        ChildIdx idx = (ChildIdx)KeyInfo::extract_bits(key, shift, node->num_children_bits);
+        ChildPtr c = Updates::load(node->children[idx]);
+        while(is_inode(c))
+        {
+            INode* child = to_inode(c);
+            KeyType key_bits = KeyInfo::extract_bits(key, shift - child->num_skipped, child->num_skipped);
+            if(key_bits != child->skipped_bits)
+            {
+                // All of child's keys are on the same side of key.
+                Leaf* l = key_bits > child->skipped_bits ? read_last_leaf(c) : 0;
+                if(l)
+                {
+                    return l;
+                }
+                c = 0;
+                break;
+            }
+            shift -= child->num_skipped + child->num_children_bits;
+            path[depth] = node;
+            path_idx[depth++] = idx;
+            node = child;
+            idx = (ChildIdx)KeyInfo::extract_bits(key, shift, node->num_children_bits);
+            c = Updates::load(node->children[idx]);
+        }
+        if(c && at_or_before(reinterpret_cast<Leaf*>(c)))
+        {
+            return reinterpret_cast<Leaf*>(c);
+        }
+        // Otherwise it's the last leaf on a branch to the left of the
+        // way down.
+        while(true)
+        {
+            while(idx-- > 0)
+            {
+                Leaf* l = read_last_leaf(Updates::load(node->children[idx]));
+                if(l)
+                {
+                    return l;
+                }
+            }
+            if(!depth)
+            {
+                return 0;
+            }
+            depth--;
+            node = path[depth];
+            idx = path_idx[depth];
+        }
+    }
+    // The leaf with the largest key below the branch c, or 0 if there's none.
+    Leaf* read_last_leaf(ChildPtr c) const
+    {
+        while(is_inode(c))
+        {
+            INode* n = to_inode(c);
+            ChildIdx i = (ChildIdx)1 << n->num_children_bits;
+            c = 0;
+            while(!c && i-- > 0)
+            {
+                c = Updates::load(n->children[i]);
+            }
+        }
+        return reinterpret_cast<Leaf*>(c);
+    }
     typedef enum { FOUND_KEY = 0, FOUND_SUCC, FOUND_PRED } SearchStatus;
+    // The value of the leaf key leads to (FOUND_KEY), or failing that of
+    // the leaf with the closest key before (FOUND_PRED) or after it
+    // (FOUND_SUCC). The descent stops at an empty branch, a leaf, or an
+    // internal node whose skipped bits don't match the key's.
     ValueType* general_search(const KeyType& key, SearchStatus& status) const
     {
         BitIdx shift = NUM_KEY_BITS - root->num_children_bits;
         ChildIdx idx = (ChildIdx)KeyInfo::extract_bits(key, shift, root->num_children_bits);
 
         INode* node = root;
-        INode* child = root->inodes[idx];
-        while(shift > 0 && node->is_internal[idx])            
+        follow_migration(node, idx, shift);
+        ChildPtr c = node->children[idx];
+        while(shift > 0 && is_inode(c))            
         {
+            INode* child = to_inode(c);
+            if(KeyInfo::extract_bits(key, shift - child->num_skipped, child->num_skipped) != child->skipped_bits)
+            {
+                break;
+            }
             shift -= child->num_children_bits + child->num_skipped;
             idx = (ChildIdx)KeyInfo::extract_bits(key, shift, child->num_children_bits);
             node = child;
-            child = node->inodes[idx];
+            follow_migration(node, idx, shift);
+            c = node->children[idx];
         }    
+        return end_general_search(key, node, idx, shift, c, status);
+    }
+    // The most keys general_search_batch will take in one call.
+    static const unsigned int BATCH_SIZE = 16;
+
+    // As general_search for each of keys[0], .., keys[n - 1] (n <= BATCH_SIZE),
+    // but the descents are interleaved a level at a time. Each round every
+    // unfinished descent prefetches the node or child slot it needs next
+    // and then moves on to the next key, so the cache misses of the whole
+    // batch overlap instead of being taken one after the other.
+    //
+    // The leaves found are prefetched too, ready for the caller.
+    void general_search_batch(const KeyType* keys, unsigned int n, ValueType** results, SearchStatus* status) const
+    {
+        INode* nodes[BATCH_SIZE];
+        BitIdx shifts[BATCH_SIZE];
+        ChildIdx idxs[BATCH_SIZE];
+        ChildPtr cs[BATCH_SIZE];
+        unsigned int active[BATCH_SIZE];
+        unsigned int num_active = n;
+
+        for(unsigned int i = 0; i < n; i++)
+        {
+            shifts[i] = NUM_KEY_BITS - root->num_children_bits;
+            idxs[i] = (ChildIdx)KeyInfo::extract_bits(keys[i], shifts[i], root->num_children_bits);
+            nodes[i] = root;
+            follow_migration(nodes[i], idxs[i], shifts[i]);
+            active[i] = i;
+            __builtin_prefetch(&nodes[i]->children[idxs[i]]);
+        }
+        while(num_active)
+        {
+            // Read the child slots prefetched last round. Descents that
+            // reached a leaf or an empty slot are done, the rest prefetch
+            // the header of the child they're moving to.
+            unsigned int num_left = 0;
+            for(unsigned int j = 0; j < num_active; j++)
+            {
+                unsigned int i = active[j];
+                ChildPtr c = cs[i] = nodes[i]->children[idxs[i]];
+                if(shifts[i] > 0 && is_inode(c))
+                {
+                    __builtin_prefetch(to_inode(c));
+                    active[num_left++] = i;
+                }
+                else
+                {
+                    end_general_search_batch(keys[i], nodes[i], idxs[i], shifts[i], c, results[i], status[i]);
+                }
+            }
+            num_active = num_left;
+            // Now the headers are (hopefully) in cache: check each child's
+            // skipped bits, and where they match find the slot to follow
+            // in the child and prefetch that.
+            num_left = 0;
+            for(unsigned int j = 0; j < num_active; j++)
+            {
+                unsigned int i = active[j];
+                INode* child = to_inode(cs[i]);
+                if(KeyInfo::extract_bits(keys[i], shifts[i] - child->num_skipped, child->num_skipped) != child->skipped_bits)
+                {
+                    end_general_search_batch(keys[i], nodes[i], idxs[i], shifts[i], cs[i], results[i], status[i]);
+                    continue;
+                }
+                shifts[i] -= child->num_children_bits + child->num_skipped;
+                idxs[i] = (ChildIdx)KeyInfo::extract_bits(keys[i], shifts[i], child->num_children_bits);
+                nodes[i] = child;
+                follow_migration(nodes[i], idxs[i], shifts[i]);
+                __builtin_prefetch(&nodes[i]->children[idxs[i]]);
+                active[num_left++] = i;
+            }
+            num_active = num_left;
+        }
+        return;
+    }
+    // end_general_search for a descent of general_search_batch, prefetching
+    // the leaf found.
+    inline void end_general_search_batch(const KeyType& key, INode* node, ChildIdx idx, BitIdx shift, ChildPtr c, ValueType*& result, SearchStatus& status) const
+    {
+        result = end_general_search(key, node, idx, shift, c, status);
+        if(result)
+        {
+            __builtin_prefetch(result);
+        }
+        return;
+    }
+    // The end of general_search: the descent stopped at slot idx of node,
+    // holding c, with the branches below node found from shift up in the
+    // key. Returns 0 only when the trie is empty.
+    ValueType* end_general_search(const KeyType& key, INode* node, ChildIdx idx, BitIdx shift, ChildPtr c, SearchStatus& status) const
+    {
         status = FOUND_KEY;
-        if(!child)
+        if(shift > 0 && is_inode(c))
+        {
+            // The skipped bits of c didn't match, so all of its keys are on
+            // the same side of key: the closest is its largest or smallest.
+            INode* child = to_inode(c);
+            if(KeyInfo::extract_bits(key, shift - child->num_skipped, child->num_skipped) > child->skipped_bits)
+            {
+                status = FOUND_PRED;
+                return &(last_leaf_below(node, idx)->value);
+            }
+            status = FOUND_SUCC;
+            return &(first_leaf_below(node, idx)->value);
+        }
+        if(!c)
         {
-            ChildIdx i = node->closest_branch_before(idx);
-            if(i > static_cast<ChildIdx>(1 << node->num_children_bits))
+            INode* pred_node = node;
+            ChildIdx i = branch_before(pred_node, idx);
+            if(i > static_cast<ChildIdx>(1 << pred_node->num_children_bits))
             {
                 status = FOUND_SUCC;
                 // Stay left.
-                idx = node->closest_branch_after(idx);
-
-                while(node->is_internal[idx])
+                idx = branch_after(node, idx);
+                if(idx >= static_cast<ChildIdx>(1 << node->num_children_bits))
                 {
-                    node = node->inodes[idx];
-                    idx = node->first_branch();
+                    return 0;
+                }
+                while(node->is_internal(idx))
+                {
+                    node = node->get_inode(idx);
+                    idx = first_branch(node);
                 }
             }
             else
             {
                 status = FOUND_PRED;
                 // Stay right.
+                node = pred_node;
                 idx = i;
-                while(node->is_internal[idx])
+                while(node->is_internal(idx))
                 {
-                    node = node->inodes[idx];
-                    idx = node->first_branch();
+                    node = node->get_inode(idx);
+                    idx = last_branch(node);
                 }
             }
         }
         return &(node->leaves[idx]->value); 
     }
+    // If node is part way through an incremental expansion and the branch
+    // at idx hasn't been moved into it yet, go to that branch of the old node.
+    inline void follow_migration(INode*& node, ChildIdx& idx, BitIdx& shift) const
+    {
+        INode* old = node->migrating_from;
+        if(old && (idx >> min_children_bits) >= node->num_migrated)
+        {
+            node = old;
+            idx >>= min_children_bits;
+            shift += min_children_bits;
+        }
+        return;
+    }
+    // The branch searches used when looking for neighbours. A node part way
+    // through an expansion and its old node are searched as one node: all
+    // the new node's branches come before the old node's, so these may move
+    // node to the other of the two.
+    ChildIdx first_branch(INode*& node) const
+    {
+        INode* old = node->migrating_from;
+        if(old && !node->node_struct->get_num_set_bits())
+        {
+            node = old;
+        }
+        return node->first_branch();
+    }
+    ChildIdx last_branch(INode*& node) const
+    {
+        INode* old = node->migrating_from;
+        if(old && old->node_struct->get_num_set_bits())
+        {
+            node = old;
+        }
+        return node->last_branch();
+    }
+    bool has_branch_before(INode* node, ChildIdx idx) const
+    {
+        INode* n = node->migrating_to;
+        return node->has_branch_before(idx) || (n && n->node_struct->get_num_set_bits());
+    }
+    ChildIdx branch_before(INode*& node, ChildIdx idx) const
+    {
+        INode* n = node->migrating_to;
+        if(n && !node->has_branch_before(idx) && n->node_struct->get_num_set_bits())
+        {
+            node = n;
+            return n->last_branch();
+        }
+        return node->closest_branch_before(idx);
+    }
+    ChildIdx branch_after(INode*& node, ChildIdx idx) const
+    {
+        INode* old = node->migrating_from;
+        if(old && !node->has_branch_after(idx) && old->node_struct->get_num_set_bits())
+        {
+            node = old;
+            return old->first_branch();
+        }
+        return node->closest_branch_after(idx);
+    }
 
-    
+    // The leaves with the largest and smallest keys below branch idx of node.
+    Leaf* last_leaf_below(INode* node, ChildIdx idx) const
+    {
+        while(node->is_internal(idx))
+        {
+            node = node->get_inode(idx);
+            idx = last_branch(node);
+        }
+        return node->leaves[idx];
+    }
+    Leaf* first_leaf_below(INode* node, ChildIdx idx) const
+    {
+        while(node->is_internal(idx))
+        {
+            node = node->get_inode(idx);
+            idx = first_branch(node);
+        }
+        return node->leaves[idx];
+    }
+    // The leaf closest to the empty branch idx of node from among node's
+    // other branches, and whether it's before idx. 0 if there are none.
+    Leaf* neighbour_in_node(INode* node, ChildIdx idx, bool& is_pred) const
+    {
+        if(has_branch_before(node, idx))
+        {
+            is_pred = true;
+            ChildIdx i = branch_before(node, idx);
+            return last_leaf_below(node, i);
+        }
+        is_pred = false;
+        ChildIdx i = branch_after(node, idx);
+        if(i >= static_cast<ChildIdx>(1 << node->num_children_bits))
+        {
+            return 0;
+        }
+        return first_leaf_below(node, i);
+    }
     // This function returns the largest key less than or equal to the supplied key (key).
     bool find_predecessor(const KeyType& key, KeyType& pred_key, ValueType& pred_value) const
+    {
+        Leaf* l = predecessor_leaf(key);
+        if(!l)
+        {
+            return false;
+        }
+        pred_key = l->key;
+        pred_value = l->value;
+        return true;
+    }
+    // As find_predecessor for each of keys[0], .., keys[n - 1] (n <= BATCH_SIZE),
+    // with the descents interleaved as in general_search_batch. results[i]
+    // points at the predecessor's value, or is 0 if keys[i] has none.
+    //
+    // A descent that stops prefetches the leaf it stopped at, and the
+    // predecessors are only worked out from there once all have stopped.
+    void find_predecessor_batch(const KeyType* keys, unsigned int n, ValueType** results) const
+    {
+        INode* nodes[BATCH_SIZE];
+        BitIdx shifts[BATCH_SIZE];
+        ChildIdx idxs[BATCH_SIZE];
+        ChildPtr cs[BATCH_SIZE];
+        KeyType key_bits[BATCH_SIZE];
+        INode* pred_ancestors[BATCH_SIZE];
+        ChildIdx idxs_at_ancestor[BATCH_SIZE];
+        unsigned int active[BATCH_SIZE];
+        unsigned int num_active = n;
+
+        for(unsigned int i = 0; i < n; i++)
+        {
+            shifts[i] = NUM_KEY_BITS - root->num_children_bits;
+            idxs[i] = (ChildIdx)KeyInfo::extract_bits(keys[i], shifts[i], root->num_children_bits);
+            nodes[i] = root;
+            follow_migration(nodes[i], idxs[i], shifts[i]);
+            key_bits[i] = 0;
+            pred_ancestors[i] = 0;
+            idxs_at_ancestor[i] = 0;
+            active[i] = i;
+            __builtin_prefetch(&nodes[i]->children[idxs[i]]);
+        }
+        while(num_active)
+        {
+            // Read the child slots prefetched last round and note the
+            // branches before them. Descents that reached the bottom, a
+            // leaf or an empty slot stop, the rest prefetch the header of
+            // the child they're moving to.
+            unsigned int num_left = 0;
+            for(unsigned int j = 0; j < num_active; j++)
+            {
+                unsigned int i = active[j];
+                ChildPtr c = cs[i] = nodes[i]->children[idxs[i]];
+                if(shifts[i] > 0 && has_branch_before(nodes[i], idxs[i]))
+                {
+                    pred_ancestors[i] = nodes[i];
+                    idxs_at_ancestor[i] = idxs[i];
+                }
+                if(shifts[i] > 0 && is_inode(c))
+                {
+                    __builtin_prefetch(to_inode(c));
+                    active[num_left++] = i;
+                }
+                else if(c)
+                {
+                    __builtin_prefetch(nodes[i]->leaves[idxs[i]]);
+                }
+            }
+            num_active = num_left;
+            // Now the headers are (hopefully) in cache: check each child's
+            // skipped bits, and where they match find the slot to follow
+            // in the child and prefetch that.
+            num_left = 0;
+            for(unsigned int j = 0; j < num_active; j++)
+            {
+                unsigned int i = active[j];
+                INode* child = to_inode(cs[i]);
+                key_bits[i] = KeyInfo::extract_bits(keys[i], shifts[i] - child->num_skipped, child->num_skipped);
+                if(key_bits[i] != child->skipped_bits)
+                {
+                    continue;
+                }
+                shifts[i] -= child->num_children_bits + child->num_skipped;
+                idxs[i] = (ChildIdx)KeyInfo::extract_bits(keys[i], shifts[i], child->num_children_bits);
+                nodes[i] = child;
+                follow_migration(nodes[i], idxs[i], shifts[i]);
+                __builtin_prefetch(&nodes[i]->children[idxs[i]]);
+                active[num_left++] = i;
+            }
+            num_active = num_left;
+        }
+        for(unsigned int i = 0; i < n; i++)
+        {
+            Leaf* l = end_predecessor_leaf(keys[i], nodes[i], idxs[i], shifts[i], cs[i], key_bits[i], pred_ancestors[i], idxs_at_ancestor[i]);
+            results[i] = l ? &(l->value) : 0;
+        }
+        return;
+    }
+    // The leaf with the largest key <= key, or 0 if there's none.
+    Leaf* predecessor_leaf(const KeyType& key) const
     {
         // First, find the deepest internal node that has a branch to a predecessor
         // of key.        
@@ -809,15 +1607,17 @@ public:
         // (i.e. when shift == 0 or we're at a leaf) or
         // when the path compression bits don't match the key's bits.
         INode* node = root;
-        INode* child = root->inodes[idx];
+        follow_migration(node, idx, shift);
+        ChildPtr c = node->children[idx];
+        INode* child = to_inode(c); // Only meaningful if is_inode(c)
         while(shift > 0)
         {
-            if(node->has_branch_before(idx))
+            if(has_branch_before(node, idx))
             {
                 pred_ancestor = node;
                 idx_at_ancestor = idx;
             }
-            if(!node->is_internal[idx])
+            if(!is_inode(c))
             {
                 break;
             }
@@ -829,9 +1629,19 @@ public:
             shift -= child->num_children_bits + child->num_skipped;            
             idx = (ChildIdx)KeyInfo::extract_bits(key, shift, child->num_children_bits);
             node = child;
-            child = node->inodes[idx];
+            follow_migration(node, idx, shift);
+            c = node->children[idx];
+            child = to_inode(c);
         }
-        if(!shift || !node->is_internal[idx])
+        return end_predecessor_leaf(key, node, idx, shift, c, key_bits, pred_ancestor, idx_at_ancestor);
+    }
+    // The end of predecessor_leaf: the descent stopped at slot idx of node,
+    // holding c, with key_bits the key's bits where c's skipped bits are
+    // (if c is an internal node whose skipped bits didn't match).
+    Leaf* end_predecessor_leaf(const KeyType& key, INode* node, ChildIdx idx, BitIdx shift, ChildPtr c, KeyType key_bits, INode* pred_ancestor, ChildIdx idx_at_ancestor) const
+    {
+        INode* child = to_inode(c); // Only meaningful if is_inode(c)
+        if(!shift || !is_inode(c))
         {
             // If we're in here then node has a leaf at idx
             // or a null-branch.
@@ -840,18 +1650,16 @@ public:
             {
                 // The predecessor is sitting at the leaf,
                 // and we're all done.
-                pred_key = node->leaves[idx]->key;
-                pred_value = node->leaves[idx]->value;
-                return true;
+                return node->leaves[idx];
             }
-            else if(node->has_branch_before(idx))            
+            else if(has_branch_before(node, idx))            
             {
+                idx = branch_before(node, idx);
                 pred_ancestor = node;
-                idx = node->closest_branch_before(idx);
             }
             else if(pred_ancestor)
             {
-                idx = pred_ancestor->closest_branch_before(idx_at_ancestor);
+                idx = branch_before(pred_ancestor, idx_at_ancestor);
             }
         }
         else if(key_bits > child->skipped_bits)
@@ -860,29 +1668,26 @@ public:
         }
         else if(key_bits < child->skipped_bits && pred_ancestor)
         {
-            idx = pred_ancestor->closest_branch_before(idx_at_ancestor);
+            idx = branch_before(pred_ancestor, idx_at_ancestor);
         }
         if(!pred_ancestor)
         {
-            return false;
+            return 0;
         }
         node = pred_ancestor;
         if(idx >= static_cast<ChildIdx>(1 << node->num_children_bits))
         {
             // Deal with the special case where the trie is just the
             // root with 0 or 1 children.
-            return false;
+            return 0;
         }
-        while(node->is_internal[idx])
+        while(node->is_internal(idx))
         {            
-            node = node->inodes[idx];
-            idx = node->last_branch();
+            node = node->get_inode(idx);
+            idx = last_branch(node);
         }
-        // now we have the leaf, tidy up and we're done.
-        Leaf* l = node->leaves[idx];
-        pred_key = l->key;
-        pred_value = l->value;
-        return true; 
+        // now we have the leaf, and we're done.
+        return node->leaves[idx];
     }
     void print(std::ostream& out)
     {
@@ -894,11 +1699,16 @@ public:
         {
             INode* n = worklist.front();
             worklist.pop_front();
+            if(n->migrating_from)
+            {
+                out << hex << "\"" << n << " (" << (int) n->num_children_bits << ")\" -> \"" << n->migrating_from << "\"[style=dashed];" << endl;
+                worklist.push_back(n->migrating_from);
+            }
             for(int i = 0; i < (1 << n->num_children_bits); i++)
             {
-                if(n->is_internal[i])
+                if(n->is_internal(i))
                 {
-                    INode* child = n->inodes[i];
+                    INode* child = n->get_inode(i);
                     out << hex << "\"" << n << " (" << (int) n->num_children_bits << ")\" -> \"" << child << "\"[label=\"" << i << "(" << dec << (int) child->num_skipped << ", " << hex << (int) child->skipped_bits << ")\"];" << endl;
                     worklist.push_back(child);
                 }
@@ -921,23 +1731,25 @@ public:
         {
             INode* n = worklist.front();
             worklist.pop_front();
+            if(n->migrating_from)
+            {
+                worklist.push_back(n->migrating_from);
+            }
             for(int i = 0; i < (1 << n->num_children_bits); i++)
             {
-                if(n->is_internal[i])
+                if(n->is_internal(i))
                 {
-                    INode* child = n->inodes[i];
+                    INode* child = n->get_inode(i);
                     worklist.push_back(child);
                 }
                 else if(n->leaves[i])
                 {
-                    update_mem_counter<count_mem,Leaf>(MemCounter::DELETE, n->leaves[i]);
                     delete n->leaves[i];
                 }
             }
-            n->destroy();
-            update_mem_counter<count_mem,INode>(MemCounter::DELETE, n);
-            delete n;
+            delete_inode(n);
         }
+        expansions.clear();
         return;
     }
     int get_min_children_bits() { return min_children_bits; }
@@ -54,6 +54,7 @@ template <bool count_mem = false> class HeapBitSearcher
     unsigned int heap_height;
     void** ptrs;
     bool* or_heap;
+    bool owns_heap;
 public:
     static const unsigned int NO_PRED = 0xFFFFFFFF;
     static const unsigned int NO_SUCC = 0x7FFFFFFF;
@@ -61,7 +62,7 @@ public:
     unsigned int min_idx;
     unsigned int max_idx;
     unsigned int num_set_bits;
-    HeapBitSearcher(void** ptrs, unsigned int radix) : num_bits(1 << radix), heap_height(radix + 1), ptrs(ptrs), min_idx(num_bits), max_idx(0), num_set_bits(0)
+    HeapBitSearcher(void** ptrs, unsigned int radix) : num_bits(1 << radix), heap_height(radix + 1), ptrs(ptrs), owns_heap(true), min_idx(num_bits), max_idx(0), num_set_bits(0)
     {
         unsigned int heap_size = num_bits; // Not num_bits - 1, since we use 1-based indexing
         or_heap = new bool[heap_size];
@@ -70,6 +71,15 @@ public:
         memset(or_heap, 0, heap_size * sizeof(*or_heap));
         return;
     }
+    // As above, but the OR-heap lives in storage_size(radix) bytes
+    // supplied (and later freed) by the caller.
+    HeapBitSearcher(void** ptrs, unsigned int radix, void* storage) : num_bits(1 << radix), heap_height(radix + 1), ptrs(ptrs), owns_heap(false), min_idx(num_bits), max_idx(0), num_set_bits(0)
+    {
+        or_heap = static_cast<bool*>(storage);
+        memset(or_heap, 0, num_bits * sizeof(*or_heap));
+        return;
+    }
+    static unsigned int storage_size(unsigned int radix) { return (1 << radix) * sizeof(bool); }
     inline void set_bit(unsigned int bit_idx)
     {
         unsigned int idx = parent(num_bits + bit_idx);
@@ -78,6 +88,11 @@ public:
             or_heap[idx] = 1;
             idx = parent(idx);
         }
+        if(!num_set_bits++)
+        {
+            // The extrema may be left over from an emptied heap.
+            min_idx = max_idx = bit_idx;
+        }
         if(bit_idx < min_idx) 
         {
             min_idx = bit_idx;
@@ -90,11 +105,20 @@ public:
     }   
     inline void unset_bit(unsigned int bit_idx)
     {
-        unsigned int idx = parent(num_bits + bit_idx);
-        while(idx)
-        {            
-            or_heap[idx] = 0;
+        // Clear ancestors only while the other half of their subtree
+        // is empty too. The pointer at bit_idx may not have been
+        // cleared yet, so it is never consulted.
+        unsigned int idx = num_bits + bit_idx;
+        while(idx > 1 && !get_heap_bit(idx ^ 1))
+        {
             idx = parent(idx);
+            or_heap[idx] = 0;
+        }
+        if(!--num_set_bits)
+        {
+            min_idx = num_bits;
+            max_idx = 0;
+            return;
         }
         if(bit_idx == min_idx)
         {
@@ -226,8 +250,11 @@ public:
 
     ~HeapBitSearcher()
     {
-        update_mem_counter<count_mem,bool>(MemCounter::DELETE, or_heap);
-        delete[] or_heap;
+        if(owns_heap)
+        {
+            update_mem_counter<count_mem,bool>(MemCounter::DELETE, or_heap);
+            delete[] or_heap;
+        }
         return;
     }
 };
@@ -22,6 +22,15 @@ public:
         max_idx = 0;
         return;
     }
+    // No auxiliary storage is needed, so storage is ignored.
+    LinearBitSearcher(void** ptrs, int size_bits, void*) : bits(ptrs), num_set_bits(0)
+    {
+        size = 1 << size_bits;
+        min_idx = size - 1;
+        max_idx = 0;
+        return;
+    }
+    static unsigned int storage_size(int) { return 0; }
     inline void set_bit(int idx)
     {
  //       bits[idx] = true;
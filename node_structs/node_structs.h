@@ -5,6 +5,7 @@
 #include <node_structs/linear_bit_searcher.h>
 #include <node_structs/sqrt_bit_searcher.h>
 #include <node_structs/heap_bit_searcher.h>
+#include <node_structs/summary_bit_searcher.h>
 
 
 #endif
@@ -22,8 +22,9 @@ public:
     unsigned int num_set_bits;
     unsigned int num_counters, size;
     unsigned short* counters;
+    bool owns_counters;
 //public:
-    SqrtBitSearcher(void** ptrs, int size_bits) : bits(ptrs), num_set_bits(0)
+    SqrtBitSearcher(void** ptrs, int size_bits) : bits(ptrs), num_set_bits(0), owns_counters(true)
     {        
         size = 1 << size_bits;
 
@@ -38,6 +39,22 @@ public:
         max_idx = 0;
         return;
     }
+    // As above, but the counters live in storage_size(size_bits) bytes
+    // supplied (and later freed) by the caller.
+    SqrtBitSearcher(void** ptrs, int size_bits, void* storage) : bits(ptrs), num_set_bits(0), owns_counters(false)
+    {        
+        size = 1 << size_bits;
+
+        shift = size_bits >> 1;
+        num_counters = 1 << shift;
+        
+        counters = static_cast<unsigned short*>(storage);
+        memset(counters, 0, num_counters * sizeof(*counters));
+        min_idx = size - 1;
+        max_idx = 0;
+        return;
+    }
+    static unsigned int storage_size(int size_bits) { return (1 << (size_bits >> 1)) * sizeof(unsigned short); }
     inline void set_bit(unsigned int idx)
     {
         //if(!bits[idx])
@@ -159,9 +176,12 @@ public:
     unsigned int get_num_set_bits() { return num_set_bits; }
     ~SqrtBitSearcher()
     {
-        delete [] counters;
-        //used_memory -= size;
-        update_mem_counter<count_mem,unsigned short>(MemCounter::DELETE, counters);
+        if(owns_counters)
+        {
+            delete [] counters;
+            //used_memory -= size;
+            update_mem_counter<count_mem,unsigned short>(MemCounter::DELETE, counters);
+        }
         return;
     }
 };
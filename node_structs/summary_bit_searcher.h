@@ -0,0 +1,259 @@
+#if !defined __SUMMARY_BIT_SEARCHER_H
+
+#define __SUMMARY_BIT_SEARCHER_H
+
+#include <cstring>
+#include <count_alloc/count_alloc.h>
+
+// A drop in replacement for HeapBitSearcher. Rather than an OR-heap of
+// bools, the set bits are kept in a bitmap of 64-bit words, summarised
+// by a hierarchy of further bitmaps: bit i of level l + 1 is set iff word
+// i of level l is non-zero. A pred/succ then looks at one word per level
+// (using count leading/trailing zeros) on the way up and again on the
+// way down, so it takes O(log_64 radix) steps rather than O(radix).
+//
+// The bitmaps use just over a bit per child, against a byte per child
+// for the OR-heap.
+template <bool count_mem = false> class SummaryBitSearcher
+{
+    typedef unsigned long long Word;
+    static const unsigned int WORD_BITS_LOG = 6;
+    static const unsigned int WORD_BITS = 1 << WORD_BITS_LOG;
+    static const unsigned int MAX_LEVELS = 6; // Enough for 2^32 children
+
+    unsigned int num_bits;
+    void** ptrs;
+    Word* words;
+    unsigned int num_levels;
+    unsigned int level_start[MAX_LEVELS]; // Where each level begins in words
+    bool owns_words;
+
+    static inline unsigned int num_words(unsigned int n) { return (n + WORD_BITS - 1) >> WORD_BITS_LOG; }
+    static unsigned int total_words(unsigned int radix)
+    {
+        unsigned int n = 1 << radix;
+        unsigned int total = 0;
+        do
+        {
+            n = num_words(n);
+            total += n;
+        } while(n > 1);
+        return total;
+    }
+    void init_levels()
+    {
+        unsigned int n = num_bits;
+        unsigned int start = 0;
+        num_levels = 0;
+        do
+        {
+            level_start[num_levels++] = start;
+            n = num_words(n);
+            start += n;
+        } while(n > 1);
+        return;
+    }
+    inline Word& word(unsigned int level, unsigned int idx) { return words[level_start[level] + (idx >> WORD_BITS_LOG)]; }
+    inline static Word bit(unsigned int idx) { return (Word)1 << (idx & (WORD_BITS - 1)); }
+public:
+    static const unsigned int NO_PRED = 0xFFFFFFFF;
+    static const unsigned int NO_SUCC = 0x7FFFFFFF;
+
+    unsigned int min_idx;
+    unsigned int max_idx;
+    unsigned int num_set_bits;
+    SummaryBitSearcher(void** ptrs, unsigned int radix) : num_bits(1 << radix), ptrs(ptrs), owns_words(true), min_idx(num_bits), max_idx(0), num_set_bits(0)
+    {
+        unsigned int size = total_words(radix);
+        words = new Word[size];
+        update_mem_counter<count_mem,Word>(MemCounter::NEW, words, size);
+        memset(words, 0, size * sizeof(*words));
+        init_levels();
+        return;
+    }
+    // As above, but the bitmaps live in storage_size(radix) bytes
+    // supplied (and later freed) by the caller.
+    SummaryBitSearcher(void** ptrs, unsigned int radix, void* storage) : num_bits(1 << radix), ptrs(ptrs), owns_words(false), min_idx(num_bits), max_idx(0), num_set_bits(0)
+    {
+        words = static_cast<Word*>(storage);
+        memset(words, 0, total_words(radix) * sizeof(*words));
+        init_levels();
+        return;
+    }
+    static unsigned int storage_size(unsigned int radix) { return total_words(radix) * sizeof(Word); }
+    inline void set_bit(unsigned int bit_idx)
+    {
+        // Set the bit at each level until we reach a word
+        // that was already non-zero (so is already summarised).
+        unsigned int idx = bit_idx;
+        for(unsigned int l = 0; l < num_levels; l++)
+        {
+            Word& w = word(l, idx);
+            Word old = w;
+            w |= bit(idx);
+            if(old)
+            {
+                break;
+            }
+            idx >>= WORD_BITS_LOG;
+        }
+        if(!num_set_bits++)
+        {
+            min_idx = max_idx = bit_idx;
+        }
+        if(bit_idx < min_idx)
+        {
+            min_idx = bit_idx;
+        }
+        if(bit_idx > max_idx)
+        {
+            max_idx = bit_idx;
+        }
+        return;
+    }
+    inline void unset_bit(unsigned int bit_idx)
+    {
+        // Clear the bit at each level until a word stays non-zero.
+        unsigned int idx = bit_idx;
+        for(unsigned int l = 0; l < num_levels; l++)
+        {
+            Word& w = word(l, idx);
+            w &= ~bit(idx);
+            if(w)
+            {
+                break;
+            }
+            idx >>= WORD_BITS_LOG;
+        }
+        if(!--num_set_bits)
+        {
+            min_idx = num_bits;
+            max_idx = 0;
+            return;
+        }
+        if(bit_idx == min_idx)
+        {
+            min_idx = succ(min_idx);
+        }
+        if(bit_idx == max_idx)
+        {
+            max_idx = pred(max_idx);
+        }
+        return;
+    }
+    unsigned int succ(unsigned int bit_idx)
+    {
+        // Go up until some word has a set bit after our position in it...
+        unsigned int idx = bit_idx;
+        unsigned int l = 0;
+        Word w = 0;
+        for(; l < num_levels; l++)
+        {
+            // Two shifts, as shifting by 64 isn't defined.
+            w = word(l, idx) & ((~(Word)0 << (idx & (WORD_BITS - 1))) << 1);
+            if(w)
+            {
+                break;
+            }
+            idx >>= WORD_BITS_LOG;
+        }
+        if(l == num_levels)
+        {
+            return NO_SUCC;
+        }
+        idx = (idx & ~(WORD_BITS - 1)) + __builtin_ctzll(w);
+        // ...then down, taking the first set bit each time.
+        while(l--)
+        {
+            idx = (idx << WORD_BITS_LOG) + __builtin_ctzll(words[level_start[l] + idx]);
+        }
+        return idx;
+    }
+    unsigned int pred(unsigned int bit_idx)
+    {
+        // As succ, with everything mirrored.
+        unsigned int idx = bit_idx;
+        unsigned int l = 0;
+        Word w = 0;
+        for(; l < num_levels; l++)
+        {
+            w = word(l, idx) & (bit(idx) - 1);
+            if(w)
+            {
+                break;
+            }
+            idx >>= WORD_BITS_LOG;
+        }
+        if(l == num_levels)
+        {
+            return NO_PRED;
+        }
+        idx = (idx & ~(WORD_BITS - 1)) + (WORD_BITS - 1 - __builtin_clzll(w));
+        while(l--)
+        {
+            idx = (idx << WORD_BITS_LOG) + (WORD_BITS - 1 - __builtin_clzll(words[level_start[l] + idx]));
+        }
+        return idx;
+    }
+    void rebuild()
+    {
+        // The bottom level straight from the pointers...
+        unsigned int n = num_words(num_bits);
+        num_set_bits = 0;
+        for(unsigned int i = 0; i < n; i++)
+        {
+            Word w = 0;
+            unsigned int end = num_bits < WORD_BITS ? num_bits : WORD_BITS;
+            void** p = ptrs + (i << WORD_BITS_LOG);
+            for(unsigned int j = 0; j < end; j++)
+            {
+                w |= (Word)(p[j] != 0) << j;
+            }
+            words[i] = w;
+            num_set_bits += __builtin_popcountll(w);
+        }
+        // ...and each summary from the level below.
+        for(unsigned int l = 1; l < num_levels; l++)
+        {
+            Word* below = words + level_start[l - 1];
+            unsigned int m = num_words(n);
+            memset(words + level_start[l], 0, m * sizeof(*words));
+            for(unsigned int i = 0; i < n; i++)
+            {
+                words[level_start[l] + (i >> WORD_BITS_LOG)] |= (Word)(below[i] != 0) << (i & (WORD_BITS - 1));
+            }
+            n = m;
+        }
+        if(!num_set_bits)
+        {
+            min_idx = num_bits;
+            max_idx = 0;
+            return;
+        }
+        min_idx = (words[0] & 1) ? 0 : succ(0);
+        max_idx = pred(num_bits - 1);
+        if(word(0, num_bits - 1) & bit(num_bits - 1))
+        {
+            max_idx = num_bits - 1;
+        }
+        return;
+    }
+    inline bool is_empty() { return max_idx < min_idx; }
+    bool has_pred(unsigned int idx) { return idx > min_idx; }
+    bool has_succ(unsigned int idx) { return idx < max_idx; }
+    unsigned int get_min_idx() { return min_idx; }
+    unsigned int get_max_idx() { return max_idx; }
+    unsigned int get_num_set_bits() { return num_set_bits; }
+
+    ~SummaryBitSearcher()
+    {
+        if(owns_words)
+        {
+            update_mem_counter<count_mem,Word>(MemCounter::DELETE, words);
+            delete[] words;
+        }
+        return;
+    }
+};
+
+#endif
@@ -7,11 +7,14 @@
 #include <node_structs/node_structs.h>
 #include <qtrie/qtrie.h>
 
-template <class KeyType, class ValueType, bool count_mem = false> class LPCQTrie
+// Nodes, leaves and buckets are allocated through Alloc (see slab_alloc.h).
+// BucketT is SortedBucket, or ForBucket to store integer keys compressed.
+// With ValueType = void it's a set (see ValueTypeInfo), and SortedBucket
+// stores no values.
+template <class KeyType, class ValueType, bool count_mem = false, class Alloc = SlabAlloc<>, template <class, class, bool, class> class BucketT = SortedBucket> class LPCQTrie
 {
-    static const int MAX_BUCKET_SIZE = 128;
-
-    typedef SortedBucket<KeyType, ValueType, count_mem> Bucket; 
+    typedef BucketT<KeyType, ValueType, count_mem, Alloc> Bucket; 
+    typedef typename ValueTypeInfo<KeyType, ValueType>::Value Value;
 /*
     typedef LPCTrie<KeyType, Bucket*, SqrtBitSearcher<count_mem > > LPCTrie_sqrt;
     typedef QTrie<KeyType, ValueType, LPCTrie_sqrt, Bucket, count_mem> LPCQTrie_internal;
@@ -19,32 +22,76 @@ template <class KeyType, class ValueType, bool count_mem = false> class LPCQTrie
     LPCQTrie_internal* lpcqtrie;
     LPCTrie_sqrt* lpctrie;
 */    
-    typedef LPCTrie<KeyType, Bucket*, HeapBitSearcher<count_mem > > LPCTrie_heap;
-    typedef QTrie<KeyType, ValueType, LPCTrie_heap, Bucket, count_mem> LPCQTrie_internal;
+    typedef LPCTrie<KeyType, Bucket*, SummaryBitSearcher<count_mem >, count_mem, true, Alloc> LPCTrie_summary;
+    typedef QTrie<KeyType, Value, LPCTrie_summary, Bucket, count_mem> LPCQTrie_internal;
     
     LPCQTrie_internal* lpcqtrie;
-    LPCTrie_heap* lpctrie;
+    LPCTrie_summary* lpctrie;
 public:
-    LPCQTrie()
+    typedef typename LPCQTrie_internal::Iterator Iterator;
+
+    // A non-zero expand_slice makes node expansion incremental (see LPCTrie).
+    // finger suits sorted or clustered inserts (see QTrie). sizer picks the
+    // number of keys at which buckets split (see BucketSizer).
+    explicit LPCQTrie(unsigned int expand_slice = 0, bool finger = false, const BucketSizer<KeyType>& sizer = BucketSizer<KeyType>())
+    {
+        lpctrie = new LPCTrie_summary(4, 20, 0.75f, 0.25f, expand_slice);
+        lpcqtrie = new LPCQTrie_internal(*lpctrie, sizer, finger);
+        return;
+    }
+    // Fixes the bucket size, or with adaptive has it chosen from size up.
+    void set_bucket_size(int size, bool adaptive = false)
     {
-        lpctrie = new LPCTrie_heap(4, 20, 0.75f, 0.25f);
-        lpcqtrie = new LPCQTrie_internal(*lpctrie, MAX_BUCKET_SIZE);
+        lpcqtrie->set_bucket_size(size, adaptive);
         return;
     }
-    void insert(const KeyType& key, const ValueType& value)
+    void insert(const KeyType& key, const Value& value)
     {
         lpcqtrie->insert(key, value);        
         return;
     }
-    ValueType* locate(const KeyType& key)
+    // For a set.
+    void insert(const KeyType& key)
+    {
+        static_assert(ValueTypeInfo<KeyType, ValueType>::IS_SET, "insert(key) is for sets, which have ValueType void");
+        lpcqtrie->insert(key, key);
+        return;
+    }
+    Value* locate(const KeyType& key)
     {
         return lpcqtrie->locate(key);
     }
+    void locate_batch(const KeyType* keys, size_t n, Value** out)
+    {
+        lpcqtrie->locate_batch(keys, n, out);
+        return;
+    }
     void remove(const KeyType& key)
     {
         lpcqtrie->remove(key);
         return;
     }
+    // In-order iteration (see BucketIterator). Any insert or remove
+    // invalidates an Iterator.
+    Iterator first()
+    {
+        return lpcqtrie->first();
+    }
+    Iterator last()
+    {
+        return lpcqtrie->last();
+    }
+    // At the smallest key >= key.
+    Iterator lower_bound(const KeyType& key)
+    {
+        return lpcqtrie->lower_bound(key);
+    }
+    // callback(key, value) for every key in [lo, hi], in order.
+    template <class Callback> void scan(const KeyType& lo, const KeyType& hi, Callback callback)
+    {
+        lpcqtrie->scan(lo, hi, callback);
+        return;
+    }
     ~LPCQTrie()
     {
         delete lpctrie;
@@ -4,35 +4,121 @@
 
 #include <bucket_structs/bucket_structs.h>
 #include <count_alloc/count_alloc.h>
+#include <limits>
 
 template <class KeyType, class ValueType, class TopStruct, class Bucket, bool mem_count = false> class QTrie
 {
     static const int INITIAL_BUCKET_SIZE = 2;
     TopStruct& top_struct;
+    BucketSizer<KeyType> sizer;
     Bucket* min_bucket;
+    // In finger mode, the bucket the last insert went to, and the range of
+    // keys the top structure sends to it: from finger_lo (none for
+    // min_bucket) up to, not including, finger_hi (none for the last
+    // bucket). That's the next bucket's key in the top structure, which is
+    // only looked up once it's needed. Removing any bucket drops the finger.
+    bool use_finger;
+    Bucket* finger;
+    KeyType finger_lo, finger_hi;
+    bool finger_has_lo, finger_hi_known;
+
+    // Whether key is in the finger's range, as far as is known.
+    inline bool finger_holds(const KeyType& key) const
+    {
+        return finger && !(finger_has_lo && key < finger_lo) && (!finger->next || (finger_hi_known && key < finger_hi));
+    }
+    // The bucket whose range of keys holds key.
+    inline Bucket* find_bucket(const KeyType& key)
+    {
+        if(finger_holds(key))
+        {
+            return finger;
+        }
+        Bucket* b;
+        KeyType k;
+        if(top_struct.find_predecessor(key, k, b))
+        {
+            return b;
+        }
+        return min_bucket;
+    }
+    // As find_bucket, but leaving the finger (if used) on the bucket found.
+    // The next bucket's key in the top structure is at most its smallest
+    // key, so past that the finger's range can't hold key; short of it, the
+    // key is looked up to settle it.
+    inline Bucket* find_bucket_moving_finger(const KeyType& key)
+    {
+        if(!use_finger)
+        {
+            return find_bucket(key);
+        }
+        if(finger_holds(key))
+        {
+            return finger;
+        }
+        if(finger && !(finger_has_lo && key < finger_lo) && !finger_hi_known && key < finger->next->get_min_key())
+        {
+            Bucket* b;
+            top_struct.find_predecessor(finger->next->get_min_key(), finger_hi, b);
+            finger_hi_known = true;
+            if(key < finger_hi)
+            {
+                return finger;
+            }
+        }
+        finger_has_lo = top_struct.find_predecessor(key, finger_lo, finger);
+        if(!finger_has_lo)
+        {
+            finger = min_bucket;
+        }
+        finger_hi_known = false;
+        return finger;
+    }
 public:
-    QTrie(TopStruct& top_struct, int max_bucket_size) : top_struct(top_struct)
+    // With use_finger, inserts start from the bucket the last one went to
+    // when key is in its range, rather than from the top structure, so
+    // sorted or clustered inserts each cost about one bucket insert. Locates
+    // and searches also try the finger, but don't move it.
+    QTrie(TopStruct& top_struct, const BucketSizer<KeyType>& sizer, bool use_finger = false) : top_struct(top_struct), sizer(sizer), use_finger(use_finger), finger(0)
     {
-        min_bucket = new Bucket(INITIAL_BUCKET_SIZE, max_bucket_size);
-        update_mem_counter<mem_count,Bucket>(MemCounter::NEW, min_bucket);
+        min_bucket = new Bucket(INITIAL_BUCKET_SIZE, sizer.size());
+        return;
+    }
+    // Buckets split at the new size from their next insert on.
+    void set_bucket_size(int size, bool adaptive = false)
+    {
+        sizer.set(size, adaptive);
         return;
     }
     bool insert(const KeyType& key, const ValueType& value)
     {
         using namespace BucketData;
-        Bucket* pred_bucket = 0;
-        KeyType pred_key;
-        if(!top_struct.find_predecessor(key, pred_key, pred_bucket))
-        {
-            pred_bucket = min_bucket;
-        }
+        Bucket* pred_bucket = find_bucket_moving_finger(key);
+        pred_bucket->set_max_capacity(sizer.size());
+        sizer.note_insert();
         if(pred_bucket->insert(key, value) == INSERT_FILLED)
         {
+            sizer.note_full(pred_bucket->get_min_key(), pred_bucket->get_key(pred_bucket->num_elems - 1), pred_bucket->num_elems);
             // Add a new representative key and split the pred_bucket
             pred_bucket->sort();
             Bucket* b = pred_bucket->split();
             const KeyType& k = b->get_min_key();
             top_struct.insert(k, b);
+            // Keep the finger on key's half: k divides their ranges.
+            if(finger == pred_bucket)
+            {
+                if(key < k)
+                {
+                    finger_hi = k;
+                    finger_hi_known = true;
+                }
+                else
+                {
+                    finger = b;
+                    finger_lo = k;
+                    finger_has_lo = true;
+                }
+            }
 
             // Insert b into the linked list of buckets:
             //
@@ -55,9 +141,17 @@ public:
             if(min_bucket->remove(key) && !min_bucket->num_elems && min_bucket->next)
             {            
                 Bucket* next = min_bucket->next;
-                update_mem_counter<mem_count,Bucket>(MemCounter::DELETE, min_bucket);
+                finger = 0;
                 delete min_bucket;
-                top_struct.remove(next->get_min_key());
+                // next's key in the top structure is its smallest key when
+                // it was split off, which may since have been removed. It's
+                // still there, so the predecessor search always finds it.
+                KeyType next_key;
+                Bucket* b;
+                if(top_struct.find_predecessor(next->get_min_key(), next_key, b))
+                {
+                    top_struct.remove(next_key);
+                }
                 next->prev = 0;
                 min_bucket = next;
             }
@@ -65,6 +159,7 @@ public:
         else if(pred_bucket->remove(key) && !pred_bucket->num_elems)
         {
             top_struct.remove(pred_key);
+            finger = 0;
             pred_bucket->prev->next = pred_bucket->next;
             if(pred_bucket->next)
             {
@@ -76,29 +171,65 @@ public:
     }
     ValueType* search(const KeyType& key)
     {
-        Bucket* b;
-        KeyType k;
-        if(top_struct.find_predecessor(key, k, b))
-        {
-            return b->search(key);
-        }
-        return min_bucket->search(key);
+        sizer.note_locates();
+        return find_bucket(key)->search(key);
     }
 
     ValueType* locate(const KeyType& key)
     {
-        Bucket* b;
-        KeyType k;
-        if(top_struct.find_predecessor(key, k, b))
+        sizer.note_locates();
+        return find_bucket(key)->locate_with_list(key);
+    }
+    // out[i] = locate(keys[i]) for i = 0, .., n - 1. The top structure's
+    // predecessor searches for a batch of keys are interleaved, and the
+    // buckets found are then prefetched together before being searched.
+    void locate_batch(const KeyType* keys, size_t n, ValueType** out)
+    {
+        static const unsigned int BATCH_SIZE = TopStruct::BATCH_SIZE;
+        Bucket** leaf_values[BATCH_SIZE];
+        Bucket* buckets[BATCH_SIZE];
+
+        sizer.note_locates(n);
+        for(size_t first = 0; first < n; first += BATCH_SIZE)
         {
-            ValueType* v = b->search(key);
-            if(!v)
+            unsigned int m = n - first < BATCH_SIZE ? n - first : BATCH_SIZE;
+            top_struct.find_predecessor_batch(keys + first, m, leaf_values);
+            for(unsigned int i = 0; i < m; i++)
+            {
+                buckets[i] = leaf_values[i] ? *leaf_values[i] : min_bucket;
+                __builtin_prefetch(buckets[i]);
+            }
+            for(unsigned int i = 0; i < m; i++)
+            {
+                buckets[i]->prefetch(true);
+            }
+            for(unsigned int i = 0; i < m; i++)
             {
-                return b->prev->values + b->num_elems - 1;
+                out[first + i] = buckets[i]->locate_with_list(keys[first + i]);
             }
-            return v;
-        }        
-       return min_bucket->search(key);
+        }
+        return;
+    }
+    typedef BucketIterator<KeyType, ValueType, Bucket> Iterator;
+
+    Iterator first()
+    {
+        return Iterator::first(min_bucket);
+    }
+    Iterator last()
+    {
+        return Iterator::last(find_bucket(std::numeric_limits<KeyType>::max()));
+    }
+    // At the smallest key >= key.
+    Iterator lower_bound(const KeyType& key)
+    {
+        return Iterator::lower_bound(find_bucket(key), key);
+    }
+    // callback(key, value) for every key in [lo, hi], in order.
+    template <class Callback> void scan(const KeyType& lo, const KeyType& hi, Callback callback)
+    {
+        lower_bound(lo).scan(hi, callback);
+        return;
     }
     ~QTrie()
     {
@@ -106,7 +237,6 @@ public:
         while(b)
         {
             Bucket* n = b->next;
-            update_mem_counter<mem_count,Bucket>(MemCounter::DELETE, b);
             delete b;
             b = n;
         }
@@ -3,39 +3,151 @@
 #define __STDMAP
 
 #include <map>
+#include <set>
 #include <iostream>
 
-template <class KeyType, class ValueType> class STDMap
+#include <key_utils/key_utils.h>
+
+// The std::map behind an STDMap, or for a set (ValueType = void, see
+// ValueTypeInfo) a std::set, whose keys are their own values.
+template <class KeyType, class ValueType> class STDMapStore
 {
-    std::map<KeyType, ValueType>* m;
 public:
-    STDMap()
+    typedef std::map<KeyType, ValueType> Map;
+    static inline const KeyType& key(typename Map::iterator it)
     {
-        m = new std::map<KeyType,ValueType>;
+        return it->first;
     }
-    void insert(const KeyType& key, const ValueType& value)
+    static inline ValueType& value(typename Map::iterator it)
+    {
+        return it->second;
+    }
+    static inline void insert(Map* m, const KeyType& key, const ValueType& value)
     {
         (*m)[key] = value;
         return;
     }
-    ValueType* locate(const KeyType& key)
+};
+
+template <class KeyType> class STDMapStore<KeyType, void>
+{
+public:
+    typedef std::set<KeyType> Map;
+    static inline const KeyType& key(typename Map::iterator it)
+    {
+        return *it;
+    }
+    // std::set only hands out const keys.
+    static inline KeyType& value(typename Map::iterator it)
+    {
+        return const_cast<KeyType&>(*it);
+    }
+    static inline void insert(Map* m, const KeyType& key, const KeyType&)
+    {
+        m->insert(key);
+        return;
+    }
+};
+
+template <class KeyType, class ValueType> class STDMap
+{
+    typedef STDMapStore<KeyType, ValueType> Store;
+    typedef typename Store::Map Map;
+    typedef typename Map::iterator MapIterator;
+    typedef typename ValueTypeInfo<KeyType, ValueType>::Value Value;
+    Map* m;
+public:
+    // The same in-order iteration as the tries give.
+    class Iterator
     {
-        typename std::map<KeyType,ValueType>::iterator it = m->find(key);
-        if((*it).first != key)
+        MapIterator it;
+        Map* m;
+    public:
+        Iterator(MapIterator it, Map* m) : it(it), m(m) {}
+        inline bool valid() const
+        {
+            return it != m->end();
+        }
+        inline const KeyType& key() const
+        {
+            return Store::key(it);
+        }
+        inline Value& value() const
+        {
+            return Store::value(it);
+        }
+        inline void next()
+        {
+            ++it;
+            return;
+        }
+        inline void prev()
         {
             if(it == m->begin())
             {
-                return 0;
+                it = m->end();
+            }
+            else
+            {
+                --it;
             }
-            --it;
-        }        
-        return &((*it).second);
+            return;
+        }
+    };
+    STDMap()
+    {
+        m = new Map;
+    }
+    void insert(const KeyType& key, const Value& value)
+    {
+        Store::insert(m, key, value);
+        return;
+    }
+    // For a set.
+    void insert(const KeyType& key)
+    {
+        static_assert(ValueTypeInfo<KeyType, ValueType>::IS_SET, "insert(key) is for sets, which have ValueType void");
+        Store::insert(m, key, key);
+        return;
+    }
+    // The value of the largest key <= key (0 if there's none).
+    Value* locate(const KeyType& key)
+    {
+        MapIterator it = m->upper_bound(key);
+        if(it == m->begin())
+        {
+            return 0;
+        }
+        --it;
+        return &Store::value(it);
     }
     void remove(const KeyType& key)
     {
         m->erase(key);
         return;
     }
+    Iterator first()
+    {
+        return Iterator(m->begin(), m);
+    }
+    Iterator last()
+    {
+        return Iterator(m->empty() ? m->end() : --m->end(), m);
+    }
+    // At the smallest key >= key.
+    Iterator lower_bound(const KeyType& key)
+    {
+        return Iterator(m->lower_bound(key), m);
+    }
+    // callback(key, value) for every key in [lo, hi], in order.
+    template <class Callback> void scan(const KeyType& lo, const KeyType& hi, Callback callback)
+    {
+        for(MapIterator it = m->lower_bound(lo); it != m->end() && !(hi < Store::key(it)); ++it)
+        {
+            callback(Store::key(it), Store::value(it));
+        }
+        return;
+    }
     ~STDMap()
     {
         delete m;
@@ -25,21 +25,22 @@
 
 #include "allocator.h"
 
-typedef int Type; // Element type stored in doubly-linked list
-                 // will be templatized later
-
-//typedef unsigned long Type;
+typedef unsigned long long Type; // Element type stored in doubly-linked list
+                                 // wide enough for 64 bit keys
 
 class Dnode {
     Type   info;
     Dnode *left;
     Dnode *right;
+    // room for a value of up to 64 bits next to the key, left to the user
+    alignas(Type) unsigned char value[sizeof(Type)];
 public:
     Dnode()          : info(0), left(0), right(0) {}
     Dnode(Type x)    : info(x), left(0), right(0) {}
     Type   getinfo()  { return info; }
     Dnode* getleft()  { return left; }
     Dnode* getright() { return right; }
+    void*  getvalue() { return value; }
     void   setinfo(  Type   x) { info  = x; }
     void   setleft(  Dnode* n) { left  = n; }
     void   setright( Dnode* n) { right = n; }
@@ -51,8 +52,9 @@ public:
 class Dlist {
     Dnode *leftend;
     Dnode *rightend;
+    Dnode *newnode; // made by the last insertleft/insertright
 public:
-    Dlist() : leftend(0), rightend(0) {};
+    Dlist() : leftend(0), rightend(0), newnode(0) {};
     ~Dlist();
 
     int    isempty()  { return leftend == 0;}
@@ -68,6 +70,8 @@ public:
     Type removeright(Dnode *p);
     Type removeleft(Dnode *p);
     Type remove(Dnode *p);
+    // the node made by insertleft/insertright since the last call, or 0
+    Dnode *takenewnode() { Dnode *p = newnode; newnode = 0; return p; }
     int find(Type x);
     void printDebug( std::ostream& out = std::cerr);
 
@@ -133,6 +137,7 @@ inline void Dlist::insertleft(Type x, Dnode *p) {
         r->setright(q);
     else
         leftend = q;
+    newnode = q;
 }
 
 inline void Dlist::insertright(Type x, Dnode *p) {
@@ -152,6 +157,7 @@ inline void Dlist::insertright(Type x, Dnode *p) {
         r->setleft(q);
     else
         rightend = q;
+    newnode = q;
 }
 
 inline Type Dlist::removefirst() {
@@ -53,7 +53,7 @@
 #define REPEAT_END }
 
 
-typedef int Type; 
+typedef unsigned long long Type;
 
 inline unsigned my_rand(void) {
     static unsigned rand;
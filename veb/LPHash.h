@@ -4,6 +4,7 @@
 #include <iostream>
 #include <cassert>
 #include <algorithm>
+#include <memory>
 #include "allocator.h"
 
 // The hash function is a static 256 bytes array initialized automatically
@@ -84,9 +85,9 @@ typename LPHash<T,Alloc>::Elem_allocator LPHash<T,Alloc>::m_alloc;
 // Intialize hash table to arraySize == 4
 template <class T, class Alloc> inline 
 void LPHash<T,Alloc>::init() {
-    // we assume here silently that we have a POD and skip m_alloc.construct()
+    // value-initialized: empty slots hold T(), the handles need not be PODs
     table = m_alloc.allocate( 1);
-    std::memset( table, 0, sizeof( Elem));
+    std::uninitialized_fill( table, table + 1, Elem());
     shiftVal  = 6; 
     arraySize = 4;
     size      = 0;
@@ -109,9 +110,8 @@ void LPHash<T,Alloc>::doubleSize() {
     shiftVal--;
     Elem *oldTable;
     oldTable = table; 
-    // we assume here silently that we have a POD and skip m_alloc.construct()
     table = m_alloc.allocate( arraySize >> 2);
-    std::memset( table, 0, sizeof( Elem) * (arraySize >> 2));
+    std::uninitialized_fill( table, table + (arraySize >> 2), Elem());
     size = 0;
     for ( int i=0; i<(arraySize>>1); i++) { // copy old to new table
         T tmp = oldTable[i>>2].item[i&3];
@@ -130,9 +130,8 @@ void LPHash<T,Alloc>::halfSize() {
     shiftVal++;
     Elem *oldTable;
     oldTable = table; 
-    // we assume here silently that we have a POD and skip m_alloc.construct()
     table = m_alloc.allocate( arraySize>>2);
-    std::memset( table, 0, sizeof( Elem) * (arraySize >> 2));
+    std::uninitialized_fill( table, table + (arraySize >> 2), Elem());
     size = 0;
     for ( int i=0; i<(arraySize<<1); i++) { // copy old to new table
         T tmp = oldTable[i>>2].item[i&3];
@@ -13,7 +13,9 @@
 // $Date: $
 //
 // The top level data structure, i.e., the public interface of our sorted
-// list data structure.
+// list data structure. It takes the 16 most significant bits of a Key, the
+// Handles below it the rest: LVL2Handle for 32 bit keys, the LVLNHandle
+// levels of LVLNTree.h for 64 bit keys.
 // ============================================================================
 
 #ifndef MAP32_LVL1TREE_H
@@ -21,39 +23,59 @@
 
 #include <cstring>
 #include <iostream>
+#include <memory>
 
 #include "Dlist.h"
 #include "LVL2Tree.h"
+#include "LVLNTree.h"
 #include "Top1.h"
 #include "allocator.h"
 
 
-typedef int Type;
+typedef unsigned long long Type;
 
 
-class LVL1Tree {
+template <class Key, class Handle>
+class LVL1TreeT {
+    // shift to the 16 bit key for this level
+    static const int SHIFT = 8 * sizeof( Key) - 16;
 public:     
     unsigned int minKey;        
     unsigned int maxKey;
  
-    LVL2Handle max; 			      
-    LVL2Handle min;						
+    Handle max; 			      
+    Handle min;						
     Top1 top;
-    LVL2Handle bot[65536];	
+    // The 65536 Handles below, in blocks of 256 which are only allocated
+    // (zeroed) once a key falls into them, so small trees stay small.
+    Handle* blocks[256];
     Dlist D;
 
+    Handle& bot( unsigned int aPos) { return blocks[aPos>>8][aPos&255]; }
 
-    LVL1Tree();
 
-    void insert(Type,unsigned int);
-    void del(unsigned int);
-    Dnode* locateNode(unsigned int);
+    LVL1TreeT();
+    ~LVL1TreeT();
+
+    Dnode* insert(Type,Key);
+    void del(Key);
+    Dnode* locateNode(Key);
 
     void printDebugTable( std::ostream& out = std::cerr);
     void printDebugList(  std::ostream& out = std::cerr);
+
+private:
+    void allocBlock( unsigned int);
+
+    static default_allocator<Handle> block_alloc;
 };
 
-inline LVL1Tree::LVL1Tree() {           
+// Definition of the static allocator variable
+template <class Key, class Handle>
+default_allocator<Handle> LVL1TreeT<Key,Handle>::block_alloc;
+
+template <class Key, class Handle>
+inline LVL1TreeT<Key,Handle>::LVL1TreeT() {           
     D.insertfirst(0); 
     D.insertlast(0);             
     minKey = 0xffffffff;                
@@ -63,67 +85,101 @@ inline LVL1Tree::LVL1Tree() {
     // min = 0; 
     // faster than:   for(int i=0;i<65536;i++) bot[i]=0;        
     // std::memset( bot, 0, 65536 * sizeof(LVL2Handle));
+    // and now only the block pointers, the blocks come with the keys
+    std::memset( blocks, 0, 256 * sizeof(Handle*));
+}
+
+// Allocates the block of Handles b, all null
+template <class Key, class Handle>
+inline void LVL1TreeT<Key,Handle>::allocBlock( unsigned int b) {
+    // value-initialized, the 64 bit handles are not PODs
+    blocks[b] = block_alloc.allocate( 256);
+    std::uninitialized_fill( blocks[b], blocks[b] + 256, Handle());
 }
 
-// Insert in level 1
-/*inline*/ void LVL1Tree::insert(Type listItem,unsigned int key) {
-    unsigned int aPos = key >> 16;
-    if ( bot[aPos].isNull()) { // new LVL2Tree
+// Frees the levels below, the list frees its nodes itself
+template <class Key, class Handle>
+inline LVL1TreeT<Key,Handle>::~LVL1TreeT() {
+    for ( int b=0;b<256;b++) {
+        if ( blocks[b] == 0)
+            continue;
+        for ( int i=0;i<256;i++)
+            blocks[b][i].destroy();
+        block_alloc.deallocate( blocks[b], 256);
+    }
+}
+
+// Insert in level 1, returns the list node of key, new or not
+template <class Key, class Handle>
+/*inline*/ Dnode* LVL1TreeT<Key,Handle>::insert(Type listItem,Key key) {
+    unsigned int aPos = key >> SHIFT;
+    if ( blocks[aPos>>8] == 0)
+        allocBlock( aPos>>8);
+    if ( bot(aPos).isNull()) { // new LVL2Tree
         if(!top.isEmpty()) { // max and min are set
             unsigned int next = top.findN(aPos);                       
             // Notice: bot[aPos]=0, i.e., aPos!=maxKey
             if ( aPos<maxKey) { // successor found with findN
                 if ( aPos<minKey) {
-                    bot[aPos] = LVL2Handle(listItem,key,D,min.minx());
-                    min = bot[aPos];
+                    bot(aPos) = Handle(listItem,key,D,min.minx());
+                    min = bot(aPos);
                     minKey = aPos;	
                 } else {
                     if ( next < 0xffffffff)
-                        bot[aPos] = LVL2Handle(listItem,key,D,
-                                               bot[next].minx());
+                        bot(aPos) = Handle(listItem,key,D,
+                                               bot(next).minx());
                     else
-                        bot[aPos] = LVL2Handle(listItem,key,D,D.lastnode());
+                        bot(aPos) = Handle(listItem,key,D,D.lastnode());
                 }
             } else { // no successor found with findN
                 Dnode *tmp = D.lastnode();      
-                bot[aPos] = LVL2Handle(listItem,key,D,tmp);
-                max = bot[aPos]; // new max
+                bot(aPos) = Handle(listItem,key,D,tmp);
+                max = bot(aPos); // new max
                 maxKey = aPos;
             }    
         } else { // empty tree
-            max = LVL2Handle(listItem,key,D,D.lastnode());             
+            max = Handle(listItem,key,D,D.lastnode());             
             min = max; 
-            bot[aPos]= max;    
-            minKey = key>>16;                
+            bot(aPos)= max;    
+            minKey = aPos;                    
             maxKey = minKey;  
         }
     } else {   // subtree exists already
-        bot[aPos].insert(listItem,key,D);  
+        bot(aPos).insert(listItem,key,D);  
+        // min and max are copies of the handles, which can change
+        if ( aPos == minKey)
+            min = bot(aPos);
+        if ( aPos == maxKey)
+            max = bot(aPos);
     }
     assert(aPos<=maxKey);
     assert(aPos>=minKey);
     top.insert(aPos);  // update top structure  
+    Dnode* node = D.takenewnode();
+    return node ? node : locateNode(key); // key was there already
 }
 
 // Delete in level 1
-inline void LVL1Tree::del(unsigned int key) {
-    unsigned int aPos = key >> 16;
-    if ( bot[aPos].isTree()) { // nothing to do if there is no subtree
-        bot[aPos].del(key,D);    
-        if(bot[aPos].isNull()) { // has the subtree been removed?
+template <class Key, class Handle>
+inline void LVL1TreeT<Key,Handle>::del(Key key) {
+    unsigned int aPos = key >> SHIFT;
+    // nothing to do if there is no subtree
+    if ( blocks[aPos>>8] != 0 && bot(aPos).isTree()) {
+        bot(aPos).del(key,D);    
+        if(bot(aPos).isNull()) { // has the subtree been removed?
             top.del(aPos);         
         }
         if(!top.isEmpty()) {
             unsigned int tmp = top.maxMin();  
             minKey = tmp & 0x0000ffff;
             maxKey = tmp >> 16;
-            min = bot[minKey];
-            max = bot[maxKey];
+            min = bot(minKey);
+            max = bot(maxKey);
         } else { // empty tree
             minKey = 0xffffffff;   
             maxKey = 0xffffffff;
-            min = LVL2Handle();
-            max = LVL2Handle();
+            min = Handle();
+            max = Handle();
         }
     }
 }
@@ -131,25 +187,26 @@ inline void LVL1Tree::del(unsigned int key) {
 using namespace std;
 
 // search in level 1
-/*inline*/ Dnode* LVL1Tree::locateNode(unsigned int key) {
-    unsigned int aPos = key >> 16;
+template <class Key, class Handle>
+/*inline*/ Dnode* LVL1TreeT<Key,Handle>::locateNode(Key key) {
+    unsigned int aPos = key >> SHIFT;
     if((aPos<maxKey)&(maxKey!=0xffffffff)){     // sure find
         //cout << "In here1\n";
         unsigned int next = top.findN(aPos);
         if(next==aPos)                            // Next > aPos ?
-            return bot[next].locateNode(key);   // recursion
+            return bot(next).locateNode(key);   // recursion
         else
-            return bot[next].minx();                 //min->min;
+            return bot(next).minx();                 //min->min;
     } else {
         if((aPos==maxKey)&(maxKey!=0xffffffff)){ // difficult case
         //cout << "In here2: aPos = " << aPos << ", maxKey = " << maxKey << endl;
 
             // reconstruct largest key
-            unsigned int globalMax = max.maxKeyx();
+            Key globalMax = max.maxKeyx();
             //cout << "globalMax = " << globalMax << endl;
             if(key<=globalMax){
                 unsigned int next = top.findN(aPos);
-                return bot[next].locateNode(key);
+                return bot(next).locateNode(key);
             }	
         }
     }
@@ -159,9 +216,12 @@ using namespace std;
 }
 
 // debug printout of the table
-void LVL1Tree::printDebugTable( std::ostream& out) {
+template <class Key, class Handle>
+void LVL1TreeT<Key,Handle>::printDebugTable( std::ostream& out) {
     for ( int i=0;i<65536;i++){
-        LVL2Handle tm = bot[i]; 
+        if ( blocks[i>>8] == 0)
+            continue;
+        Handle tm = bot(i); 
         if ( tm.isTree()){
             out << "LVL1-Entry at:" << i << std::endl;
             tm.printDebugHash( out);
@@ -171,15 +231,20 @@ void LVL1Tree::printDebugTable( std::ostream& out) {
 }
 
 // debug printout of the Dlist
-void LVL1Tree::printDebugList( std::ostream& out) {
+template <class Key, class Handle>
+void LVL1TreeT<Key,Handle>::printDebugList( std::ostream& out) {
     out << std::endl;
     Dnode *tmp=D.firstnode();
     while ( tmp!=D.lastnode()){
         tmp = tmp->getright();
-        out << ";" << (unsigned int)tmp->getinfo() << std::endl;
+        out << ";" << (Key)tmp->getinfo() << std::endl;
     }    
     out << std::endl;
 }
 
+// The sorted list for 32 bit keys, and for 64 bit keys.
+typedef LVL1TreeT< unsigned int, LVL2Handle > LVL1Tree;
+typedef LVL1TreeT< Key64, LVL64Handle >       LVL1Tree64;
+
 #endif // MAP32_LVL1TREE_H
 
@@ -29,8 +29,8 @@
 #include "Dlist.h"
 #include "allocator.h"
 
-typedef int Type; // Element type stored in doubly-linked list
-                  // will be templatized later
+typedef unsigned long long Type; // Element type stored in doubly-linked list
+                                 // wide enough for 64 bit keys
 
 class LVL2Tree {
 public:
@@ -47,6 +47,7 @@ public:
     void insert(Type,unsigned int, Dlist&);
     bool del(unsigned int, Dlist&);
     Dnode* locateNode(unsigned int);
+    void destroy();
 
     void printDebugHash( std::ostream& out = std::cerr);
 
@@ -125,7 +126,17 @@ inline void LVL2Tree::insert(Type listItem,unsigned int key, Dlist& D) {
         top.insert(midKey);              // update top
     } else if (((unsigned char)nextKey) == midKey){  // no new tree
         // search correct subtree and insert element
-        bot.find(midKey)->insert(listItem,key,D);
+        LVL3Handle* sub = bot.find(midKey);
+        sub->insert(listItem,key,D);
+        // the element can still be a new maxx or minx
+        if ( key > maxKeyx) {
+            maxx = sub->max();
+            maxKeyx = key;
+        }
+        if ( key < minKeyx) {
+            minx = sub->min();
+            minKeyx = key;
+        }
     } else if ( midKey <minKey) { // new min found
         LVL3Handle min = LVL3Handle(listItem,key,D,minx);
         minx = minx->getleft();
@@ -173,26 +184,29 @@ inline bool LVL2Tree::del(unsigned int key, Dlist& D) {
     unsigned char maxKey = iTmp >> 8;
     if ( maxKey == minKey) { // one LVL3Tree left, maybe needs to collapse
         LVL3Handle max = *(bot.find(maxKey));
-        minKeyx = (key & 0xffffff00)|(max.minKey());
+        // the list items are the keys; maxKey need not be the middle
+        // 8 bits of key
         minx = max.min();
-        maxKeyx = (key & 0xffffff00)|(max.maxKey());
+        minKeyx = minx->getinfo();
         maxx = max.max();
+        maxKeyx = maxx->getinfo();
         if ( minKeyx == maxKeyx) { // one element left in LVL3Tree, collapse it
-            max.del( maxKey, D); // replaces max.free(); 
+            // the LVL3Handle holds it directly, nothing to free there
             bot.destroy();
             return true;
         }
     } else {
+        // the old minx or maxx node may be gone already, so take the new
+        // ones from the LVL3Handles
         if ( key==minKeyx) { // Update min-max-nodes. Move? later ...
             LVL3Handle min = *(bot.find(minKey));
-            // assemble new key
-            minKeyx = (key & 0xffffff00)|(min.minKey());
-            minx = minx->getright();
+            minx = min.min();
+            minKeyx = minx->getinfo();
         }
         if ( key==maxKeyx) {
             LVL3Handle max = *(bot.find(maxKey));
-            maxKeyx = (key & 0xffffff00)|(max.maxKey());
-            maxx = maxx->getleft();
+            maxx = max.max();
+            maxKeyx = maxx->getinfo();
         }
     }
     return false;
@@ -214,6 +228,16 @@ inline Dnode* LVL2Tree::locateNode(unsigned int key) {
     return maxx->getright(); // max->max->getright();
 }
 
+// Frees the LVL3Trees and the hash table, not the list nodes
+inline void LVL2Tree::destroy() {
+    for ( unsigned int k = top.findN(0); k < 1000;
+          k = ( k < 255) ? top.findN(k+1) : 1000) {
+        LVL3Handle sub = *(bot.find(k)); // the table must keep its entries
+        sub.destroy();
+    }
+    bot.destroy();
+}
+
 void LVL2Tree::printDebugHash( std::ostream& out) {
     if ( bot.isInitialized()){
         for ( int i=0;i<256;i++){
@@ -270,6 +294,9 @@ public:
         return ptr()->maxKeyx;
     }
 
+    bool operator==( LVL2Handle p) const { return tree == p.tree; }
+    bool operator!=( LVL2Handle p) const { return tree != p.tree; }
+
     void insert(Type  listItem,unsigned int key, Dlist& D) {
         assert( isTree());
         if ( bit()) {
@@ -310,6 +337,19 @@ public:
             }
         }
     }
+    // frees the LVL2Tree and those below it, not its list nodes
+    void destroy() {
+        if ( isTree() && ! bit()) {
+            ptr()->destroy();
+#ifndef USE_LEDA_MEMORY
+            lvl2_alloc.destroy( ptr());
+            lvl2_alloc.deallocate( ptr(),1);
+#else
+            delete ptr();
+#endif
+        }
+        tree = 0;
+    }
     Dnode* locateNode(unsigned int key) {
         assert( isTree());
         if ( bit()) {
@@ -321,6 +361,8 @@ public:
         return ptr()->locateNode(key);
     }
     LVL2Handle() : tree(0) {}
+    // wraps an element already in the list
+    explicit LVL2Handle( Dnode* node) { set_node( node); }
     LVL2Handle( Type listItem,unsigned int key,Dlist& D,Dnode *next) {
         D.insertleft(listItem,next);  // store element in the list
         // deferred creation and insertion, store the node pointer only
@@ -28,8 +28,8 @@
 #include "Dlist.h"
 #include "allocator.h"
 
-typedef int Type; // Element type stored in doubly-linked list
-                  // will be templatized later
+typedef unsigned long long Type; // Element type stored in doubly-linked list
+                                 // wide enough for 64 bit keys
 
 class LVL3Tree {  
 public:
@@ -272,6 +272,19 @@ public:
             }
         }
     }
+    // frees the LVL3Tree, not its list nodes
+    void destroy() {
+        if ( isTree() && ! bit()) {
+            ptr()->bot.destroy();
+#ifndef USE_LEDA_MEMORY
+            lvl3_alloc.destroy( ptr());
+            lvl3_alloc.deallocate( ptr(),1);
+#else
+            delete ptr();
+#endif
+        }
+        tree = 0;
+    }
     Dnode* locateNode(unsigned char x) {
         assert( isTree());
         if ( bit()) {
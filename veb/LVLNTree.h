@@ -0,0 +1,299 @@
+// ============================================================================
+// LVLNTree.h
+//
+// The middle levels for 64 bit keys and their handle class, a generalization
+// of LVL2Tree.h. A LVLNTree<SHIFT,Sub> is a stratified tree on the 8 bits of
+// the key from bit SHIFT up: a Top23 on top and the Sub handles of the level
+// below in an LPHash. As for LVL2Handle, the LVLNHandle stores a direct
+// pointer to the list entry while only one element is stored below it, so
+// the levels are only allocated once two keys share them. The list items are
+// the keys themselves, so min and max keys are read off the min and max list
+// nodes rather than stored.
+//
+// Below the last LVLNTree (bits 16 to 23) the LVL2Tree takes over. It only
+// sees the low 32 bits of a key, which is enough since all keys under one
+// LVL2Handle agree on the rest.
+// ============================================================================
+
+#ifndef MAP32_LVLNTREE_H
+#define MAP32_LVLNTREE_H
+
+#include <iostream>
+
+#include "LVL2Tree.h"
+#include "LPHash.h"
+#include "Top23.h"
+#include "Dlist.h"
+#include "allocator.h"
+
+typedef unsigned long long Key64;
+
+template <int SHIFT, class Sub>
+class LVLNTree {
+public:
+    Dnode *maxx;           // direct list pointer for min and max
+    Dnode *minx;
+    LPHash< Sub > bot;     // manage the next level in a hash table
+    Top23 top;
+
+    LVLNTree( Dnode* node) : maxx( node), minx( node) {}
+    void insert_2nd(Type,Key64, Dlist&);
+    void insert(Type,Key64, Dlist&);
+    bool del(Key64, Dlist&);
+    Dnode* locateNode(Key64);
+    void destroy();
+
+    // the key for the hash table of this level
+    static unsigned char midKey( Key64 key) { return key >> SHIFT; }
+    static Key64 keyOf( Dnode* p) { return p->getinfo(); }
+
+#ifdef USE_LEDA_MEMORY
+    LEDA_MEMORY(LVLNTree);
+#endif
+};
+
+// Adds second key after the constructor has been called
+// Precond: the LVLNTree contains exactly one element
+template <int SHIFT, class Sub> inline
+void LVLNTree<SHIFT,Sub>::insert_2nd(Type listItem,Key64 key, Dlist& D) {
+    assert( keyOf( minx) != key); // key differs from the one element stored
+    unsigned char newKey = midKey( key);
+    unsigned char oldKey = midKey( keyOf( minx));
+    Sub old( minx);               // re-wrap the original element
+    bot.init();                   // create hash table
+    if ( newKey == oldKey) {      // insert both in the level below
+        old.insert( listItem, key, D);
+        maxx = old.maxx();
+        minx = old.minx();
+    } else {
+        bool isMin = key < keyOf( minx);
+        Dnode *next = isMin ? minx : minx->getright();
+        Sub sub( listItem, key, D, next);
+        if ( isMin)
+            minx = next->getleft();
+        else
+            maxx = next->getleft();
+        top.insert( newKey);
+        bot.insert( sub, newKey);
+    }
+    top.insert( oldKey);
+    bot.insert( old, oldKey);
+}
+
+// Precond: the LVLNTree contains already two elements
+template <int SHIFT, class Sub> inline
+void LVLNTree<SHIFT,Sub>::insert(Type listItem,Key64 key, Dlist& D) {
+    unsigned char newKey = midKey( key);
+    assert( bot.isInitialized());
+    unsigned int nextKey = top.findNext( newKey);
+    if ( nextKey == 1000) { // new local maximum found
+        Dnode *next = maxx->getright();  // since inserting left of next!
+        Sub max( listItem, key, D, next);
+        maxx = next->getleft();
+        bot.insert( max, newKey);
+        top.insert( newKey);
+    } else if ( ((unsigned char)nextKey) == newKey) { // no new subtree
+        // the handle is updated in place in the hash table
+        Sub* sub = bot.find( newKey);
+        sub->insert( listItem, key, D);
+        // the element can still be a new maxx or minx
+        if ( key > keyOf( maxx))
+            maxx = sub->maxx();
+        if ( key < keyOf( minx))
+            minx = sub->minx();
+    } else if ( newKey < midKey( keyOf( minx))) { // new min found
+        Sub min( listItem, key, D, minx);
+        minx = minx->getleft();
+        bot.insert( min, newKey);
+        top.insert( newKey);
+    } else { // new subtree between min and max
+        Dnode *next = bot.find( nextKey)->minx();
+        Sub tmp( listItem, key, D, next);
+        bot.insert( tmp, newKey);
+        top.insert( newKey);
+    }
+}
+
+// Removes the element 'key' from the tree
+// Precond: at least two elements in LVLNTree.
+// Returns true if only one element is left in this LVLNTree, whose hash
+// table is then gone already.
+template <int SHIFT, class Sub> inline
+bool LVLNTree<SHIFT,Sub>::del(Key64 key, Dlist& D) {
+    assert( bot.isInitialized());
+    unsigned char oldKey = midKey( key);
+    Sub* tmp = bot.find( oldKey);
+    if ( tmp == 0) // no entry found for key, nothing happens
+        return false;
+    // delete on a copy: the hash table must never hold the 0 handle
+    Sub sub = *tmp;
+    sub.del( key, D);
+    if ( sub.isNull()) { // subtree is empty
+        bot.remove( oldKey);
+        top.del( oldKey);
+    } else {
+        *tmp = sub;
+    }
+    // one subtree must remain
+    assert( !top.isEmpty());
+    unsigned int iTmp = top.maxMin();  // update min and max
+    minx = bot.find( iTmp & 255)->minx();
+    maxx = bot.find( iTmp >> 8)->maxx();
+    if ( minx == maxx) { // one element left, held directly by its handle
+        bot.destroy();
+        return true;
+    }
+    return false;
+}
+
+// Find list node of the next element >= key
+template <int SHIFT, class Sub> inline
+Dnode* LVLNTree<SHIFT,Sub>::locateNode(Key64 key) {
+    unsigned char findKey = midKey( key);
+    if ( findKey <= midKey( keyOf( maxx))) {
+        unsigned int next = top.findN( findKey);
+        Sub* sub = bot.find( next);
+        if ( ((unsigned char)next) == findKey)
+            return sub->locateNode( key);
+        return sub->minx();
+    }
+    return maxx->getright();
+}
+
+// Frees the levels below and the hash table, not the list nodes
+template <int SHIFT, class Sub> inline
+void LVLNTree<SHIFT,Sub>::destroy() {
+    for ( unsigned int k = top.findN(0); k < 1000;
+          k = ( k < 255) ? top.findN(k+1) : 1000) {
+        Sub sub = *(bot.find(k)); // the table must keep its entries
+        sub.destroy();
+    }
+    bot.destroy();
+}
+
+
+// ==========================================================================
+
+// The LVLNHandle encapsulates a pointer to a LVLNTree, as the LVL2Handle
+// does to a LVL2Tree: a single key does not create a tree.
+template <int SHIFT, class Sub>
+class LVLNHandle {
+    typedef LVLNTree<SHIFT,Sub> Tree;
+
+    std::ptrdiff_t tree;
+    static default_allocator<Tree> lvln_alloc;
+
+    // if bit is set, we have a Dnode* ptr instead of a LVLNTree ptr
+    bool   bit()  { return BIT( tree); }
+    Tree*  ptr()  { assert( ! bit()); return PTR(Tree*,tree); }
+    Dnode* node() { assert(   bit()); return PTR(Dnode*,tree); }
+
+    void set_ptr( Tree* p) { tree = reinterpret_cast< std::ptrdiff_t>(p);}
+    void set_node( Dnode* p) { tree = reinterpret_cast< std::ptrdiff_t>(p)|1;}
+
+public:
+    bool isNull() const { return tree == 0;}
+    bool isTree() const { return tree != 0;}
+
+    Dnode*  maxx() {
+        assert( isTree());
+        if ( bit())
+            return node();
+        return ptr()->maxx;
+    }
+    Dnode*  minx() {
+        assert( isTree());
+        if ( bit())
+            return node();
+        return ptr()->minx;
+    }
+    Key64 maxKeyx() {
+        return maxx()->getinfo();
+    }
+
+    bool operator==( LVLNHandle p) const { return tree == p.tree; }
+    bool operator!=( LVLNHandle p) const { return tree != p.tree; }
+
+    void insert(Type listItem,Key64 key, Dlist& D) {
+        assert( isTree());
+        if ( bit()) {
+            if ( key != (Key64)(node()->getinfo())) {
+                // new key: deferred creation and insertion, do it now
+#ifndef USE_LEDA_MEMORY
+                Tree* p = lvln_alloc.allocate(1);
+                lvln_alloc.construct( p, Tree( node()));
+                assert(((std::ptrdiff_t)(p) & 1) == 0);
+                set_ptr(p);
+#else
+                set_ptr( new Tree( node()));
+#endif
+                ptr()->insert_2nd( listItem, key, D);
+            }
+        } else {
+            ptr()->insert( listItem, key, D);
+        }
+    }
+    void del(Key64 key, Dlist& D) {
+        assert( isTree());
+        if ( bit()) {
+            if ( key == (Key64)(node()->getinfo())) {
+                D.remove( node());
+                tree = 0;
+            }
+        } else {
+            if ( ptr()->del( key, D)) { // only one element left in tree
+                Dnode* p = ptr()->maxx;
+#ifndef USE_LEDA_MEMORY
+                lvln_alloc.destroy( ptr());
+                lvln_alloc.deallocate( ptr(),1);
+#else
+                delete ptr();
+#endif
+                set_node(p);
+            }
+        }
+    }
+    // frees the LVLNTree and those below it, not its list nodes
+    void destroy() {
+        if ( isTree() && ! bit()) {
+            ptr()->destroy();
+#ifndef USE_LEDA_MEMORY
+            lvln_alloc.destroy( ptr());
+            lvln_alloc.deallocate( ptr(),1);
+#else
+            delete ptr();
+#endif
+        }
+        tree = 0;
+    }
+    Dnode* locateNode(Key64 key) {
+        assert( isTree());
+        if ( bit()) {
+            Dnode* p = node();
+            if (key <= (Key64)(p->getinfo()))
+                return p;
+            return p->getright();
+        }
+        return ptr()->locateNode(key);
+    }
+    LVLNHandle() : tree(0) {}
+    // wraps an element already in the list
+    explicit LVLNHandle( Dnode* node) { set_node( node); }
+    LVLNHandle( Type listItem,Key64 key,Dlist& D,Dnode *next) {
+        D.insertleft(listItem,next);  // store element in the list
+        // deferred creation and insertion, store the node pointer only
+        set_node( (*next).getleft());
+    }
+};
+
+template <int SHIFT, class Sub>
+default_allocator< LVLNTree<SHIFT,Sub> > LVLNHandle<SHIFT,Sub>::lvln_alloc;
+
+// The levels below the 16 bits of LVL1Tree64: four LVLNTrees on bits 47 down
+// to 16, then LVL2Tree and LVL3Tree.
+typedef LVLNHandle< 16, LVL2Handle >  LVL16Handle;
+typedef LVLNHandle< 24, LVL16Handle > LVL24Handle;
+typedef LVLNHandle< 32, LVL24Handle > LVL32Handle;
+typedef LVLNHandle< 40, LVL32Handle > LVL64Handle;
+
+#endif //  MAP32_LVLNTREE_H
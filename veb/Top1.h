@@ -20,15 +20,18 @@
 
 #include <iostream>
 
+// The table for ms_one is a static 64KB array shared by all Top1s and
+// initialized automatically once at program startup (see below), so that
+// constructing a Top1 is cheap.
+static unsigned char Top1_msTable[65536];
+
 class Top1 {	
     unsigned int hi1;      // left  of tree top layer; most significant bits
     unsigned int hi2;      // right of tree top layer; least significant bits
     unsigned int mid[64];  // tree middle layer
     unsigned int lo[2048]; // tree lower layer
 
-    unsigned char msTable[65536]; // Table for ms_one
-
-    unsigned int ms_one(unsigned int); 
+    static unsigned int ms_one(unsigned int); 
     unsigned int ms_oneT(unsigned int); // table based version
     unsigned int ls_one(unsigned int);
 
@@ -46,6 +49,8 @@ public:
     unsigned int maxMin();
 
     void printDebugList(  std::ostream& out = std::cerr);
+
+    friend struct Auto_init_ms_table;
 };
 
 inline unsigned int Top1::ms_one(unsigned int mry) {
@@ -59,9 +64,9 @@ inline unsigned int Top1::ms_one(unsigned int mry) {
 // version with 16 bit lookup table
 inline unsigned int Top1::ms_oneT(unsigned int x) {
     if(x>65535)
-        return msTable[x>>16]+16;
+        return Top1_msTable[x>>16]+16;
     else
-        return msTable[x];    
+        return Top1_msTable[x];    
 }
 
 inline unsigned int Top1::ls_one(unsigned int x) { // position least sign. one
@@ -104,9 +109,9 @@ inline unsigned int Top1::findMid(unsigned int elem, unsigned int apos) {
     unsigned int tmp; 
     tmp = mid[apos]&(0xffffffffu>>elem);
     if(tmp>65535)
-        tmp = msTable[tmp>>16]+16;        // ms_one replacement
+        tmp = Top1_msTable[tmp>>16]+16;        // ms_one replacement
     else
-        tmp = msTable[tmp];   
+        tmp = Top1_msTable[tmp];   
     apos = (apos<<5) + 31 - tmp;
     return apos;
 }
@@ -115,8 +120,8 @@ inline unsigned int Top1::findMid(unsigned int elem, unsigned int apos) {
 inline unsigned int Top1::findLo(unsigned int elem, unsigned int apos) {
     unsigned int tmp = lo[apos]&(0xffffffffu >> elem);
     if ( tmp>65535)
-        tmp = msTable[tmp>>16]+16; // ms_one replacement
-    else tmp = msTable[tmp];   
+        tmp = Top1_msTable[tmp>>16]+16; // ms_one replacement
+    else tmp = Top1_msTable[tmp];   
     return (apos<<5) + 31 - tmp;
     // } 
 } 
@@ -128,11 +133,18 @@ inline Top1::Top1() {
         mid[i] = 0;
     hi1 = 0;
     hi2 = 0;
-    // init table for ms_one
-    for(int e=0;e<65536;e++)
-        msTable[e] = ms_one(e);
 }
 
+struct Auto_init_ms_table {
+    Auto_init_ms_table() {
+        for(int e=0;e<65536;e++)
+            Top1_msTable[e] = Top1::ms_one(e);
+    }
+};
+
+// This static variable triggers the initialization of the table for ms_one
+static Auto_init_ms_table auto_init_ms_table;
+
 // Check if x is an element
 bool Top1::isElement(unsigned int x) {
     unsigned int elem = x;
@@ -155,9 +167,9 @@ inline unsigned int Top1::findN(unsigned int next) {
     // if there are still bits left in pos then result is in same lo[] field
     if (pos!=0){   
         if(pos>65535)
-            pos = msTable[pos>>16]+16;      
+            pos = Top1_msTable[pos>>16]+16;      
         else
-            pos = msTable[pos];   
+            pos = Top1_msTable[pos];   
         return (midPos<<5) + 31 - pos;
     } else {          
         // We have to get one level up in the tree since the current integer
@@ -167,9 +179,9 @@ inline unsigned int Top1::findN(unsigned int next) {
         pos = mid[hiPos]&(0xffffffffu>>(midPos&31));
         if(pos!=0){ // Found non-zero position in mid[]
             if(pos>65535)
-                pos = msTable[pos>>16]+16; // ms_one replacement
+                pos = Top1_msTable[pos>>16]+16; // ms_one replacement
             else
-                pos = msTable[pos];
+                pos = Top1_msTable[pos];
             pos = (hiPos<<5) + 31 - pos ;  
             return findLo(0,pos);  		
         } else { // mid[] was zero, we continue in the high level.
@@ -11,40 +11,135 @@
 
 #include <veb/LVL1Tree.h>
 #include <iostream>
+#include <new>
+#include <type_traits>
 
 template <class KeyType, class ValueType> class STree
 {
-    LVL1Tree* l1t;
-    ValueType val;
+    // 32-bit keys take the original three levels, 64-bit keys the four
+    // middle levels of LVLNTree.h on top of them.
+    typedef typename std::conditional<sizeof(KeyType) == 8, LVL1Tree64, LVL1Tree>::type Tree;
+
+    // The values live in the list nodes, next to their keys.
+    static_assert(sizeof(ValueType) <= sizeof(Type) && std::is_trivially_copyable<ValueType>::value, "STree values must be trivially copyable and fit in 64 bits");
+
+    Tree* l1t;
+
+    static ValueType* value_of(Dnode* node)
+    {
+        return static_cast<ValueType*>(node->getvalue());
+    }
 public:
+    // In-order iteration along the list of keys under the tree (between
+    // its two sentinel nodes). Any insert or remove invalidates an
+    // Iterator.
+    class Iterator
+    {
+        Dnode* node;
+        Dlist* list;
+    public:
+        Iterator(Dnode* node, Dlist* list) : node(node), list(list)
+        {
+            if(node == list->firstnode() || node == list->lastnode())
+            {
+                this->node = 0;
+            }
+        }
+        inline bool valid() const
+        {
+            return node != 0;
+        }
+        inline KeyType key() const
+        {
+            return (KeyType)node->getinfo();
+        }
+        inline ValueType& value() const
+        {
+            return *value_of(node);
+        }
+        inline void next()
+        {
+            node = node->getright();
+            if(node == list->lastnode())
+            {
+                node = 0;
+            }
+            return;
+        }
+        inline void prev()
+        {
+            node = node->getleft();
+            if(node == list->firstnode())
+            {
+                node = 0;
+            }
+            return;
+        }
+    };
+
     STree()
     {
-        if(sizeof(KeyType) != 4)
+        if(sizeof(KeyType) != 4 && sizeof(KeyType) != 8)
         {
-            cerr << "FATAL ERROR: STree only works on 32-bit keys!" << endl;
+            cerr << "FATAL ERROR: STree only works on 32 and 64-bit keys!" << endl;
             l1t = 0;
         }
         else
         {
-            l1t = new LVL1Tree;
+            l1t = new Tree;
         }
     }
-    void insert(const KeyType& key, const KeyType& value)
+    // The list items are the keys themselves: the levels below compare
+    // them with the keys searched for. An existing key gets the new value.
+    void insert(const KeyType& key, const ValueType& value)
     {
-        l1t->insert(value, key);
+        Dnode* node = l1t->insert(key, key);
+        new(node->getvalue()) ValueType(value);
         return;
     }
+    // The value of the largest key <= key, or 0. locateNode finds the
+    // successor, so the predecessor is it or its left neighbour.
     ValueType* locate(const KeyType& key)
     {
-        l1t->locateNode(key);
-        return 0;
-        //return &val;
+        Dnode* node = l1t->locateNode(key);
+        if(!node)
+        {
+            node = l1t->D.lastnode();
+        }
+        if((KeyType)node->getinfo() != key || node == l1t->D.lastnode())
+        {
+            node = node->getleft();
+        }
+        return node == l1t->D.firstnode() ? 0 : value_of(node);
     }
     void remove(const KeyType& key)
     {
         l1t->del(key);
         return;
     }
+    Iterator first()
+    {
+        return Iterator(l1t->D.firstnode()->getright(), &l1t->D);
+    }
+    Iterator last()
+    {
+        return Iterator(l1t->D.lastnode()->getleft(), &l1t->D);
+    }
+    // At the smallest key >= key.
+    Iterator lower_bound(const KeyType& key)
+    {
+        Dnode* node = l1t->locateNode(key);
+        return node ? Iterator(node, &l1t->D) : Iterator(l1t->D.lastnode(), &l1t->D);
+    }
+    // callback(key, value) for every key in [lo, hi], in order.
+    template <class Callback> void scan(const KeyType& lo, const KeyType& hi, Callback callback)
+    {
+        for(Iterator it = lower_bound(lo); it.valid() && !(hi < it.key()); it.next())
+        {
+            callback(it.key(), it.value());
+        }
+        return;
+    }
     ~STree()
     {
         delete l1t;